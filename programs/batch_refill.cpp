@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+
+// A slot can take a new isomer once its current one has converged, failed or if it never held one.
+inline bool is_finished(const IsomerStatus status)
+{
+    return status == IsomerStatus::CONVERGED || status == IsomerStatus::FAILED || status == IsomerStatus::EMPTY;
+}
+
+/**
+ * @brief Stream compaction over B.statuses, collects the indices of all finished slots (CONVERGED, FAILED or EMPTY) in ascending order.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param slots Output buffer of at least B.capacity() elements, the first n entries receive the slot indices.
+ * @return n, the number of finished slots.
+ */
+template <typename T, typename K, StoragePolicy S>
+size_t compact_finished(sycl::queue &Q, IsomerBatch<T, K, S> &B, sycl::buffer<size_t, 1> &slots)
+{
+    sycl::buffer<size_t, 1> count(sycl::range<1>(1));
+    const size_t capacity = B.capacity();
+    const size_t group_size = std::min<size_t>(256, Q.get_device().get_info<sycl::info::device::max_work_group_size>());
+    Q.submit([&](sycl::handler &h)
+             {
+        auto statuses_acc = B.statuses.view(h, sycl::read_only);
+        sycl::local_accessor<size_t, 1> scan_scratch(scan_scratch_size(group_size), h);
+        sycl::accessor slots_acc(slots, h, sycl::write_only, sycl::no_init);
+        sycl::accessor count_acc(count, h, sycl::write_only, sycl::no_init);
+
+        // A single work-group sweeps the statuses, the running offset keeps the slots in ascending order.
+        h.parallel_for<class compact>(sycl::nd_range(sycl::range{group_size}, sycl::range{group_size}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            size_t offset = 0;
+            for (size_t i = 0; i < capacity; i += group_size)
+            {
+                size_t slot = i + tid;
+                size_t finished = (slot < capacity && is_finished(statuses_acc[slot])) ? 1 : 0;
+                size_t idx = exclusive_scan<size_t>(cta, finished, scan_scratch.get_pointer(), sycl::plus<size_t>{}, 0);
+                if (finished) slots_acc[offset + idx] = slot;
+                offset += sycl::reduce_over_group(cta, finished, sycl::plus<size_t>{});
+            }
+            if (tid == 0) count_acc[0] = offset;
+        }); });
+    sycl::host_accessor count_h(count, sycl::read_only);
+    return count_h[0];
+}
+
+/**
+ * @brief Swaps finished isomers out of B and new isomers into exactly those slots.
+ *        finished[i] receives the isomer in slot slots[i] for i < n_slots, the remaining entries of finished are marked EMPTY.
+ *        incoming[(incoming_first + i) % capacity] is loaded into slot slots[i] for i < n_new, slots beyond that are marked EMPTY.
+ *        incoming is used as a ring, so graphs staged for later launches can stay where they are while the front is consumed.
+ * @param Q The queue to submit the kernels to.
+ * @param B The batch being optimised.
+ * @param slots Slot indices as returned by compact_finished.
+ * @param n_slots Number of valid entries in slots.
+ * @param finished Batch receiving the results, same N and capacity as B.
+ * @param incoming Batch holding the new isomers, same N and capacity as B.
+ * @param n_new Number of new isomers in incoming.
+ * @param incoming_first Entry of incoming holding the first new isomer, the others follow it and wrap around the end.
+ */
+template <typename T, typename K, StoragePolicy S>
+void refill(sycl::queue &Q, IsomerBatch<T, K, S> &B, sycl::buffer<size_t, 1> &slots, const size_t n_slots, IsomerBatch<T, K, S> &finished, IsomerBatch<T, K, S> &incoming, const size_t n_new, const size_t incoming_first = 0)
+{
+    assert(B.N() == finished.N() && B.N() == incoming.N() && n_new <= n_slots);
+    const size_t N = B.N(), capacity = incoming.capacity();
+    if (n_slots > 0)
+    {
+        Q.submit([&](sycl::handler &h)
+                 {
+            sycl::accessor slots_acc(slots, h, sycl::read_only);
+            auto X_acc = B.X.view(h);
+            auto xys_acc = B.xys.view(h);
+            auto neighbours_acc = B.cubic_neighbours.view(h);
+            auto IDs_acc = B.IDs.view(h);
+            auto iterations_acc = B.iterations.view(h);
+            auto statuses_acc = B.statuses.view(h);
+            auto out_X_acc = finished.X.view(h, sycl::write_only);
+            auto out_neighbours_acc = finished.cubic_neighbours.view(h, sycl::write_only);
+            auto out_IDs_acc = finished.IDs.view(h, sycl::write_only);
+            auto out_iterations_acc = finished.iterations.view(h, sycl::write_only);
+            auto out_statuses_acc = finished.statuses.view(h, sycl::write_only);
+            auto in_X_acc = incoming.X.view(h, sycl::read_only);
+            auto in_xys_acc = incoming.xys.view(h, sycl::read_only);
+            auto in_neighbours_acc = incoming.cubic_neighbours.view(h, sycl::read_only);
+            auto in_IDs_acc = incoming.IDs.view(h, sycl::read_only);
+            auto in_iterations_acc = incoming.iterations.view(h, sycl::read_only);
+            auto in_statuses_acc = incoming.statuses.view(h, sycl::read_only);
+
+            // One work-item per atom of every slot being swapped.
+            h.parallel_for<class refill_slots>(sycl::range{n_slots * N}, [=](sycl::item<1> item) {
+                size_t i = item.get_linear_id() / N;
+                size_t atom = item.get_linear_id() % N;
+                size_t slot = slots_acc[i];
+
+                out_X_acc[i * N + atom] = X_acc[slot * N + atom];
+                for (int j = 0; j < 3; j++) out_neighbours_acc[(i * N + atom) * 3 + j] = neighbours_acc[(slot * N + atom) * 3 + j];
+                if (atom == 0)
+                {
+                    out_IDs_acc[i] = IDs_acc[slot];
+                    out_iterations_acc[i] = iterations_acc[slot];
+                    out_statuses_acc[i] = statuses_acc[slot];
+                }
+
+                if (i < n_new)
+                {
+                    size_t in = (incoming_first + i) % capacity;
+                    X_acc[slot * N + atom] = in_X_acc[in * N + atom];
+                    xys_acc[slot * N + atom] = in_xys_acc[in * N + atom];
+                    for (int j = 0; j < 3; j++) neighbours_acc[(slot * N + atom) * 3 + j] = in_neighbours_acc[(in * N + atom) * 3 + j];
+                    if (atom == 0)
+                    {
+                        IDs_acc[slot] = in_IDs_acc[in];
+                        iterations_acc[slot] = in_iterations_acc[in];
+                        statuses_acc[slot] = in_statuses_acc[in];
+                    }
+                }
+                else if (atom == 0)
+                {
+                    statuses_acc[slot] = IsomerStatus::EMPTY;
+                }
+            }); });
+    }
+
+    Q.submit([&](sycl::handler &h)
+             {
+        auto out_statuses_acc = finished.statuses.view(h, sycl::write_only);
+        h.parallel_for<class refill_tail>(sycl::range{finished.capacity()}, [=](sycl::item<1> item) {
+            if (item.get_linear_id() >= n_slots) out_statuses_acc[item.get_linear_id()] = IsomerStatus::EMPTY;
+        }); });
+}
@@ -0,0 +1,210 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+
+// Snapshots of the isomers a queue has in flight, so that a long campaign can be restarted after the process dies.
+// Layout: CheckpointHeader | X (capacity * N coord3d) | cubic_neighbours (capacity * N * 3 K) | IDs | iterations | statuses (capacity each).
+// The CG search direction is not stored: every launch of forcefield_optimise restarts CG from steepest descent, so X and the counters are the whole state.
+
+constexpr char CHECKPOINT_MAGIC[8] = {'I', 'S', 'O', 'C', 'K', 'P', '0', '1'};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint64_t N;
+    uint64_t capacity;
+    uint32_t real_width;
+    uint32_t node_width;
+    uint64_t sequence; //Number of snapshots taken before this one
+};
+
+/**
+ * @brief Writes snapshots of a batch from a background thread. The copies of the batch to pinned host memory are enqueued behind the running launch,
+ *        the writer thread waits for them and writes them to disk, so neither the copies nor the disk write hold up the caller or the next launches.
+ *        Each snapshot is written to path + ".tmp" and renamed over path, so path always holds a complete snapshot.
+ */
+template <typename T, typename K>
+struct Checkpointer
+{
+    TEMPLATE_TYPEDEFS(T, K);
+
+    /**
+     * @param path The checkpoint file.
+     * @param Q Queue the snapshotted batches live on, the copies are enqueued on it and the pinned staging memory is taken from its UsmPool.
+     * @param N Atoms per isomer.
+     * @param capacity Capacity of the batches that are snapshotted.
+     */
+    Checkpointer(const std::string &path, sycl::queue &Q, const size_t N, const size_t capacity) : path(path), Q(Q), N(N), capacity(capacity)
+    {
+        X = pool_malloc<coord3d>(capacity * N, Q, sycl::usm::alloc::host);
+        cubic_neighbours = pool_malloc<K>(capacity * N * 3, Q, sycl::usm::alloc::host);
+        IDs = pool_malloc<size_t>(capacity, Q, sycl::usm::alloc::host);
+        iterations = pool_malloc<size_t>(capacity, Q, sycl::usm::alloc::host);
+        statuses = pool_malloc<IsomerStatus>(capacity, Q, sycl::usm::alloc::host);
+        writer = std::thread([this]() { write_loop(); });
+    }
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+    ~Checkpointer()
+    {
+        {
+            std::lock_guard lock(mutex);
+            closing = true;
+        }
+        cv.notify_all();
+        writer.join();
+        pool_free(X, Q);
+        pool_free(cubic_neighbours, Q);
+        pool_free(IDs, Q);
+        pool_free(iterations, Q);
+        pool_free(statuses, Q);
+    }
+
+    /**
+     * @brief Enqueues copies of the batch into the staging memory and hands them to the writer thread, without waiting for them.
+     *        On an in-order queue the snapshot is of the batch as the work submitted before the call leaves it.
+     *        If the previous snapshot is still being written the call returns immediately, a slow disk costs snapshots rather than device time.
+     * @return True if a snapshot was taken.
+     */
+    template <StoragePolicy S>
+    bool snapshot(IsomerBatch<T, K, S> &B)
+    {
+        assert(B.N() == N && B.capacity() == capacity);
+        {
+            std::lock_guard lock(mutex);
+            if (pending) return false;
+        }
+        copies = {B.X.download(Q, X, capacity * N), B.cubic_neighbours.download(Q, cubic_neighbours, capacity * N * 3), B.IDs.download(Q, IDs, capacity),
+                  B.iterations.download(Q, iterations, capacity), B.statuses.download(Q, statuses, capacity)};
+        {
+            std::lock_guard lock(mutex);
+            pending = true;
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    //Blocks until the last snapshot is on disk.
+    void wait()
+    {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [this]() { return !pending; });
+    }
+
+  private:
+    std::string path;
+    sycl::queue Q;
+    size_t N, capacity;
+    coord3d *X;
+    K *cubic_neighbours;
+    size_t *IDs, *iterations;
+    IsomerStatus *statuses;
+    std::vector<sycl::event> copies; //Device to host copies of the pending snapshot
+    uint64_t sequence = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool pending = false, closing = false;
+    std::thread writer;
+
+    void write_loop()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [this]() { return closing || pending; });
+                if (!pending) return;
+            }
+            for (auto &event : copies) event.wait();
+            CheckpointHeader header;
+            std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+            header.N = N;
+            header.capacity = capacity;
+            header.real_width = sizeof(T);
+            header.node_width = sizeof(K);
+            header.sequence = sequence++;
+            std::string tmp_path = path + ".tmp";
+            {
+                std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char *>(X), capacity * N * sizeof(coord3d));
+                file.write(reinterpret_cast<const char *>(cubic_neighbours), capacity * N * 3 * sizeof(K));
+                file.write(reinterpret_cast<const char *>(IDs), capacity * sizeof(size_t));
+                file.write(reinterpret_cast<const char *>(iterations), capacity * sizeof(size_t));
+                file.write(reinterpret_cast<const char *>(statuses), capacity * sizeof(IsomerStatus));
+                if (!file) std::cerr << "Checkpointer: failed to write " << tmp_path << "\n";
+            }
+            std::rename(tmp_path.c_str(), path.c_str());
+            {
+                std::lock_guard lock(mutex);
+                pending = false;
+            }
+            cv.notify_all();
+        }
+    }
+};
+
+/**
+ * @brief Restores a batch from a checkpoint written by Checkpointer. B grows to the capacity of the checkpoint if it is smaller.
+ * @param path The checkpoint file.
+ * @param Q The queue B lives on.
+ * @param B The batch to restore into, must have the same N as the checkpoint.
+ * @param finished_ids Sorted IDs whose results are already stored, their slots are restored as EMPTY.
+ * @return False if there is no checkpoint at path.
+ * @throws std::runtime_error if the checkpoint is truncated or was written with a different N, T or K.
+ */
+template <typename T, typename K, StoragePolicy S>
+bool load_checkpoint(const std::string &path, sycl::queue &Q, IsomerBatch<T, K, S> &B, const std::vector<uint64_t> &finished_ids = {})
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    CheckpointHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header.N != B.N() || header.real_width != sizeof(T) || header.node_width != sizeof(K))
+        throw std::runtime_error("load_checkpoint: " + path + " is not a checkpoint for this N, T and K");
+
+    size_t capacity = header.capacity, N = header.N;
+    std::vector<coord3d> X(capacity * N);
+    std::vector<K> cubic_neighbours(capacity * N * 3);
+    std::vector<size_t> IDs(capacity), iterations(capacity);
+    std::vector<IsomerStatus> statuses(capacity);
+    file.read(reinterpret_cast<char *>(X.data()), X.size() * sizeof(coord3d));
+    file.read(reinterpret_cast<char *>(cubic_neighbours.data()), cubic_neighbours.size() * sizeof(K));
+    file.read(reinterpret_cast<char *>(IDs.data()), IDs.size() * sizeof(size_t));
+    file.read(reinterpret_cast<char *>(iterations.data()), iterations.size() * sizeof(size_t));
+    file.read(reinterpret_cast<char *>(statuses.data()), statuses.size() * sizeof(IsomerStatus));
+    if (!file) throw std::runtime_error("load_checkpoint: " + path + " is truncated");
+
+    for (size_t i = 0; i < capacity; i++)
+        if (statuses[i] != IsomerStatus::EMPTY && std::binary_search(finished_ids.begin(), finished_ids.end(), (uint64_t)IDs[i]))
+        {
+            statuses[i] = IsomerStatus::EMPTY;
+            IDs[i] = std::numeric_limits<size_t>::max();
+        }
+
+    //Slots beyond the checkpoint, if B is larger, are EMPTY.
+    size_t n = std::max(capacity, B.capacity());
+    X.resize(n * N);
+    cubic_neighbours.resize(n * N * 3, std::numeric_limits<K>::max());
+    IDs.resize(n, std::numeric_limits<size_t>::max());
+    iterations.resize(n, 0);
+    statuses.resize(n, IsomerStatus::EMPTY);
+    B.resize(Q, n);
+    copy(B.X, X.data());
+    copy(B.cubic_neighbours, cubic_neighbours.data());
+    copy(B.IDs, IDs.data());
+    copy(B.iterations, iterations.data());
+    copy(B.statuses, statuses.data());
+    return true;
+}
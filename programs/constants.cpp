@@ -40,7 +40,22 @@ struct Constants{
      * @param isomer_idx The index of the isomer that the current thread is a part of
      * @return Forcefield constants for the current node in the isomer_idx^th isomer in G
      */
-    inline Constants(const accessor<K, 1, access::mode::read> cubic_neighbours, sycl::group<1>& cta){
+    template <typename View>
+    inline Constants(const View cubic_neighbours, sycl::group<1>& cta) : Constants(cubic_neighbours, cta.get_group_linear_id(), cta.get_local_linear_range(), cta.get_local_linear_id()) {}
+
+    Constants() = default;
+
+    /**
+     * @brief Constructor for the constants of an explicit node, for kernels where a work-item handles several nodes.
+     *
+     * @param cubic_neighbours The neighbour lists of every isomer in the batch
+     * @param isomer_idx The index of the isomer
+     * @param N Number of nodes per isomer
+     * @param tid The node
+     * @return Forcefield constants for the tid^th node in the isomer_idx^th isomer
+     */
+    template <typename View>
+    inline Constants(const View cubic_neighbours, const size_t isomer_idx, const size_t N, const size_t tid){
 
         constexpr real_t optimal_corner_cos_angles[2] = {-0.30901699437494734, -0.5}; 
         constexpr real_t optimal_bond_lengths[3] = {1.479, 1.458, 1.401}; 
@@ -50,16 +65,12 @@ struct Constants{
         constexpr real_t dih_forces[4] = {35.0,65.0,85.0,270.0}; 
         //constexpr float flat_forces[3] = {0., 0., 0.};
         //Set pointers to start of fullerene.
-        auto isomer_idx = cta.get_group_linear_id();
-        auto tid = cta.get_local_linear_id();
-        auto N = cta.get_local_linear_range();
-
         auto face_index = [&](int f1, int f2, int f3){
             return f1*4 + f2*2 + f3;
         };
 
 
-        const DeviceCubicGraph<K> FG(cubic_neighbours, isomer_idx*N*3);
+        const DeviceCubicGraph FG(cubic_neighbours, isomer_idx*N*3);
         node3 neighbours = {FG[tid*3], FG[tid*3 + 1], FG[tid*3 + 2]};
         //       m    p
         //    f5_|   |_f4
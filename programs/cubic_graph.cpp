@@ -1,16 +1,17 @@
 #include <array>
 
-template <typename K>
+//View is any kernel side view of the neighbour array, a read accessor for buffer backed batches or a UsmView for USM backed ones.
+template <typename K, typename View = accessor<K, 1, access::mode::read>>
 struct DeviceCubicGraph{
     static_assert(std::is_integral<K>::value, "K must be integral");
-    const accessor<K, 1, access::mode::read> cubic_neighbours;
+    const View cubic_neighbours;
     const size_t offset;
 
     inline K operator[](const K i) const{
         return cubic_neighbours[i + offset];
     }
 
-    DeviceCubicGraph(const accessor<K, 1, access::mode::read> cubic_neighbours, size_t offset) : cubic_neighbours(cubic_neighbours), offset(offset) {}
+    DeviceCubicGraph(const View cubic_neighbours, size_t offset) : cubic_neighbours(cubic_neighbours), offset(offset) {}
 
     /** @brief Find the index of the neighbour v in the list of neighbours of u
     // @param u: source node in the arc (u,v)
@@ -111,4 +112,7 @@ struct DeviceCubicGraph{
         //assert(next_on_face(u,v) == start_node);
         return min_edge;
     }
-};
\ No newline at end of file
+};
+
+template <typename View>
+DeviceCubicGraph(const View, size_t) -> DeviceCubicGraph<std::remove_cv_t<typename View::value_type>, View>;
@@ -0,0 +1,202 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+
+//True if the program carries kernels the device can run. A DPC++ build for nvptx64 only, see CMakeLists.txt, has none for CPUs or GPUs of other vendors.
+inline bool has_kernels_for(const sycl::device &device)
+{
+#ifdef SYCL_IMPLEMENTATION_ONEAPI
+    return sycl::has_kernel_bundle<sycl::bundle_state::executable>(sycl::context(device), {device});
+#else
+    //Other implementations only expose the backends they were built for, see HIPSYCL_TARGETS.
+    return true;
+#endif
+}
+
+/**
+ * @brief The devices of every platform to schedule on, with CPUs split into sub-devices so that each queue stays inside one NUMA domain.
+ *        The same physical device is often exposed by several backends, e.g. CUDA and OpenCL, so a device is skipped if an earlier platform already exposed one of the same name.
+ *        The platform of the default GPU is searched first, if there is one, so such a device is used through the default backend.
+ *        Devices the program has no kernels for, and the host device, are skipped.
+ *        CPUs are partitioned by NUMA affinity domain where supported, otherwise into sub-devices of cpu_units_per_queue compute units each.
+ * @param partition_cpus If false, CPUs are returned whole.
+ * @param cpu_units_per_queue Compute units per sub-device when the CPU cannot be split by NUMA domain, 0 keeps the CPU whole in that case.
+ */
+inline std::vector<sycl::device> schedulable_devices(const bool partition_cpus = true, const size_t cpu_units_per_queue = 0)
+{
+    std::vector<sycl::platform> platforms = sycl::platform::get_platforms();
+    //The selector throws on nodes without a GPU, the platforms are then searched in the runtime's order.
+    try
+    {
+        sycl::platform preferred = sycl::device(sycl::gpu_selector_v).get_platform();
+        std::stable_partition(platforms.begin(), platforms.end(), [&](const sycl::platform &platform) { return platform == preferred; });
+    }
+    catch (sycl::exception &) {}
+    std::vector<sycl::device> devices;
+    //Devices of each name exposed by the platforms searched so far. There is no portable device UUID, the name tells physical devices apart well enough across backends.
+    std::map<std::string, size_t> claimed;
+    for (auto &platform : platforms)
+    {
+        std::map<std::string, size_t> exposed;
+        for (auto &device : platform.get_devices())
+        {
+            if (device.is_host() || !has_kernels_for(device)) continue;
+            std::string name = device.get_info<sycl::info::device::name>();
+            if (exposed[name]++ < claimed[name]) continue;
+            if (!device.is_cpu() || !partition_cpus || device.get_info<sycl::info::device::partition_max_sub_devices>() < 2)
+            {
+                devices.push_back(device);
+                continue;
+            }
+            auto properties = device.get_info<sycl::info::device::partition_properties>();
+            auto domains = device.get_info<sycl::info::device::partition_affinity_domains>();
+            auto supports = [](auto &list, auto value) { return std::find(list.begin(), list.end(), value) != list.end(); };
+            std::vector<sycl::device> sub_devices;
+            //Runtimes may advertise a partitioning and still refuse it on a single-socket machine, in which case we fall through.
+            try
+            {
+                if (supports(properties, sycl::info::partition_property::partition_by_affinity_domain) && supports(domains, sycl::info::partition_affinity_domain::numa))
+                    sub_devices = device.create_sub_devices<sycl::info::partition_property::partition_by_affinity_domain>(sycl::info::partition_affinity_domain::numa);
+                else if (cpu_units_per_queue > 0 && supports(properties, sycl::info::partition_property::partition_equally))
+                    sub_devices = device.create_sub_devices<sycl::info::partition_property::partition_equally>(cpu_units_per_queue);
+            }
+            catch (sycl::exception &) { sub_devices.clear(); }
+            if (sub_devices.empty()) devices.push_back(device);
+            else devices.insert(devices.end(), sub_devices.begin(), sub_devices.end());
+        }
+        for (auto &[name, count] : exposed) claimed[name] = std::max(claimed[name], count);
+    }
+    return devices;
+}
+
+/**
+ * @brief Hands out ranges of a stream of n items to competing workers. Faster devices simply come back for more, which balances the load without knowing their speed up front.
+ */
+struct WorkCounter
+{
+    explicit WorkCounter(const size_t n_items) : n_items(n_items) {}
+
+    /**
+     * @brief Claims the next range of at most max_count items, thread safe.
+     * @return The first item of the range and the number of items claimed, which is 0 once the stream is exhausted.
+     */
+    std::pair<size_t, size_t> claim(const size_t max_count)
+    {
+        size_t first = next.fetch_add(max_count);
+        if (first >= n_items) return {n_items, 0};
+        return {first, std::min(max_count, n_items - first)};
+    }
+
+    size_t size() const { return n_items; }
+
+  private:
+    const size_t n_items;
+    std::atomic<size_t> next{0};
+};
+
+/**
+ * @brief One in-order queue per (sub-)device, and a host thread per queue to drive it.
+ *        Every queue has an in-order copy queue on the same device and context beside it, for host transfers that should overlap with the kernels of the queue.
+ *        Every queue gets an asynchronous handler, so errors of kernels that were never waited on are reported by the next wait_and_throw() or throw_asynchronous() on that queue
+ *        instead of being lost. The handler prints them and keeps the first, which for_each_queue rethrows.
+ */
+struct DeviceScheduler
+{
+    /**
+     * @param devices The devices to schedule on, see schedulable_devices().
+     * @param profiling Create the queues with enable_profiling, needed by the Profiler.
+     */
+    explicit DeviceScheduler(const std::vector<sycl::device> &devices, const bool profiling = false) : async_error(std::make_shared<AsyncError>())
+    {
+        auto handler = [error = async_error](sycl::exception_list exceptions)
+        {
+            for (auto &e : exceptions)
+            {
+                try { std::rethrow_exception(e); }
+                catch (std::exception &ex) { std::cerr << "Asynchronous SYCL error: " << ex.what() << "\n"; }
+                std::lock_guard lock(error->mutex);
+                if (!error->first) error->first = e;
+            }
+        };
+        sycl::property_list properties = profiling ? sycl::property_list{sycl::property::queue::in_order(), sycl::property::queue::enable_profiling()} : sycl::property_list{sycl::property::queue::in_order()};
+        for (auto &device : devices)
+        {
+            queues.emplace_back(device, handler, properties);
+            copy_queues.emplace_back(queues.back().get_context(), device, handler, properties);
+        }
+    }
+    //Schedules on schedulable_devices().
+    explicit DeviceScheduler(const bool profiling = false) : DeviceScheduler(schedulable_devices(), profiling) {}
+
+    size_t size() const { return queues.size(); }
+    sycl::queue &queue(const size_t i) { return queues[i]; }
+    const std::vector<sycl::queue> &all_queues() const { return queues; }
+    //The copy queue beside queue(i). Copies on it are only ordered against the kernels of queue(i) through buffer accessors or events, not by the queue.
+    sycl::queue &copy_queue(const size_t i) { return copy_queues[i]; }
+    const std::vector<sycl::queue> &all_copy_queues() const { return copy_queues; }
+
+    /**
+     * @brief Calls f(Q, i) for every queue, each on its own host thread, and waits for all of them.
+     *        Each worker should pull its work from a shared WorkCounter.
+     * @throws The first exception thrown by any of the workers, after every worker has returned.
+     */
+    template <typename F>
+    void for_each_queue(F &&f)
+    {
+        std::vector<std::thread> workers;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        for (size_t i = 0; i < queues.size(); i++)
+            workers.emplace_back([&, i]()
+                                 {
+                try { f(queues[i], i); }
+                catch (...)
+                {
+                    std::lock_guard lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                } });
+        for (auto &worker : workers) worker.join();
+        for (auto &Q : queues) Q.throw_asynchronous();
+        for (auto &Q : copy_queues) Q.throw_asynchronous();
+        if (!error)
+        {
+            std::lock_guard lock(async_error->mutex);
+            std::swap(error, async_error->first);
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    /**
+     * @brief Shards a stream of n_items across all queues in ranges of at most chunk items. f(Q, i, first, count) is called for every range.
+     */
+    template <typename F>
+    void run(const size_t n_items, const size_t chunk, F &&f)
+    {
+        WorkCounter counter(n_items);
+        for_each_queue([&](sycl::queue &Q, size_t i)
+                       {
+            while (true)
+            {
+                auto [first, count] = counter.claim(chunk);
+                if (count == 0) break;
+                f(Q, i, first, count);
+            } });
+    }
+
+  private:
+    struct AsyncError
+    {
+        std::mutex mutex;
+        std::exception_ptr first;
+    };
+    std::vector<sycl::queue> queues, copy_queues;
+    std::shared_ptr<AsyncError> async_error; // Shared with the handlers, which may outlive the scheduler inside the runtime
+};
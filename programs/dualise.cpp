@@ -1,6 +1,11 @@
 #include <CL/sycl.hpp>
 #include <iostream>
 #include "util.cpp"
+#include "launch_config.cpp"
+#include "group_scan.cpp"
+#include "device_scheduler.cpp"
+#include "profiler.cpp"
+#include "usm_pool.cpp"
 #include "numeric"
 using namespace cl::sycl;
 
@@ -94,117 +99,126 @@ void sequential_print(group<1> cta, T data) {
 int main(int argc, char** argv){
     size_t N, batch_size, Nf;
     constexpr int MaxDegree = 6;
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <N> <Batch-Size>\n";
+    if (argc < 3 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <N> <Batch-Size> [Chrome trace file]\n";
         return 1;
     }
+    if (argc == 4) Profiler::instance().enable(argv[3]);
 
     N = std::stoi(argv[1]);
     batch_size = std::stoi(argv[2]);
     Nf = N/2 + 2;
 
-    // Selects a GPU device and creates a queue with in-order execution, equivalent to CUDA stream
-    queue Q(gpu_selector_v, property::queue::in_order()); 
-    //queue Q(cpu_selector{});
+    // One in-order queue per device, CPUs are split by NUMA domain. The batch is sharded across them in chunks, a faster device simply claims more chunks.
+    DeviceScheduler scheduler(Profiler::instance().enabled());
+    size_t chunk = std::max<size_t>(1, batch_size / (4*scheduler.size()));
 
-    auto device = Q.get_device();
     std::vector<UINT_TYPE>  dual_neighbours(Nf*MaxDegree*batch_size, 0);
     std::vector<uint8_t>    face_degrees(Nf*batch_size, 0);
     std::vector<UINT_TYPE>  cubic_neighbours(N*3*batch_size, 0);
 
-    fill(dual_neighbours, face_degrees, Nf, batch_size);
-
-    UINT_TYPE* dual_neighbours_dev = (UINT_TYPE*)malloc_device(dual_neighbours.size()*sizeof(UINT_TYPE), Q);
-    uint8_t* face_degrees_dev = (uint8_t*)malloc_device(face_degrees.size()*sizeof(uint8_t), Q);
-    UINT_TYPE* cubic_neighbours_dev = (UINT_TYPE*)malloc_device(cubic_neighbours.size()*sizeof(UINT_TYPE), Q);
-
-
-    global_ptr<UINT_TYPE> dual_neighbours_dev_ptr(dual_neighbours_dev);
-    global_ptr<uint8_t> face_degrees_dev_ptr(face_degrees_dev);
-    buffer<UINT_TYPE,1> dual_neighbours_dev_buf(dual_neighbours_dev_ptr, range{dual_neighbours.size()});
-    buffer<uint8_t, 1> face_deg_buff(range{face_degrees.size()});
-
-    //Create some local shared memory
-    try{
-        Q.memcpy(dual_neighbours_dev, dual_neighbours.data(), dual_neighbours.size()*sizeof(UINT_TYPE));
-        Q.wait_and_throw();
-        Q.memcpy(face_degrees_dev, face_degrees.data(), face_degrees.size()*sizeof(uint8_t));
-        Q.wait_and_throw();
-    }
-    catch (sycl::exception const& e) {
-        std::cout << "Caught asynchronous SYCL exception during memcpy:\n"
-                << e.what() << std::endl;
-        std::terminate();
+    {
+        ProfilePhase phase("fill");
+        fill(dual_neighbours, face_degrees, Nf, batch_size);
     }
-    Q.submit([&](handler &h) {
-        // Create a command group to issue GPU work.
-        local_accessor<UINT_TYPE, 1>    triangle_numbers(Nf*MaxDegree, h);
-        local_accessor<UINT_TYPE, 1>    cached_neighbours(Nf*MaxDegree, h);
-        local_accessor<uint8_t, 1>      cached_degrees(Nf, h);
-        local_accessor<std::array<UINT_TYPE,2>, 1> arc_list(N, h);
-
-        h.parallel_for<class dualise>(nd_range(range{N*batch_size}, range{N}), [=](nd_item<1> nditem) {
-            auto cta = nditem.get_group();
-            auto result = reduce_over_group(cta, 1, plus<int>{}); // Should be size of work-group (N)
-            auto thid = nditem.get_local_linear_id();
-            auto bid = nditem.get_group_linear_id();
+
+    WorkCounter isomers(batch_size);
+    scheduler.for_each_queue([&](queue &Q, size_t) {
+        check_launch(Q.get_device(), N, Nf*MaxDegree*2*sizeof(UINT_TYPE) + Nf*sizeof(uint8_t) + N*sizeof(std::array<UINT_TYPE,2>) + scan_scratch_size(N)*sizeof(UINT_TYPE), "dualise");
+        UINT_TYPE* dual_neighbours_dev = pool_malloc<UINT_TYPE>(Nf*MaxDegree*chunk, Q);
+        uint8_t* face_degrees_dev = pool_malloc<uint8_t>(Nf*chunk, Q);
+        UINT_TYPE* cubic_neighbours_dev = pool_malloc<UINT_TYPE>(N*3*chunk, Q);
+
+        global_ptr<UINT_TYPE> dual_neighbours_dev_ptr(dual_neighbours_dev);
+        global_ptr<uint8_t> face_degrees_dev_ptr(face_degrees_dev);
+
+        while (true) {
+            size_t first, count;
+            std::tie(first, count) = isomers.claim(chunk);
+            if (count == 0) break;
+            profile("dual_neighbours to device", Q, Q.memcpy(dual_neighbours_dev, dual_neighbours.data() + first*Nf*MaxDegree, count*Nf*MaxDegree*sizeof(UINT_TYPE)));
+            profile("face_degrees to device", Q, Q.memcpy(face_degrees_dev, face_degrees.data() + first*Nf, count*Nf*sizeof(uint8_t)));
+            auto event = Q.submit([&](handler &h) {
+                // Create a command group to issue GPU work.
+                local_accessor<UINT_TYPE, 1>    triangle_numbers(Nf*MaxDegree, h);
+                local_accessor<UINT_TYPE, 1>    cached_neighbours(Nf*MaxDegree, h);
+                local_accessor<uint8_t, 1>      cached_degrees(Nf, h);
+                local_accessor<std::array<UINT_TYPE,2>, 1> arc_list(N, h);
+                local_accessor<UINT_TYPE, 1>    scan_scratch(scan_scratch_size(N), h);
+
+                h.parallel_for<class dualise>(nd_range(range{N*count}, range{N}), [=](nd_item<1> nditem) {
+                    auto cta = nditem.get_group();
+                    auto result = reduce_over_group(cta, 1, plus<int>{}); // Should be size of work-group (N)
+                    auto thid = nditem.get_local_linear_id();
+                    auto bid = nditem.get_group_linear_id();
             
-            cta.async_work_group_copy(cached_neighbours.get_pointer(), dual_neighbours_dev_ptr + bid*Nf*MaxDegree, Nf*MaxDegree);
-            cta.async_work_group_copy(cached_degrees.get_pointer(), face_degrees_dev_ptr + bid*Nf, Nf);
-            DeviceDualGraph<MaxDegree, UINT_TYPE> FD(cached_neighbours.get_pointer(), cached_degrees.get_pointer());
-            UINT_TYPE cannon_arcs[MaxDegree]; memset(cannon_arcs, UINT_TYPE_MAX, MaxDegree*sizeof(UINT_TYPE));
-            UINT_TYPE rep_count  = 0;
-            nditem.barrier(access::fence_space::local_space);
-            if (thid < Nf){
-                for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
-                    auto cannon_arc = FD.get_cannonical_triangle_arc(thid, FD.dual_neighbours[thid*MaxDegree + i]);
-                    if (cannon_arc[0] == thid){
-                        cannon_arcs[i] = cannon_arc[1];
-                        rep_count++;
+                    cta.async_work_group_copy(cached_neighbours.get_pointer(), dual_neighbours_dev_ptr + bid*Nf*MaxDegree, Nf*MaxDegree);
+                    cta.async_work_group_copy(cached_degrees.get_pointer(), face_degrees_dev_ptr + bid*Nf, Nf);
+                    DeviceDualGraph<MaxDegree, UINT_TYPE> FD(cached_neighbours.get_pointer(), cached_degrees.get_pointer());
+                    UINT_TYPE cannon_arcs[MaxDegree]; memset(cannon_arcs, UINT_TYPE_MAX, MaxDegree*sizeof(UINT_TYPE));
+                    UINT_TYPE rep_count  = 0;
+                    nditem.barrier(access::fence_space::local_space);
+                    if (thid < Nf){
+                        for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
+                            auto cannon_arc = FD.get_cannonical_triangle_arc(thid, FD.dual_neighbours[thid*MaxDegree + i]);
+                            if (cannon_arc[0] == thid){
+                                cannon_arcs[i] = cannon_arc[1];
+                                rep_count++;
+                            }
+                        }
+                    }
+                    nditem.barrier(access::fence_space::local_space);
+
+                    UINT_TYPE scan_result = exclusive_scan<UINT_TYPE>(cta, rep_count, scan_scratch.get_pointer(), plus<UINT_TYPE>{}, UINT_TYPE(0));
+
+                    if (thid < Nf){
+                        UINT_TYPE arc_count = 0;
+                        for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
+                            if(cannon_arcs[i] != UINT_TYPE_MAX){
+                                triangle_numbers[thid*MaxDegree + i] = scan_result + arc_count;
+                                ++arc_count;
+                            }    
+                        }
                     }
-                }
-            }
-            nditem.barrier(access::fence_space::local_space);
-
-            UINT_TYPE scan_result = exclusive_scan_over_group(cta, rep_count, plus<UINT_TYPE>{});
-
-            if (thid < Nf){
-                UINT_TYPE arc_count = 0;
-                for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
-                    if(cannon_arcs[i] != UINT_TYPE_MAX){
-                        triangle_numbers[thid*MaxDegree + i] = scan_result + arc_count;
-                        ++arc_count;
-                    }    
-                }
-            }
-            nditem.barrier(access::fence_space::local_space);
-
-            if (thid < Nf){
-                for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
-                    if(cannon_arcs[i] != UINT_TYPE_MAX){
-                        auto idx = triangle_numbers[thid*MaxDegree + i];
-                        arc_list[idx] = {UINT_TYPE(thid), cannon_arcs[i]};
+                    nditem.barrier(access::fence_space::local_space);
+
+                    if (thid < Nf){
+                        for (UINT_TYPE i = 0; i < FD.face_degrees[thid]; i++){
+                            if(cannon_arcs[i] != UINT_TYPE_MAX){
+                                auto idx = triangle_numbers[thid*MaxDegree + i];
+                                arc_list[idx] = {UINT_TYPE(thid), cannon_arcs[i]};
+                            }
+                        }
                     }
-                }
-            }
-            nditem.barrier(access::fence_space::local_space);
+                    nditem.barrier(access::fence_space::local_space);
 //
-            auto [u, v] = arc_list[thid];
-           /*  if(bid == 0){
-                //printf("ThreadID: %d,\n ", thid);
-                sequential_print(cta, rep_count);
-            } */
-            auto w = FD.next(u,v);
+                    auto [u, v] = arc_list[thid];
+                   /*  if(bid == 0){
+                        //printf("ThreadID: %d,\n ", thid);
+                        sequential_print(cta, rep_count);
+                    } */
+                    auto w = FD.next(u,v);
 //
-            auto edge_b = FD.get_cannonical_triangle_arc(v, u); cubic_neighbours_dev[bid*N*3 + thid*3 + 0] = triangle_numbers[edge_b[0]*MaxDegree + FD.dedge_ix(edge_b[0], edge_b[1])];
-            auto edge_c = FD.get_cannonical_triangle_arc(w, v); cubic_neighbours_dev[bid*N*3 + thid*3 + 1] = triangle_numbers[edge_c[0]*MaxDegree + FD.dedge_ix(edge_c[0], edge_c[1])];
-            auto edge_d = FD.get_cannonical_triangle_arc(u, w); cubic_neighbours_dev[bid*N*3 + thid*3 + 2] = triangle_numbers[edge_d[0]*MaxDegree + FD.dedge_ix(edge_d[0], edge_d[1])];
-
-        });
+                    auto edge_b = FD.get_cannonical_triangle_arc(v, u); cubic_neighbours_dev[bid*N*3 + thid*3 + 0] = triangle_numbers[edge_b[0]*MaxDegree + FD.dedge_ix(edge_b[0], edge_b[1])];
+                    auto edge_c = FD.get_cannonical_triangle_arc(w, v); cubic_neighbours_dev[bid*N*3 + thid*3 + 1] = triangle_numbers[edge_c[0]*MaxDegree + FD.dedge_ix(edge_c[0], edge_c[1])];
+                    auto edge_d = FD.get_cannonical_triangle_arc(u, w); cubic_neighbours_dev[bid*N*3 + thid*3 + 2] = triangle_numbers[edge_d[0]*MaxDegree + FD.dedge_ix(edge_d[0], edge_d[1])];
+
+                });
+            });
+            profile("dualise", Q, event);
+            profile("cubic_neighbours to host", Q, Q.memcpy(cubic_neighbours.data() + first*N*3, cubic_neighbours_dev, count*N*3*sizeof(UINT_TYPE)));
+            Q.wait_and_throw(); 
+        }
+        pool_free(dual_neighbours_dev, Q);
+        pool_free(face_degrees_dev, Q);
+        pool_free(cubic_neighbours_dev, Q);
     });
-    Q.wait_and_throw();
-    Q.memcpy(cubic_neighbours.data(), cubic_neighbours_dev, cubic_neighbours.size()*sizeof(UINT_TYPE));
-    Q.wait_and_throw(); 
+    for (size_t d = 0; d < scheduler.size(); d++)
+    {
+        auto stats = UsmPool::get(scheduler.queue(d)).statistics();
+        std::cout << "Queue " << d << " USM pool: peak " << stats.peak_bytes << " bytes, " << stats.reuses << " of " << stats.allocations << " allocations reused\n";
+    }
+    Profiler::instance().write();
 
     for (UINT_TYPE i = 0; i < N; i++){
         std::cout << "Atom " << i << " Neighbours: " << cubic_neighbours[i*3 + 0] << ", " << cubic_neighbours[i*3 + 1] << ", " << cubic_neighbours[i*3 + 2] << "\n";
@@ -0,0 +1,136 @@
+#pragma once
+#include <array>
+
+/**
+ * @brief Computes a Tutte (barycentric) embedding of every isomer in the batch and stores it in B.xys.
+ *        The face to the left of the arc 0 -> cubic_neighbours[0] is fixed to the unit circle, all other nodes are iteratively moved to the barycenter of their neighbours.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers, cubic_neighbours must be filled. EMPTY slots are skipped.
+ * @param max_iterations Upper bound on the number of Jacobi iterations.
+ * @param tolerance The iteration stops when no node moves further than this.
+ */
+template <typename T, typename K, StoragePolicy S>
+void tutte_layout(sycl::queue &Q, IsomerBatch<T, K, S> &B, const size_t max_iterations = 10000, const T tolerance = T(1e-5))
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    check_launch(Q.get_device(), B.N(), B.N() * 2 * sizeof(coord2d), "tutte_layout");
+    Q.submit([&](sycl::handler &h)
+             {
+        auto N = B.N();
+        sycl::local_accessor<coord2d, 1> xys(N, h);
+        sycl::local_accessor<coord2d, 1> next_xys(N, h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h, sycl::read_only);
+        auto xys_acc = B.xys.view(h, sycl::write_only);
+
+        h.parallel_for<class tutte>(sycl::nd_range(sycl::range{N * B.capacity()}, sycl::range{N}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            node_t tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            // EMPTY slots hold sentinel neighbours, walking their faces would index out of bounds.
+            if (statuses_acc[bid] == IsomerStatus::EMPTY) return;
+            const DeviceCubicGraph FG(cubic_neighbours_acc, bid * N * 3);
+            node3 neighbours = {FG[tid * 3], FG[tid * 3 + 1], FG[tid * 3 + 2]};
+
+            node6 outer_face;
+            int face_size = FG.get_face_oriented(0, FG[0], &outer_face[0]);
+            bool fixed = false;
+            coord2d xy = {(real_t)0., (real_t)0.};
+            for (int k = 0; k < face_size; k++)
+            {
+                if (outer_face[k] == tid)
+                {
+                    fixed = true;
+                    real_t angle = (real_t)(2. * M_PI) * k / face_size;
+                    xy = {sycl::cos(angle), sycl::sin(angle)};
+                }
+            }
+            xys[tid] = xy;
+            sycl::group_barrier(cta);
+
+            for (size_t i = 0; i < max_iterations; i++)
+            {
+                if (!fixed)
+                {
+                    xy = {(xys[neighbours[0]][0] + xys[neighbours[1]][0] + xys[neighbours[2]][0]) / (real_t)3.,
+                          (xys[neighbours[0]][1] + xys[neighbours[1]][1] + xys[neighbours[2]][1]) / (real_t)3.};
+                }
+                real_t dx = xy[0] - xys[tid][0], dy = xy[1] - xys[tid][1];
+                real_t max_change = sycl::reduce_over_group(cta, dx * dx + dy * dy, sycl::maximum<real_t>{});
+                next_xys[tid] = xy;
+                sycl::group_barrier(cta);
+                xys[tid] = next_xys[tid];
+                sycl::group_barrier(cta);
+                if (max_change < tolerance * tolerance) break;
+            }
+            xys_acc[bid * N + tid] = xys[tid];
+        }); });
+}
+
+/**
+ * @brief Projects the Tutte embedding in B.xys onto a sphere and stores the resulting starting geometry in B.X.
+ *        The polar angle of a node is given by its topological distance to the outer face of the embedding, the azimuthal angle by its direction in the plane.
+ *        The geometry is centered at the origin and scaled to a mean bond length of 1.45.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers, cubic_neighbours and xys must be filled. EMPTY slots are skipped.
+ */
+template <typename T, typename K, StoragePolicy S>
+void spherical_projection(sycl::queue &Q, IsomerBatch<T, K, S> &B)
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    check_launch(Q.get_device(), B.N(), B.N() * (sizeof(K) + sizeof(coord3d)), "spherical_projection");
+    Q.submit([&](sycl::handler &h)
+             {
+        auto N = B.N();
+        sycl::local_accessor<K, 1> distances(N, h);
+        sycl::local_accessor<coord3d, 1> X(N, h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto xys_acc = B.xys.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h, sycl::read_only);
+        auto X_acc = B.X.view(h, sycl::write_only);
+
+        h.parallel_for<class spherical>(sycl::nd_range(sycl::range{N * B.capacity()}, sycl::range{N}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            node_t tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            if (statuses_acc[bid] == IsomerStatus::EMPTY) return;
+            const DeviceCubicGraph FG(cubic_neighbours_acc, bid * N * 3);
+            node3 neighbours = {FG[tid * 3], FG[tid * 3 + 1], FG[tid * 3 + 2]};
+
+            // Topological distance to the outer face of the Tutte embedding.
+            node6 outer_face;
+            int face_size = FG.get_face_oriented(0, FG[0], &outer_face[0]);
+            node_t distance = std::numeric_limits<node_t>::max() - 1;
+            for (int k = 0; k < face_size; k++)
+                if (outer_face[k] == tid) distance = 0;
+            distances[tid] = distance;
+            sycl::group_barrier(cta);
+            for (size_t i = 0; i < N; i++)
+            {
+                node_t d = sycl::min(sycl::min(distances[neighbours[0]], distances[neighbours[1]]), distances[neighbours[2]]) + 1;
+                bool changed = d < distance;
+                if (changed) distance = d;
+                bool any_changed = sycl::any_of_group(cta, changed);
+                distances[tid] = distance;
+                sycl::group_barrier(cta);
+                if (!any_changed) break;
+            }
+            node_t max_distance = sycl::reduce_over_group(cta, distance, sycl::maximum<node_t>{});
+
+            coord2d xy = xys_acc[bid * N + tid];
+            real_t theta = (real_t)M_PI * ((real_t)distance + (real_t)0.5) / ((real_t)max_distance + (real_t)1.);
+            real_t phi = sycl::atan2(xy[1], xy[0]);
+            coord3d x = {sycl::sin(theta) * sycl::cos(phi), sycl::sin(theta) * sycl::sin(phi), sycl::cos(theta)};
+
+            coord3d centroid = {sycl::reduce_over_group(cta, x[0], sycl::plus<real_t>{}),
+                                sycl::reduce_over_group(cta, x[1], sycl::plus<real_t>{}),
+                                sycl::reduce_over_group(cta, x[2], sycl::plus<real_t>{})};
+            x -= centroid / (real_t)N;
+            X[tid] = x;
+            sycl::group_barrier(cta);
+
+            real_t bond_sum = sycl::reduce_over_group(cta, norm(X[neighbours[0]] - x) + norm(X[neighbours[1]] - x) + norm(X[neighbours[2]] - x), sycl::plus<real_t>{});
+            real_t scale = (real_t)1.45 * (real_t)(3 * N) / bond_sum;
+            X_acc[bid * N + tid] = x * scale;
+        }); });
+}
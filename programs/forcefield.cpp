@@ -0,0 +1,2956 @@
+#pragma once
+#include <CL/sycl.hpp>
+using namespace cl;
+#define USE_MAX_NORM 0
+// Sum float energies with compensated_sum, for when the line search must tell apart energies that differ less than the rounding error of a plain float sum.
+// Off by default: it doubles the local scratch of the energy and takes the extra barriers the fused reductions save. The double precision polish
+// already settles the last digits, the builds that compare float results across summation orders turn it on, see sycl-tests/CMakeLists.txt.
+#ifndef COMPENSATED_ENERGY
+#define COMPENSATED_ENERGY 0
+#endif
+// Optimise with persistent work-groups that pull isomers from a global counter, see forcefield_optimise_persistent.
+#ifndef PERSISTENT_OPTIMISE
+#define PERSISTENT_OPTIMISE 0
+#endif
+// Trial points the line search evaluates per fused reduction, 0 selects the golden section search. See ForceField::multi_point_search.
+// At least 3: with 2 points the search needs 24 reductions against the 21 of the golden section search, 3 points need 14.
+#ifndef LINE_SEARCH_POINTS
+#define LINE_SEARCH_POINTS 0
+#endif
+// Iterations between refreshes of the block-Jacobi preconditioner of the CG, 0 runs unpreconditioned CG. See ForceField::diagonal_block_inverse.
+#ifndef BLOCK_JACOBI_INTERVAL
+#define BLOCK_JACOBI_INTERVAL 0
+#endif
+#define SQRT sycl::sqrt
+#include "forcefield_includes.cpp"
+#include "fstream"
+#include <numeric>
+enum ForcefieldType
+{
+    WIRZ,
+    PEDERSEN,
+    FLATNESS_ENABLED,
+    FLAT_BOND,
+    BOND,
+    ANGLE,
+    DIH,
+    ANGLE_M,
+    ANGLE_P,
+    DIH_A,
+    DIH_M,
+    DIH_P,
+    BOND_ANGLE // Bond and angle terms without the dihedrals, a warm-up stage of forcefield_optimise_staged
+};
+
+template <ForcefieldType FFT, typename T, typename K>
+struct ForceField
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    typedef Constants<T, K> Constants;
+    typedef mat3<T> mat3;
+
+    const NodeNeighbours<K> node_graph; // Contains face-information and neighbour-information. Both of which are constant in the lifespan of this struct.
+    const Constants constants;          // Contains force-constants and equillibrium-parameters. Constant in the lifespan of this struct.
+
+    size_t node_id;
+    size_t N;
+    const sycl::group<1> cta;
+    const sycl::sub_group sg;
+    real_t *sdata; // Pointer to start of L1 cache array, used exclusively for reduction.
+
+    ForceField(const NodeNeighbours<K> &G,
+               const Constants &c,
+               sycl::group<1> cta,
+               sycl::sub_group sg,
+               real_t *sdata) : node_graph(G), constants(c), cta(cta), sg(sg), sdata(sdata)
+    {
+        node_id = cta.get_local_linear_id();
+        N = cta.get_local_linear_range();
+    }
+
+    struct FaceData
+    {
+        coord3d Xa;
+        symMat3<T> A;
+        coord3d n_f;     // normalized normal vector to face-plane
+        real_t lambda_f; // Smallest eigenvalue defining the flatness of the face
+        coord3d lambdas;
+        coord3d centroid;
+        node3 face_neighbours;
+        node_t N;
+        node_t node_id;
+        sycl::group<1> cta;
+        // 84 + 107 FLOPS
+        FaceData(const sycl::group<1> &cta, const sycl::local_accessor<coord3d, 1> &X, const NodeNeighbours<K> &G) : cta(cta)
+        {
+            node_id = cta.get_local_linear_id();
+            N = cta.get_local_linear_range();
+
+            face_neighbours = G.face_neighbours;
+            Xa = X[node_id];
+            // There are only N/2 + 2 faces. (Nf  =  N/2 + 1)
+            if (node_id < N / 2 + 2)
+            {
+                coord3d Xf[6] = {X[G.face_nodes[0]], X[G.face_nodes[1]], X[G.face_nodes[2]], X[G.face_nodes[3]], X[G.face_nodes[4]]};
+                // If pentagon set to 0 otherwise get the 6th node coordinates.
+                if (G.face_size == 6)
+                {
+                    Xf[5] = X[G.face_nodes[5]];
+                }
+                else
+                {
+                    Xf[5] = {(real_t)0., (real_t)0., (real_t)0.};
+                }
+                centroid = (Xf[0] + Xf[1] + Xf[2] + Xf[3] + Xf[4] + Xf[5]) / (T)G.face_size;
+                // Centralise coordinate system to centroid of the face
+                Xf[0] -= centroid;
+                Xf[1] -= centroid;
+                Xf[2] -= centroid;
+                Xf[3] -= centroid;
+                Xf[4] -= centroid;
+                if (G.face_size == 6)
+                {
+                    Xf[5] -= centroid;
+                }
+                auto a = Xf[0][0] * Xf[0][0] + Xf[1][0] * Xf[1][0] + Xf[2][0] * Xf[2][0] + Xf[3][0] * Xf[3][0] + Xf[4][0] * Xf[4][0] + Xf[5][0] * Xf[5][0],
+                     b = Xf[0][0] * Xf[0][1] + Xf[1][0] * Xf[1][1] + Xf[2][0] * Xf[2][1] + Xf[3][0] * Xf[3][1] + Xf[4][0] * Xf[4][1] + Xf[5][0] * Xf[5][1],
+                     c = Xf[0][0] * Xf[0][2] + Xf[1][0] * Xf[1][2] + Xf[2][0] * Xf[2][2] + Xf[3][0] * Xf[3][2] + Xf[4][0] * Xf[4][2] + Xf[5][0] * Xf[5][2],
+                     d = Xf[0][1] * Xf[0][1] + Xf[1][1] * Xf[1][1] + Xf[2][1] * Xf[2][1] + Xf[3][1] * Xf[3][1] + Xf[4][1] * Xf[4][1] + Xf[5][1] * Xf[5][1],
+                     e = Xf[0][1] * Xf[0][2] + Xf[1][1] * Xf[1][2] + Xf[2][1] * Xf[2][2] + Xf[3][1] * Xf[3][2] + Xf[4][1] * Xf[4][2] + Xf[5][1] * Xf[5][2],
+                     f = Xf[0][2] * Xf[0][2] + Xf[1][2] * Xf[1][2] + Xf[2][2] * Xf[2][2] + Xf[3][2] * Xf[3][2] + Xf[4][2] * Xf[4][2] + Xf[5][2] * Xf[5][2];
+                // Xf * Xf^FFT In closed form.
+                A = symMat3(a, b, c, d, e, f);
+
+                // A is positive-semi-definite so all eigenvalues are non-negative
+                lambdas = A.eigenvalues();
+                lambda_f = d_min(d_min(lambdas[0], lambdas[1]), lambdas[2]);
+            }
+        }
+        // 3 FLOPs
+        /**
+         * Computes the harmonic energy contribution of one term.
+         *
+         * @param[in] p0 Equillibrium parameter
+         * @param[in] p Current parameter
+         * @return Hooke's law harmonic energy contribution of the term
+         */
+        real_t harmonic_energy(const real_t p0, const real_t p) const
+        {
+            return (real_t)0.5 * (p - p0) * (p - p0);
+        }
+
+        /** @brief Compute the flatness of the threadIdx^th face in the isomer
+         *  @return The flatness of the threadIdx^th face in the isomer
+         */
+        real_t flatness() const { return node_id < N / 2 + 2 ? lambda_f : (real_t)0.; }
+
+        // 4 FLOPs
+        /**
+         * Computes the harmonic energy gradient contribution of one term.
+         *
+         * @param[in] p0 Equillibrium parameter
+         * @param[in] p Current parameter
+         * @param[in] gradp Gradient of the parameter w.r.t. the particle position
+         * @return Hooke's law harmonic energy gradient contribution of the term
+         */
+        coord3d harmonic_energy_gradient(const real_t p0, const real_t p, const coord3d gradp) const
+        {
+            return (p - p0) * gradp;
+        }
+
+        /**
+         * @brief Compute the flatness energy contribution of the threadIdx^th face in the isomer.
+         *
+         * @param c The forcefield constants for the threadIdx^th node.
+         * @return The flatness energy.
+         */
+        real_t flatness_energy(const Constants &c) const
+        {
+            return c.f_flat * harmonic_energy(flatness(), (real_t)0.);
+        }
+
+        /**
+         * @brief Compute the gradient of the flatness w.r.t to the threadIdx^th atom in the isomer.
+         * @param c The forcefield constants for the threadIdx^th node.
+         * @param cache A pointer to a cache of minimum size Nf * 2 * sizeof(coord3d) bytes.
+         * @return The flatness energy gradient.
+         */
+        coord3d flatness_gradient(const Constants &c, coord3d *cache) const
+        {
+            coord3d *centroids = reinterpret_cast<coord3d *>(cache);
+            coord3d *norms = reinterpret_cast<coord3d *>(cache + N / 2 + 2);
+            if (node_id < N / 2 + 2)
+            {
+                auto lam = lambda_f;
+                centroids[node_id] = centroid;
+                norms[node_id] = A.eigenvector3x3(lam);
+            }
+            sycl::group_barrier(cta);
+
+            coord3d grad = {(real_t)0., (real_t)0., (real_t)0.};
+            for (unsigned char j = 0; j < 3; j++)
+                grad += dot(Xa - centroids[d_get(face_neighbours, j)], norms[d_get(face_neighbours, j)]) * norms[d_get(face_neighbours, j)];
+            return c.f_flat * (real_t)2. * grad;
+        }
+    };
+
+    // Container for all energy and gradient evaluations with respect to an arc, eg. AB, AC or AD.
+    struct ArcData
+    {
+        // 124 FLOPs;
+        int j;
+        /**
+         * @brief Construct a new ArcData object
+         * @param j The index of the arc, eg. 0 for ab, 1 for ac and 2 for ad.
+         * @param X The coordinates of all nodes in the isomer.
+         * @param G The neighbour information for the threadIdx^th node.
+         * @return A new ArcData object.
+         */
+        ArcData(const sycl::group<1> &cta, const int j, const sycl::local_accessor<coord3d, 1> &X, const NodeNeighbours<K> &G) : ArcData((node_t)cta.get_local_linear_id(), j, X, G) {}
+
+        /**
+         * @brief Construct the ArcData of an explicit node, for kernels where a work-item handles several nodes.
+         * @param a The node the arc starts in.
+         * @param j The index of the arc, eg. 0 for ab, 1 for ac and 2 for ad.
+         * @param X The coordinates of all nodes in the isomer, local or global memory.
+         * @param G The neighbour information for node a.
+         */
+        template <typename Coords>
+        ArcData(const node_t a, const int j, const Coords &X, const NodeNeighbours<K> &G)
+        {
+            __builtin_assume(j < 3);
+            this->j = j;
+            coord3d ap, am, ab, ac, ad, mp, db, bc;
+            coord3d X_a = X[a], X_b = X[d_get(G.cubic_neighbours, j)];
+            // Compute the arcs ab, ac, ad, bp, bm, ap, am, mp, bc and cd
+            ab = (X_b - X_a);
+            rabn = bond_length(ab);
+            abh = rabn * ab;
+            ac = (X[d_get(G.cubic_neighbours, (j + 1) % 3)] - X_a);
+            racn = bond_length(ac);
+            ach = racn * ac;
+            rab = non_resciprocal_bond_length(ab);
+            ad = (X[d_get(G.cubic_neighbours, (j + 2) % 3)] - X_a);
+            radn = bond_length(ad);
+            adh = radn * ad;
+            db = (X_b - X[d_get(G.cubic_neighbours, (j + 2) % 3)]);
+            rdbn = bond_length(db);
+            dbh = rdbn * db;
+            coord3d bp = (X[d_get(G.next_on_face, j)] - X_b);
+            coord3d bm = (X[d_get(G.prev_on_face, j)] - X_b);
+
+            rbpn = bond_length(bp);
+            bph = bp * rbpn;
+            rbmn = bond_length(bm);
+            bmh = bm * rbmn;
+
+            ap = bp + ab;
+            rapn = bond_length(ap);
+            aph = rapn * ap;
+            am = bm + ab;
+            ramn = bond_length(am);
+            amh = ramn * am;
+            mp = bp - bm;
+            rmpn = bond_length(mp);
+            mph = rmpn * mp;
+            bc = ac - ab;
+            rbcn = bond_length(bc);
+            bch = rbcn * bc;
+            cdh = unit_vector(ad - ac);
+
+            // Compute inverses of some arcs, these are subject to be omitted if the equations are adapted appropriately with inversion of signs.
+            bah = -abh;
+            mbh = -bmh;
+            pah = -aph;
+            pbh = -bph;
+        }
+
+        // 3 FLOPs
+        /**
+         * @brief Compute the harmonic energy contribution from one parameter.
+         * @param p0 The equillibrium value of the parameter.
+         * @param p The current value of the parameter.
+         */
+        real_t harmonic_energy(const real_t p0, const real_t p) const
+        {
+            return (real_t)0.5 * (p - p0) * (p - p0);
+        }
+        // 4 FLOPs
+        /**
+         * @brief Compute the harmonic energy gradient contribution from one parameter.
+         * @param p0 The equillibrium value of the parameter.
+         * @param p The current value of the parameter.
+         * @param gradp The gradient of the parameter with respect to the node position.
+         */
+        coord3d harmonic_energy_gradient(const real_t p0, const real_t p, const coord3d gradp) const
+        {
+            return (p - p0) * gradp;
+        }
+
+        mat3 harmonic_energy_hessian(const real_t p0, const real_t p, const coord3d grad_a, const coord3d grad_b, const mat3 &hessp) const
+        {
+            return hessp * (p - p0) + tensor_product(grad_a, grad_b);
+        }
+
+        // 1 FLOP
+        /**
+         * @brief Compute the bond length of the main arc ab or ac or ad. for j = 0, 1 or 2 respectively.
+         * @return The bond length.
+         */
+        real_t bond() const { return rab; }
+        // 5 FLOPs
+        /**
+         * @brief Compute the cosine of the angle between the main arc and the next arc, (ab,ac), (ac,ad), (ad,ab). For j = 0, 1 or 2 respectively.
+         * @return The cosine of the angle.
+         */
+        real_t angle() const { return dot(abh, ach); }
+
+        real_t normalized_angle_err() const { return sycl::acos(dot(abh, ach)); }
+
+        // Returns outer angle m, used only diagnostically.
+        real_t outer_angle_m() const { return -dot(abh, bmh); } // Compute outer angle. ab,bm
+
+        // Returns outer angle p, used only diagnostically.
+        real_t outer_angle_p() const { return -dot(abh, bph); } // Compute outer angle. ab,bp
+
+        // Returns the inner dihedral angle for the current arc. Used here only for energy calculation,
+        // otherwise embedded in dihedral computation because the planes and angles that make up the dihedral angle computation are required for derivative computation.
+        // 50 FLOPs
+        /**
+         * @brief Compute the dihedral angle between the planes (abc,bcd), (acd,bcd) and (abd,bcd). For j = 0, 1 or 2 respectively.
+         * @return The dihedral angle.
+         */
+        real_t dihedral() const
+        {
+            coord3d nabc, nbcd;
+            real_t cos_b, cos_c, r_sin_b, r_sin_c;
+            cos_b = dot(bah, bch);
+            r_sin_b = sycl::rsqrt((real_t)1.0 - cos_b * cos_b);
+            nabc = cross(bah, bch) * r_sin_b;
+            cos_c = dot(-bch, cdh);
+            r_sin_c = sycl::rsqrt((real_t)1.0 - cos_c * cos_c);
+            nbcd = cross(-bch, cdh) * r_sin_c;
+            /* if(isnan(dot(nabc,nbcd))){
+                printf("bah: %f %f %f\n", bah[0], bah[1], bah[2]);
+                printf("bch: %f %f %f\n", bch[0], bch[1], bch[2]);
+                printf("cosb: %f, cosc: %f\n", cos_b, cos_c);
+                printf("rsqrt(1 - cosb^2): %f, rsqrt(1 - cosc^2): %f\n", sycl::rsqrt((real_t)1.0 - cos_b*cos_b), sycl::rsqrt((real_t)1.0 - cos_c*cos_c));
+                printf("r_sin_b: %f, r_sin_c: %f\n", r_sin_b, r_sin_c);
+                printf("nabc: %f %f %f\n", nabc[0], nabc[1], nabc[2]);
+                printf("nbcd: %f %f %f\n", nbcd[0], nbcd[1], nbcd[2]);
+                printf("BondLength AB: %f, BondLength BC: %f\n", 1/rabn, 1/racn);
+            } */
+            return dot(nabc, nbcd);
+        }
+        // Returns the Outer-dihedral-a wrt. current arc, only accessed diagnostically (internal coordinate).
+        /**
+         * @brief Compute the dihedral angle between the planes $(b-a-b_m, a-b_m-b_p)$, $(c-a-c_m, a-c_m-c_p)$ and $(d-a-d_m, a-d_m-d_p)$. For j = 0, 1 or 2 respectively.
+         * @return The dihedral angle.
+         */
+        real_t outer_dihedral_a() const
+        {
+            coord3d nbam_hat, namp_hat;
+            real_t cos_a, cos_m, r_sin_a, r_sin_m;
+            cos_a = dot(abh, amh);
+            r_sin_a = sycl::rsqrt((real_t)1.0 - cos_a * cos_a);
+            nbam_hat = cross(abh, amh) * r_sin_a;
+            cos_m = dot(-amh, mph);
+            r_sin_m = sycl::rsqrt((real_t)1.0 - cos_m * cos_m);
+            namp_hat = cross(-amh, mph) * r_sin_m;
+            real_t cos_beta = dot(nbam_hat, namp_hat); // Outer Dihedral angle bam, amp
+            return cos_beta;
+        }
+        // Returns the Outer-dihedral-m wrt. current arc, only accessed diagnostically (internal coordinate).
+        /**
+         * @brief Compute the dihedral angle between the planes $(b-b_m-b_p, b_m-b_p-a)$, $(c-c_m-c_p, c_m-c_p-a)$ and $(d-d_m-d_p, d_m-d_p-a)$. For j = 0, 1 or 2 respectively.
+         * @return The dihedral angle.
+         */
+        real_t outer_dihedral_m() const
+        {
+            coord3d nbmp_hat, nmpa_hat;
+            real_t cos_m, cos_p, r_sin_m, r_sin_p;
+            cos_m = dot(mbh, mph);
+            r_sin_m = sycl::rsqrt((real_t)1.0 - cos_m * cos_m);
+            nbmp_hat = cross(mbh, mph) * r_sin_m;
+            cos_p = dot(-mph, pah);
+            r_sin_p = sycl::rsqrt((real_t)1.0 - cos_p * cos_p);
+            nmpa_hat = cross(-mph, pah) * r_sin_p;
+            // Cosine to the outer dihedral angle constituted by the planes bmp and mpa
+            real_t cos_beta = dot(nbmp_hat, nmpa_hat); // Outer dihedral angle bmp,mpa.
+            return cos_beta;
+        }
+        // Returns the Outer-dihedral-p wrt. current arc, only accessed diagnostically (internal coordinate).
+        /**
+         * @brief Compute the dihedral angle between the planes $(b-b_p-a, b_p-a-b_m)$, $(c-c_p-a, c_p-a-c_m)$ and $(d-d_p-a, d_p-a-d_m)$. For j = 0, 1 or 2 respectively.
+         * @return The dihedral angle.
+         */
+        real_t outer_dihedral_p() const
+        {
+            coord3d nbpa_hat, npam_hat;
+            real_t cos_p, cos_a, r_sin_p, r_sin_a;
+            cos_a = dot(aph, amh);
+            r_sin_a = sycl::rsqrt((real_t)1.0 - cos_a * cos_a);
+            npam_hat = cross(aph, amh) * r_sin_a;
+            cos_p = dot(pbh, -aph);
+            r_sin_p = sycl::rsqrt((real_t)1.0 - cos_p * cos_p);
+            nbpa_hat = cross(pbh, -aph) * r_sin_p;
+            real_t cos_beta = dot(nbpa_hat, npam_hat); // Outer dihedral angle bpa, pam.
+            // Eq. 33 multiplied by harmonic term.
+            return cos_beta;
+        }
+
+        // Chain rule terms for angle calculation
+        // Computes gradient related to bending term. ~24 FLOPs
+        /**
+         * @brief Compute the gradient of the bending term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the bending term.
+         */
+        coord3d inner_angle_gradient(const Constants &c) const
+        {
+            real_t cos_angle = angle();                                                                       // Inner angle of arcs ab,ac.
+            coord3d grad = cos_angle * (abh * rabn + ach * racn) - abh * racn - ach * rabn;                   // Derivative of inner angle: Eq. 21.
+            return d_get(c.f_inner_angle, j) * harmonic_energy_gradient(d_get(c.angle0, j), cos_angle, grad); // Harmonic Energy Gradient: Eq. 21. multiplied by harmonic term.
+        }
+
+        mat3 bond_hessian_a(const Constants &c) const
+        {
+            coord3d grad_a = -abh;
+            mat3 hessp = (identity3() - tensor_product(abh, abh)) * rabn;
+            return d_get(c.f_bond, j) * harmonic_energy_hessian(d_get(c.r0, j), rab, grad_a, grad_a, hessp);
+        }
+
+        mat3 bond_hessian_b(const Constants &c) const
+        {
+            coord3d grad_a = -abh;
+            coord3d grad_b = abh;
+            mat3 hessp = (tensor_product(abh, abh) - identity3()) * rabn;
+            return d_get(c.f_bond, j) * harmonic_energy_hessian(d_get(c.r0, j), rab, grad_a, grad_b, hessp);
+        }
+
+        mat3 inner_angle_hessian_a(const Constants &c) const
+        {
+            real_t cos_angle = angle(); // Inner angle of arcs ab,ac.
+            coord3d grad_a = (abh * angle() - ach) * rabn + (ach * angle() - abh) * racn;
+
+            mat3 GradG = tensor_product(abh, rabn * (abh * angle() - ach) + racn * (ach * angle() - abh)) + angle() * rabn * (tensor_product(abh, abh) - identity3()) - racn * (tensor_product(ach, ach) - identity3());
+
+            mat3 GradF = tensor_product(ach, rabn * (abh * angle() - ach) + racn * (ach * angle() - abh)) + angle() * racn * (tensor_product(ach, ach) - identity3()) - rabn * (tensor_product(abh, abh) - identity3());
+
+            mat3 P1 = tensor_product(abh * angle() - ach, abh * rabn * rabn);
+            mat3 P2 = rabn * GradG;
+            mat3 P3 = tensor_product(ach * angle() - abh, ach * racn * racn);
+            mat3 P4 = racn * GradF;
+            return c.f_inner_angle[j] * harmonic_energy_hessian(c.angle0[j], cos_angle, grad_a, grad_a, P1 + P2 + P3 + P4); // Harmonic Energy Hessian
+        }
+
+        mat3 inner_angle_hessian_b(const Constants &c) const
+        {
+            coord3d grad_a = (abh * angle() - ach) * rabn + (ach * angle() - abh) * racn;
+            coord3d grad_b = (ach - abh * angle()) * rabn;
+            mat3 G = tensor_product(abh, rabn * (ach - abh * angle())) + angle() * rabn * (identity3() - tensor_product(abh, abh));
+            mat3 F = tensor_product(ach, rabn * (ach - abh * angle())) - rabn * (identity3() - tensor_product(abh, abh));
+            mat3 P1 = tensor_product(abh * angle() - ach, -abh * rabn * rabn);
+
+            mat3 P2 = rabn * G;
+            mat3 P4 = racn * F;
+            return d_get(c.f_inner_angle, j) * harmonic_energy_hessian(d_get(c.angle0, j), angle(), grad_a, grad_b, P1 + P2 + P4); // Harmonic Energy Hessian
+        }
+
+        mat3 inner_angle_hessian_c(const Constants &c) const
+        {
+            coord3d grad_a = (abh * angle() - ach) * rabn + (ach * angle() - abh) * racn;
+            coord3d grad_c = (abh - angle() * ach) * racn;
+            mat3 G = tensor_product(abh, racn * (abh - ach * angle())) - racn * (identity3() - tensor_product(ach, ach));
+            mat3 F = tensor_product(ach, racn * (abh - ach * angle())) + angle() * racn * (identity3() - tensor_product(ach, ach));
+            mat3 P2 = rabn * G;
+            mat3 P3 = tensor_product(ach * angle() - abh, -ach * racn * racn);
+            mat3 P4 = racn * F;
+            return d_get(c.f_inner_angle, j) * harmonic_energy_hessian(d_get(c.angle0, j), angle(), grad_a, grad_c, P2 + P3 + P4); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_m_a(const Constants &c) const
+        {
+            real_t cost = dot(bah, bmh); // Compute outer angle. ab,bm
+            mat3 gradba = rabn * (identity3() - tensor_product(bah, bah));
+            coord3d grad_a = (bmh - bah * cost) * rabn;
+            mat3 P1 = tensor_product(bmh - bah * cost, -bah * rabn * rabn);
+            mat3 P2 = -rabn * (tensor_product(bah, grad_a) + cost * gradba);
+            return d_get(c.f_outer_angle_m, j) * harmonic_energy_hessian(d_get(c.outer_angle_m0, j), cost, grad_a, grad_a, P1 + P2); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_m_b(const Constants &c) const
+        {
+            real_t cost = dot(bah, bmh); // Compute outer angle. ba,bm
+            mat3 gradba = rabn * (tensor_product(bah, bah) - identity3());
+            mat3 gradbm = rbmn * (tensor_product(bmh, bmh) - identity3());
+            coord3d grad_b = rabn * (bah * cost - bmh) + rbmn * (bmh * cost - bah);
+            coord3d grad_a = (bmh - bah * cost) * rabn;
+            mat3 P1 = tensor_product(bmh - bah * cost, bah * rabn * rabn);
+            mat3 P3 = rabn * (gradbm - (tensor_product(bah, grad_b) + cost * gradba));
+            return d_get(c.f_outer_angle_m, j) * harmonic_energy_hessian(d_get(c.outer_angle_m0, j), cost, grad_a, grad_b, P1 + P3); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_m_m(const Constants &c) const
+        {
+            real_t cost = dot(bah, bmh); // Compute outer angle. ba,bm
+            mat3 gradbm = rbmn * (identity3() - tensor_product(bmh, bmh));
+            coord3d grad_a = (bmh - bah * cost) * rabn;
+            coord3d grad_m = rbmn * (bah - bmh * cost);
+            mat3 P1 = rabn * (gradbm - tensor_product(bah, grad_m));
+            return d_get(c.f_outer_angle_m, j) * harmonic_energy_hessian(d_get(c.outer_angle_m0, j), cost, grad_a, grad_m, P1); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_p_a(const Constants &c) const
+        {
+            real_t cost = dot(bah, bph); // Compute outer angle. ba,bp
+            mat3 gradba = rabn * (identity3() - tensor_product(bah, bah));
+            coord3d grad_a = rabn * (bph - bah * cost);
+            mat3 P1 = tensor_product(bph - bah * cost, -bah * rabn * rabn);
+            mat3 P2 = -rabn * (tensor_product(bah, grad_a) + cost * gradba);
+            return d_get(c.f_outer_angle_p, j) * harmonic_energy_hessian(d_get(c.outer_angle_p0, j), cost, grad_a, grad_a, P1 + P2); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_p_b(const Constants &c) const
+        {
+            real_t cost = dot(bah, bph); // Compute outer angle. ba,bp
+            mat3 gradba = rabn * (tensor_product(bah, bah) - identity3());
+            mat3 gradbp = rbpn * (tensor_product(bph, bph) - identity3());
+            coord3d grad_b = rabn * (bah * cost - bph) + rbpn * (bph * cost - bah);
+            coord3d grad_a = rabn * (bph - bah * cost);
+            mat3 P1 = tensor_product(bph - bah * cost, bah * rabn * rabn);
+            mat3 P3 = rabn * (gradbp - (tensor_product(bah, grad_b) + cost * gradba));
+            return d_get(c.f_outer_angle_p, j) * harmonic_energy_hessian(d_get(c.outer_angle_p0, j), cost, grad_a, grad_b, P1 + P3); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_angle_hessian_p_p(const Constants &c) const
+        {
+            real_t cost = dot(bah, bph); // Compute outer angle. ba,bp
+            mat3 gradbp = rbpn * (identity3() - tensor_product(bph, bph));
+            coord3d grad_a = rabn * (bph - bah * cost);
+            coord3d grad_p = rbpn * (bah - bph * cost);
+            mat3 P1 = rabn * (gradbp - tensor_product(bah, grad_p));
+            return d_get(c.f_outer_angle_p, j) * harmonic_energy_hessian(d_get(c.outer_angle_p0, j), cost, grad_a, grad_p, P1); // Harmonic Energy Hessian
+        }
+
+        auto dihedral_hessian_terms(const Constants &c) const
+        {
+            coord3d cbh = -bch;
+            real_t cost1 = dot(abh, cbh);
+            real_t cost2 = dot(cbh, dbh);
+            real_t sint1 = SQRT(1 - cost1 * cost1);
+            real_t sint2 = SQRT(1 - cost2 * cost2);
+            real_t cot1 = cost1 / sint1;
+            real_t csc1 = real_t(1.) / sint1;
+            real_t csc2 = real_t(1.) / sint2;
+            coord3d nabc = cross(abh, cbh) * csc1;
+            coord3d nbcd = cross(dbh, cbh) * csc2;
+            real_t cosb = dot(nabc, nbcd);
+            real_t Coeff = cosb * csc1 * rabn;
+            coord3d F1 = abh * sint1;
+            coord3d F2 = cross(cbh, nbcd) / cosb;
+            coord3d F3 = cot1 * (abh * cost1 - cbh);
+            coord3d F = F1 - F2 + F3;
+            coord3d GradACosb = cosb * rabn * csc1 * (abh * sint1 - cross(cbh, nbcd) / cosb + cot1 * (abh * cost1 - cbh));
+            return std::tuple{cbh, cost1, cost2, sint1, sint2, cot1, csc1, csc2, nabc, nbcd, cosb, Coeff, F, GradACosb};
+        }
+
+        // $\nabla_a(\nabla_a(\cos(\theta)))$
+        mat3 dihedral_hessian_a(const Constants &c) const
+        {
+            auto [cbh, cost1, cost2, sint1, sint2, cot1, csc1, csc2, nabc, nbcd, cosb, Coeff, F, GradACosb] = dihedral_hessian_terms(c);
+            coord3d GradARab = abh * rabn * rabn;
+            mat3 GradAabh = (tensor_product(abh, abh) - identity3()) * rabn;
+            coord3d GradASint1 = -(abh * cost1 - cbh) * cost1 * rabn * csc1;
+            coord3d GradAcsc1 = -GradASint1 * csc1 * csc1;
+            coord3d GradAcost1 = (abh * cost1 - cbh) * rabn;
+            coord3d GradAcot1 = (sint1 * GradAcost1 - cost1 * GradASint1) * csc1 * csc1;
+            coord3d GradACoeff = GradACosb * rabn * csc1 + cosb * (GradARab * csc1 + GradAcsc1 * rabn);
+            mat3 GradAF1 = GradAabh * sint1 + tensor_product(abh, GradASint1);
+            mat3 GradAF2 = tensor_product(cross(cbh, nbcd), -GradACosb / (cosb * cosb));
+            mat3 GradAF3 = tensor_product(abh * cost1 - cbh, GradAcot1) + cot1 * (tensor_product(abh, GradAcost1) + cost1 * GradAabh);
+            mat3 GradAF = GradAF1 - GradAF2 + GradAF3;
+            mat3 GradAGradCosb = tensor_product(F, GradACoeff) + Coeff * GradAF;
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy_hessian(d_get(c.inner_dih0, j), cosb, GradACosb, GradACosb, GradAGradCosb); // Harmonic Energy Hessian
+        }
+
+        // $\nabla_b(\nabla_a(\cos(\beta)))$
+        mat3 dihedral_hessian_b(const Constants &c) const
+        {
+            auto [cbh, cost1, cost2, sint1, sint2, cot1, csc1, csc2, nabc, nbcd, cosb, Coeff, F, GradACosb] = dihedral_hessian_terms(c);
+            coord3d grad_b_sint1 = -((cbh - abh * cost1) * rabn + (abh - cbh * cost1) * rbcn) * cost1 * csc1;
+            coord3d grad_b_sint2 = -((cbh - dbh * cost2) * rdbn + (dbh - cbh * cost2) * rbcn) * cost2 * csc2;
+            coord3d grad_b_ab_cross_cb_dot_nbcd = (rbcn * (cross(nbcd, abh) - dot(nbcd, cross(abh, cbh)) * cbh) - rabn * (cross(nbcd, cbh) - dot(nbcd, cross(cbh, abh)) * abh));
+            coord3d grad_b_db_cross_cb_dot_nabc = (rbcn * (cross(nabc, dbh) - dot(nabc, cross(dbh, cbh)) * cbh) - rdbn * (cross(nabc, cbh) - dot(nabc, cross(cbh, dbh)) * dbh));
+            coord3d P1 = (grad_b_ab_cross_cb_dot_nbcd * sint1 - (dot(nbcd, cross(abh, cbh))) * grad_b_sint1) * csc1 * csc1;
+            coord3d P2 = (grad_b_db_cross_cb_dot_nabc * sint2 - (dot(nabc, cross(dbh, cbh))) * grad_b_sint2) * csc2 * csc2;
+            coord3d grad_b = P1 + P2;
+            coord3d GradBRab = -abh * rabn * rabn;
+            mat3 GradBabh = (identity3() - tensor_product(abh, abh)) * rabn;
+            mat3 GradBcbh = (identity3() - tensor_product(cbh, cbh)) * rbcn;
+            mat3 GradBdbh = (identity3() - tensor_product(dbh, dbh)) * rdbn;
+            mat3 GradBnbcd = ((cross(dbh, GradBcbh) - cross(cbh, GradBdbh)) * sint2 - tensor_product(cross(dbh, cbh), grad_b_sint2)) * csc2 * csc2;
+            coord3d GradBcsc1 = -grad_b_sint1 * csc1 * csc1;
+            coord3d GradBcost1 = (cbh - abh * cost1) * rabn + (abh - cbh * cost1) * rbcn;
+            coord3d GradBcot1 = (sint1 * GradBcost1 - cost1 * grad_b_sint1) * csc1 * csc1;
+            coord3d GradBCoeff = grad_b * rabn * csc1 + cosb * (GradBRab * csc1 + GradBcsc1 * rabn);
+            mat3 GradBF1 = GradBabh * sint1 + tensor_product(abh, grad_b_sint1);
+            mat3 GradBF2 = tensor_product(cross(cbh, nbcd), -grad_b / (cosb * cosb)) + (cross(cbh, GradBnbcd) - cross(nbcd, GradBcbh)) / cosb;
+            mat3 GradBF3 = tensor_product(abh * cost1 - cbh, GradBcot1) + cot1 * (tensor_product(abh, GradBcost1) + cost1 * GradBabh - GradBcbh);
+            mat3 GradBF = GradBF1 - GradBF2 + GradBF3;
+            mat3 GradBGradCosb = tensor_product(F, GradBCoeff) + Coeff * GradBF;
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy_hessian(d_get(c.inner_dih0, j), cosb, GradACosb, grad_b, GradBGradCosb); // Harmonic Energy Hessian
+        }
+
+        // $\nabla_c(\nabla_a(\cos(\theta)))$
+        mat3 dihedral_hessian_c(const Constants &c) const
+        {
+            auto [cbh, cost1, cost2, sint1, sint2, cot1, csc1, csc2, nabc, nbcd, cosb, Coeff, F, GradACosb] = dihedral_hessian_terms(c);
+            coord3d grad_c_sint1 = -(cbh * cost1 - abh) * cost1 * csc1 * rbcn;
+            coord3d grad_c_sint2 = -(cbh * cost2 - dbh) * cost2 * csc2 * rbcn;
+            coord3d grad_c_ab_cross_cb_dot_nabc = rbcn * (dot(nabc, cross(dbh, cbh)) * cbh - cross(nabc, dbh));
+            coord3d grad_c_db_cross_cb_dot_nbcd = rbcn * (dot(nbcd, cross(abh, cbh)) * cbh - cross(nbcd, abh));
+            coord3d P1 = (grad_c_ab_cross_cb_dot_nabc * sint2 - (dot(nabc, cross(dbh, cbh))) * grad_c_sint2) * csc2 * csc2;
+            coord3d P2 = (grad_c_db_cross_cb_dot_nbcd * sint1 - (dot(nbcd, cross(abh, cbh))) * grad_c_sint1) * csc1 * csc1;
+            coord3d grad_c = P1 + P2;
+
+            mat3 GradCcbh = (tensor_product(cbh, cbh) - identity3()) * rbcn;
+            coord3d GradCcsc1 = -grad_c_sint1 * csc1 * csc1;
+            coord3d GradCcost1 = (cbh * cost1 - abh) * rbcn;
+            coord3d GradCcot1 = (sint1 * GradCcost1 - cost1 * grad_c_sint1) * csc1 * csc1;
+            mat3 GradCnbcd = (cross(dbh, GradCcbh) * sint2 - tensor_product(cross(dbh, cbh), grad_c_sint2)) * csc2 * csc2;
+            coord3d GradCCoeff = grad_c * rabn * csc1 + cosb * (GradCcsc1 * rabn);
+            mat3 GradCF1 = tensor_product(abh, grad_c_sint1);
+            mat3 GradCF2 = tensor_product(cross(cbh, nbcd), -grad_c / (cosb * cosb)) + (cross(cbh, GradCnbcd) - cross(nbcd, GradCcbh)) / cosb;
+            mat3 GradCF3 = tensor_product(abh * cost1 - cbh, GradCcot1) + cot1 * (tensor_product(abh, GradCcost1) - GradCcbh);
+            mat3 GradCF = GradCF1 - GradCF2 + GradCF3;
+            mat3 GradCGradCosb = tensor_product(F, GradCCoeff) + Coeff * GradCF;
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy_hessian(d_get(c.inner_dih0, j), cosb, GradACosb, grad_c, GradCGradCosb); // Harmonic Energy Hessian
+        }
+
+        // $\nabla_d(\nabla_a(\cos(\theta)))$
+        mat3 dihedral_hessian_d(const Constants &c) const
+        {
+            auto [cbh, cost1, cost2, sint1, sint2, cot1, csc1, csc2, nabc, nbcd, cosb, Coeff, F, GradACosb] = dihedral_hessian_terms(c);
+            coord3d GradDSint2 = -(dbh * cost2 - cbh) * cost2 * csc2 * rdbn;
+            coord3d GradDDbCrossCbDotNabc = -rdbn * (dot(nabc, cross(cbh, dbh)) * dbh - cross(nabc, cbh));
+            coord3d grad_d = (GradDDbCrossCbDotNabc * sint2 - (dot(nabc, cross(dbh, cbh))) * GradDSint2) * csc2 * csc2;
+
+            mat3 GradDdbh = (tensor_product(dbh, dbh) - identity3()) * rdbn;
+            mat3 GradDnbcd = (-cross(cbh, GradDdbh) * sint2 - tensor_product(cross(dbh, cbh), GradDSint2)) * csc2 * csc2;
+            coord3d GradDCoeff = grad_d * rabn * csc1;
+            mat3 GradDF2 = tensor_product(cross(cbh, nbcd), -grad_d / (cosb * cosb)) + cross(cbh, GradDnbcd) / cosb;
+            mat3 GradDF = -GradDF2;
+            mat3 GradDGradCosb = tensor_product(F, GradDCoeff) + Coeff * GradDF;
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy_hessian(d_get(c.inner_dih0, j), cosb, GradACosb, grad_d, GradDGradCosb); // Harmonic Energy Hessian
+        }
+
+        auto outer_dihedral_hessian_a_terms(const Constants &c) const
+        {
+            coord3d mah = -amh;
+            real_t cosa = dot(abh, amh);
+            real_t cosm = dot(mah, mph);
+            real_t sina = sqrt(1 - cosa * cosa);
+            real_t sinm = sqrt(1 - cosm * cosm);
+            real_t cota = cosa / sina;
+            real_t cotm = cosm / sinm;
+            real_t csca = real_t(1.) / sina;
+            real_t cscm = real_t(1.) / sinm;
+            coord3d nbam = cross(abh, amh) * csca;
+            coord3d namp = cross(mah, mph) * cscm;
+            real_t cosb = dot(nbam, namp);
+            coord3d F1 = abh * cosb;
+            coord3d F2 = cross(amh, namp) * csca;
+            coord3d F3 = amh * cosb;
+            coord3d F4 = cross(namp, abh) * csca;
+            coord3d G1 = abh * cosa * rabn;
+            coord3d G2 = amh * rabn;
+            coord3d G3 = amh * cosa * ramn;
+            coord3d G4 = abh * ramn;
+            coord3d H1 = cross(mph, nbam);
+            coord3d H2 = mah * cosb * sinm;
+            coord3d H3 = cotm * cosb * (mph - mah * cosm);
+            real_t C1 = cota * cosb * csca;
+            real_t C2 = ramn * cscm;
+            coord3d GradAcosb = (F1 - F2) * rabn + (F3 - F4) * ramn + C1 * (G1 - G2 + G3 - G4) + C2 * (H1 - H2 + H3);
+            return std::tuple(cosa, cosm, sina, sinm, cota, cotm, csca, cscm, nbam, namp, cosb, F1, F2, F3, F4, G1, G2, G3, G4, H1, H2, H3, C1, C2, GradAcosb);
+        }
+
+        mat3 outer_dihedral_hessian_a_a(const Constants &c) const
+        {
+            auto [cosa, cosm, sina, sinm, cota, cotm, csca, cscm, nbam, namp, cosb, F1, F2, F3, F4, G1, G2, G3, G4, H1, H2, H3, C1, C2, GradAcosb] = outer_dihedral_hessian_a_terms(c);
+            coord3d mah = -amh;
+
+            coord3d GradAcosa = (amh * cosa - abh) * ramn + (abh * cosa - amh) * rabn;
+            coord3d GradAsina = -cosa * csca * GradAcosa;
+            coord3d GradAcota = (sina * GradAcosa - cosa * GradAsina) * csca * csca;
+            coord3d GradAcsca = -GradAsina * csca * csca;
+            coord3d GradAcosm = (mph - mah * cosm) * ramn;
+            coord3d GradAsinm = -cosm * cscm * GradAcosm;
+            coord3d GradAcotm = (sinm * GradAcosm - cosm * GradAsinm) * cscm * cscm;
+            coord3d GradAcscm = -GradAsinm * cscm * cscm;
+
+            mat3 GradAab = (tensor_product(abh, abh) - identity3()) * rabn;
+            coord3d GradArabn = abh * rabn * rabn;
+            mat3 GradAam = (tensor_product(amh, amh) - identity3()) * ramn;
+            coord3d GradAramn = amh * ramn * ramn;
+            mat3 GradAma = (identity3() - tensor_product(mah, mah)) * ramn;
+            mat3 GradAnbam = ((cross(abh, GradAam) - cross(amh, GradAab)) * sina - tensor_product(cross(abh, amh), GradAsina)) * csca * csca;
+            mat3 GradAnamp = ((-cross(mph, GradAma)) * sinm - tensor_product(cross(mah, mph), GradAsinm)) * cscm * cscm;
+            mat3 GradAF1 = tensor_product(abh, GradAcosb) + cosb * GradAab;
+            mat3 GradAF2 = ((cross(amh, GradAnamp) - cross(namp, GradAam)) * sina - tensor_product(cross(amh, namp), GradAsina)) * csca * csca;
+            mat3 GradAF3 = tensor_product(amh, GradAcosb) + cosb * GradAam;
+            mat3 GradAF4 = ((cross(namp, GradAab) - cross(abh, GradAnamp)) * sina - tensor_product(cross(namp, abh), GradAsina)) * csca * csca;
+
+            mat3 GradAG1 = tensor_product(abh, (GradAcosa * rabn + GradArabn * cosa)) + cosa * rabn * GradAab;
+            mat3 GradAG2 = tensor_product(amh, GradArabn) + GradAam * rabn;
+            mat3 GradAG3 = tensor_product(amh, (GradAcosa * ramn + GradAramn * cosa)) + cosa * ramn * GradAam;
+            mat3 GradAG4 = tensor_product(abh, GradAramn) + GradAab * ramn;
+
+            mat3 GradAH1 = cross(mph, GradAnbam);
+            mat3 GradAH2 = tensor_product(mah, (cosb * GradAsinm + GradAcosb * sinm)) + cosb * sinm * GradAma;
+            mat3 GradAH3 = tensor_product(mph - mah * cosm, (GradAcotm * cosb + GradAcosb * cotm)) + cotm * cosb * (-(GradAma * cosm + tensor_product(mah, GradAcosm)));
+
+            coord3d GradAC1 = GradAcota * cosb * csca + cota * (GradAcosb * csca + cosb * GradAcsca);
+            coord3d GradAC2 = GradAramn * cscm + GradAcscm * ramn;
+
+            mat3 GradAF = rabn * (GradAF1 - GradAF2) + tensor_product(F1 - F2, GradArabn) + ramn * (GradAF3 - GradAF4) + tensor_product(F3 - F4, GradAramn);
+            mat3 GradAG = C1 * (GradAG1 - GradAG2 + GradAG3 - GradAG4) + tensor_product(G1 - G2 + G3 - G4, GradAC1);
+            mat3 GradAH = C2 * (GradAH1 - GradAH2 + GradAH3) + tensor_product(H1 - H2 + H3, GradAC2);
+
+            mat3 GradGradAcosb = GradAF + GradAG + GradAH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_a, j), cosb, GradAcosb, GradAcosb, GradGradAcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_a_b(const Constants &c) const
+        {
+            auto [cosa, cosm, sina, sinm, cota, cotm, csca, cscm, nbam, namp, cosb, F1, F2, F3, F4, G1, G2, G3, G4, H1, H2, H3, C1, C2, GradAcosb] = outer_dihedral_hessian_a_terms(c);
+            coord3d mah = -amh;
+
+            mat3 GradBab = (identity3() - tensor_product(abh, abh)) * rabn;
+            coord3d GradBrabn = -abh * rabn * rabn;
+            coord3d GradBcosa = (amh - cosa * abh) * rabn;
+            coord3d GradBsina = -cosa / sina * GradBcosa;
+            coord3d GradBcota = (sina * GradBcosa - cosa * GradBsina) * csca * csca;
+            coord3d GradBcsca = -GradBsina * csca * csca;
+            mat3 GradBnbam = ((-cross(amh, GradBab)) * sina - tensor_product(cross(abh, amh), GradBsina)) * csca * csca;
+            coord3d GradBcosb = (-(cross(namp, amh) - dot(namp, cross(amh, abh)) * abh) * sina * rabn - dot(namp, cross(abh, amh)) * GradBsina) * csca * csca;
+
+            mat3 GradBF1 = tensor_product(abh, GradBcosb) + cosb * GradBab;
+            mat3 GradBF2 = (-tensor_product(cross(amh, namp), GradBsina)) * csca * csca;
+            mat3 GradBF3 = tensor_product(amh, GradBcosb);
+            mat3 GradBF4 = ((cross(namp, GradBab)) * sina - tensor_product(cross(namp, abh), GradBsina)) * csca * csca;
+
+            mat3 GradBG1 = tensor_product(abh, (GradBcosa * rabn + GradBrabn * cosa)) + cosa * rabn * GradBab;
+            mat3 GradBG2 = tensor_product(amh, GradBrabn);
+            mat3 GradBG3 = tensor_product(amh, (GradBcosa * ramn));
+            mat3 GradBG4 = GradBab * ramn;
+
+            mat3 GradBH1 = cross(mph, GradBnbam);
+            mat3 GradBH2 = tensor_product(mah, GradBcosb * sinm);
+            mat3 GradBH3 = tensor_product(mph - mah * cosm, (GradBcosb * cotm));
+
+            coord3d GradBC1 = GradBcota * cosb * csca + cota * (GradBcosb * csca + cosb * GradBcsca);
+
+            mat3 GradBF = rabn * (GradBF1 - GradBF2) + tensor_product(F1 - F2, GradBrabn) + ramn * (GradBF3 - GradBF4);
+            mat3 GradBG = C1 * (GradBG1 - GradBG2 + GradBG3 - GradBG4) + tensor_product(G1 - G2 + G3 - G4, GradBC1);
+            mat3 GradBH = C2 * (GradBH1 - GradBH2 + GradBH3);
+
+            mat3 GradGradBcosb = GradBF + GradBG + GradBH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_a, j), cosb, GradAcosb, GradBcosb, GradGradBcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_a_m(const Constants &c) const
+        {
+            auto [cosa, cosm, sina, sinm, cota, cotm, csca, cscm, nbam, namp, cosb, F1, F2, F3, F4, G1, G2, G3, G4, H1, H2, H3, C1, C2, GradAcosb] = outer_dihedral_hessian_a_terms(c);
+            coord3d mah = -amh;
+
+            coord3d GradMcosa = (abh - cosa * amh) * ramn;
+            coord3d GradMcosm = (mah * cosm - mph) * ramn + (mph * cosm - mah) * rmpn;
+            coord3d GradMsina = -cosa / sina * GradMcosa;
+            coord3d GradMsinm = -cosm / sinm * GradMcosm;
+
+            mat3 GradMam = (identity3() - tensor_product(amh, amh)) * ramn;
+            coord3d GradMramn = -amh * ramn * ramn;
+            mat3 GradMma = (tensor_product(amh, amh) - identity3()) * ramn;
+            mat3 GradMmp = (tensor_product(mph, mph) - identity3()) * rmpn;
+            coord3d GradMcota = (sina * GradMcosa - cosa * GradMsina) * csca * csca;
+            coord3d GradMcotm = (sinm * GradMcosm - cosm * GradMsinm) * cscm * cscm;
+            coord3d GradMcsca = -GradMsina * csca * csca;
+            coord3d GradMcscm = -GradMsinm * cscm * cscm;
+            mat3 GradMnbam = ((cross(abh, GradMam)) * sina - tensor_product(cross(abh, amh), GradMsina)) * csca * csca;
+            mat3 GradMnamp = ((cross(mah, GradMmp) - cross(mph, GradMma)) * sinm - tensor_product(cross(mah, mph), GradMsinm)) * cscm * cscm;
+
+            coord3d cosbP1 = (((cross(namp, abh) - dot(namp, cross(abh, amh)) * amh) * sina * ramn - dot(namp, cross(abh, amh)) * GradMsina) * csca * csca);
+            coord3d cosbP2 = (((rmpn * cscm) * (dot(nbam, cross(mah, mph)) * mph - cross(nbam, mah)) - (cscm * ramn) * (dot(nbam, cross(mph, mah)) * mah - cross(nbam, mph))) - dot(nbam, cross(mah, mph)) * GradMsinm * cscm * cscm);
+            coord3d GradMcosb = cosbP1 + cosbP2;
+            mat3 GradMF1 = tensor_product(abh, GradMcosb);
+            mat3 GradMF2 = ((cross(amh, GradMnamp) - cross(namp, GradMam)) * sina - tensor_product(cross(amh, namp), GradMsina)) * csca * csca;
+            mat3 GradMF3 = tensor_product(amh, GradMcosb) + cosb * GradMam;
+            mat3 GradMF4 = ((-cross(abh, GradMnamp)) * sina - tensor_product(cross(namp, abh), GradMsina)) * csca * csca;
+
+            mat3 GradMG1 = tensor_product(abh, GradMcosa * rabn);
+            mat3 GradMG2 = GradMam * rabn;
+            mat3 GradMG3 = tensor_product(amh, GradMcosa * ramn + GradMramn * cosa) + cosa * ramn * GradMam;
+            mat3 GradMG4 = tensor_product(abh, GradMramn);
+
+            mat3 GradMH1 = cross(mph, GradMnbam) - cross(nbam, GradMmp);
+            mat3 GradMH2 = tensor_product(mah, (cosb * GradMsinm + GradMcosb * sinm)) + cosb * sinm * GradMma;
+            mat3 GradMH3 = tensor_product(mph - mah * cosm, (GradMcotm * cosb + GradMcosb * cotm)) + cotm * cosb * (GradMmp - (GradMma * cosm + tensor_product(mah, GradMcosm)));
+
+            coord3d GradMC1 = GradMcota * cosb * csca + cota * (GradMcosb * csca + cosb * GradMcsca);
+            coord3d GradMC2 = GradMramn * cscm + GradMcscm * ramn;
+
+            mat3 GradMF = rabn * (GradMF1 - GradMF2) + ramn * (GradMF3 - GradMF4) + tensor_product(F3 - F4, GradMramn);
+            mat3 GradMG = C1 * (GradMG1 - GradMG2 + GradMG3 - GradMG4) + tensor_product(G1 - G2 + G3 - G4, GradMC1);
+            mat3 GradMH = C2 * (GradMH1 - GradMH2 + GradMH3) + tensor_product(H1 - H2 + H3, GradMC2);
+
+            mat3 GradGradMcosb = GradMF + GradMG + GradMH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_a, j), cosb, GradAcosb, GradMcosb, GradGradMcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_a_p(const Constants &c) const
+        {
+            auto [cosa, cosm, sina, sinm, cota, cotm, csca, cscm, nbam, namp, cosb, F1, F2, F3, F4, G1, G2, G3, G4, H1, H2, H3, C1, C2, GradAcosb] = outer_dihedral_hessian_a_terms(c);
+            coord3d mah = -amh;
+
+            coord3d GradPcosm = (mah - mph * cosm) * rmpn;
+            coord3d GradPsinm = -cosm * cscm * GradPcosm;
+
+            mat3 GradPmp = (identity3() - tensor_product(mph, mph)) * rmpn;
+            coord3d GradPcotm = (sinm * GradPcosm - cosm * GradPsinm) * cscm * cscm;
+            coord3d GradPcscm = -GradPsinm * cscm * cscm;
+            mat3 GradPnbam = -tensor_product(cross(abh, amh), GradAcosb) * csca * csca;
+            mat3 GradPnamp = (cross(mah, GradPmp) * sinm - tensor_product(cross(mah, mph), GradPsinm)) * cscm * cscm;
+            coord3d GradPcosb = (sinm * rmpn * (cross(nbam, mah) - dot(nbam, cross(mah, mph)) * mph) - dot(nbam, cross(mah, mph)) * GradPsinm) * cscm * cscm;
+
+            mat3 GradPF1 = tensor_product(abh, GradPcosb);
+            mat3 GradPF2 = ((cross(amh, GradPnamp)) * sina) * csca * csca;
+            mat3 GradPF3 = tensor_product(amh, GradPcosb);
+            mat3 GradPF4 = ((-cross(abh, GradPnamp)) * sina) * csca * csca;
+
+            mat3 GradPH1 = -cross(nbam, GradPmp);
+            mat3 GradPH2 = tensor_product(mah, (cosb * GradPsinm + GradPcosb * sinm));
+            mat3 GradPH3 = tensor_product(mph - mah * cosm, (GradPcotm * cosb + GradPcosb * cotm)) + cotm * cosb * (GradPmp - (tensor_product(mah, GradPcosm)));
+
+            coord3d GradPC1 = cota * (GradPcosb * csca);
+            coord3d GradPC2 = GradPcscm * ramn;
+
+            mat3 GradPF = (GradPF1 - GradPF2) * rabn + (GradPF3 - GradPF4) * ramn;
+            mat3 GradPG = tensor_product(G1 - G2 + G3 - G4, GradPC1);
+            mat3 GradPH = C2 * (GradPH1 - GradPH2 + GradPH3) + tensor_product(H1 - H2 + H3, GradPC2);
+
+            mat3 GradGradPcosb = GradPF + GradPG + GradPH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_a, j), cosb, GradAcosb, GradPcosb, GradGradPcosb); // Harmonic Energy Hessian
+        }
+
+        auto outer_dihedral_hessian_m_terms() const
+        {
+            coord3d pmh = -mph;
+            real_t cosm = dot(mbh, mph);
+            real_t cosp = dot(pmh, pah);
+            real_t sinm = sqrt(1 - cosm * cosm);
+            real_t sinp = sqrt(1 - cosp * cosp);
+            real_t cscm = 1 / sinm;
+            real_t cscp = 1 / sinp;
+            real_t cotp = cosp / sinp;
+            real_t cotm = cosm / sinm;
+            coord3d nbmp = cross(mbh, mph) * cscm;
+            coord3d nmpa = cross(pmh, pah) * cscp;
+            real_t cosb = dot(nbmp, nmpa);
+            coord3d F = cross(nbmp, pmh) * rapn * cscp;
+            coord3d G = pah * cosb * rapn;
+            real_t K1 = cotp * cosb;
+            real_t K2 = rapn * cscp;
+            real_t K_ = K1 * K2;
+            coord3d H = K_ * (pmh - pah * cosp);
+            coord3d GradAcosb = F - G + H;
+            return std::tuple(cosm, cosp, sinm, sinp, cscm, cscp, cotp, cotm, nbmp, nmpa, cosb, F, G, H, K1, K2, K_, GradAcosb);
+        }
+
+        mat3 outer_dihedral_hessian_m_a(const Constants &c) const
+        {
+            auto [cosm, cosp, sinm, sinp, cscm, cscp, cotp, cotm, nbmp, nmpa, cosb, F, G, H, K1, K2, K_, GradAcosb] = outer_dihedral_hessian_m_terms();
+            coord3d pmh = -mph;
+
+            coord3d GradAcosp = (pmh - pah * cosp) * rapn;
+            coord3d GradAsinp = -cosp * cscp * GradAcosp;
+            coord3d GradAcscp = -GradAsinp * cscp * cscp;
+            coord3d GradAcotp = (sinp * GradAcosp - cosp * GradAsinp) * cscp * cscp;
+
+            mat3 GradApah = (identity3() - tensor_product(pah, pah)) * rapn;
+            coord3d GradArpan = -pah * rapn * rapn;
+            mat3 GradAF = tensor_product(cross(nbmp, pmh), GradArpan * cscp + GradAcscp * rapn);
+            mat3 GradAG = tensor_product(pah, GradAcosb * rapn + GradArpan * cosb) + GradApah * cosb * rapn;
+            coord3d GradAK1 = GradAcotp * cosb + cotp * GradAcosb;
+            coord3d GradAK2 = GradArpan * cscp + GradAcscp * rapn;
+            coord3d GradAK = GradAK1 * K2 + K1 * GradAK2;
+            mat3 GradAH = tensor_product(pmh - pah * cosp, GradAK) + K_ * (-GradApah * cosp - tensor_product(pah, GradAcosp));
+
+            mat3 GradGradAcosb = GradAF - GradAG + GradAH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_m, j), cosb, GradAcosb, GradAcosb, GradGradAcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_m_b(const Constants &c) const
+        {
+            auto [cosm, cosp, sinm, sinp, cscm, cscp, cotp, cotm, nbmp, nmpa, cosb, F, G, H, K1, K2, K_, GradAcosb] = outer_dihedral_hessian_m_terms();
+            coord3d pmh = -mph;
+
+            coord3d GradBcosm = (mph - mbh * cosm) * rbmn;
+            coord3d GradBsinm = -cosm / sinm * GradBcosm;
+            coord3d GradBcscm = -GradBsinm * cscm * cscm;
+
+            coord3d GradBcosb = -(cross(nmpa, mph) - dot(cross(nmpa, mph), mbh) * mbh) * rbmn * cscm - dot(nmpa, cross(mbh, mph)) * GradBsinm * cscm * cscm;
+
+            mat3 GradBmbh = (identity3() - tensor_product(mbh, mbh)) * rbmn;
+            mat3 GradBnbmp = (-cross(mph, GradBmbh) * sinm - tensor_product(cross(mbh, mph), GradBsinm)) * cscm * cscm;
+            mat3 GradBF = -cross(pmh, GradBnbmp) * rapn * cscp;
+            mat3 GradBG = tensor_product(pah, GradBcosb * rapn);
+            coord3d GradBK1 = cotp * GradBcosb;
+            coord3d GradBK = GradBK1 * K2;
+            mat3 GradBH = tensor_product(pmh - pah * cosp, GradBK);
+            mat3 GradGradBcosb = GradBF - GradBG + GradBH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_m, j), cosb, GradAcosb, GradBcosb, GradGradBcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_m_m(const Constants &c) const
+        {
+            auto [cosm, cosp, sinm, sinp, cscm, cscp, cotp, cotm, nbmp, nmpa, cosb, F, G, H, K1, K2, K_, GradAcosb] = outer_dihedral_hessian_m_terms();
+            coord3d pmh = -mph;
+
+            coord3d GradMcosm = (mbh * cosm - mph) * rbmn + (mph * cosm - mbh) * rmpn;
+            coord3d GradMsinm = -cosm / sinm * GradMcosm;
+            coord3d GradMcscm = -GradMsinm * cscm * cscm;
+            coord3d GradMcosp = (pah - pmh * cosp) * rmpn;
+            coord3d GradMsinp = -cosp * cscp * GradMcosp;
+            coord3d GradMcscp = -GradMsinp * cscp * cscp;
+            coord3d GradMcotp = (sinp * GradMcosp - cosp * GradMsinp) * cscp * cscp;
+
+            mat3 GradMmph = (tensor_product(mph, mph) - identity3()) * rmpn;
+            mat3 GradMpmh = (identity3() - tensor_product(pmh, pmh)) * rmpn;
+            mat3 GradMmbh = (tensor_product(mbh, mbh) - identity3()) * rbmn;
+
+            mat3 GradMnbmp = ((cross(mbh, GradMmph) - cross(mph, GradMmbh)) * sinm - tensor_product(cross(mbh, mph), GradMsinm)) * cscm * cscm;
+            coord3d GradMcosbP1 = (((dot(cross(nmpa, mbh), mph) * mph - cross(nmpa, mbh)) * rmpn - (dot(cross(nmpa, mph), mbh) * mbh - cross(nmpa, mph)) * rbmn) * sinm - dot(nmpa, cross(mbh, mph)) * GradMsinm) * cscm * cscm;
+            coord3d GradMcosbP2 = ((-(cross(nbmp, pah) - dot(cross(nbmp, pah), pmh) * pmh) * rmpn) * sinp - dot(nbmp, cross(pmh, pah)) * GradMsinp) * cscp * cscp;
+            coord3d GradMcosb = GradMcosbP1 + GradMcosbP2;
+
+            mat3 GradMF = (cross(nbmp, GradMpmh) - cross(pmh, GradMnbmp)) * rapn * cscp + tensor_product(cross(nbmp, pmh), GradMcscp * rapn);
+            mat3 GradMG = tensor_product(pah, GradMcosb * rapn);
+            coord3d GradMK1 = GradMcotp * cosb + cotp * GradMcosb;
+            coord3d GradMK2 = GradMcscp * rapn;
+            coord3d GradMK = GradMK1 * K2 + K1 * GradMK2;
+            mat3 GradMH = tensor_product((pmh - pah * cosp), GradMK) + K_ * (GradMpmh - tensor_product(pah, GradMcosp));
+            mat3 GradGradMcosb = GradMF - GradMG + GradMH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_m, j), cosb, GradAcosb, GradMcosb, GradGradMcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_m_p(const Constants &c) const
+        {
+            auto [cosm, cosp, sinm, sinp, cscm, cscp, cotp, cotm, nbmp, nmpa, cosb, F, G, H, K1, K2, K_, GradAcosb] = outer_dihedral_hessian_m_terms();
+            coord3d pmh = -mph;
+
+            coord3d GradPcosm = (mbh - mph * cosm) * rmpn;
+            coord3d GradPsinm = -cosm / sinm * GradPcosm;
+            coord3d GradPcscm = -GradPsinm * cscm * cscm;
+            coord3d GradPcosp = (pmh * cosp - pah) * rmpn + (pah * cosp - pmh) * rapn;
+            coord3d GradPsinp = -cosp * cscp * GradPcosp;
+            coord3d GradPcscp = -GradPsinp * cscp * cscp;
+            coord3d GradPcotp = (sinp * GradPcosp - cosp * GradPsinp) * cscp * cscp;
+
+            mat3 GradPmph = (identity3() - tensor_product(mph, mph)) * rmpn;
+            mat3 GradPpmh = (tensor_product(pmh, pmh) - identity3()) * rmpn;
+            mat3 GradPpah = (tensor_product(pah, pah) - identity3()) * rapn;
+
+            coord3d GradPrpan = pah * rapn * rapn;
+
+            mat3 GradPnbmp = ((cross(mbh, GradPmph)) * sinm - tensor_product(cross(mbh, mph), GradPsinm)) * cscm * cscm;
+            coord3d GradPcosbP1 = (((cross(nmpa, mbh) - dot(cross(nmpa, mbh), mph) * mph) * rmpn) * sinm - dot(nmpa, cross(mbh, mph)) * GradPsinm) * cscm * cscm;
+            coord3d GradPcosbP2 = (((dot(cross(nbmp, pmh), pah) * pah - cross(nbmp, pmh)) * rapn - (dot(cross(nbmp, pah), pmh) * pmh - cross(nbmp, pah)) * rmpn) * sinp - dot(nbmp, cross(pmh, pah)) * GradPsinp) * cscp * cscp;
+            coord3d GradPcosb = GradPcosbP1 + GradPcosbP2;
+
+            mat3 GradPF = (cross(nbmp, GradPpmh) - cross(pmh, GradPnbmp)) * rapn * cscp + tensor_product(cross(nbmp, pmh), GradPcscp * rapn + GradPrpan * cscp);
+            mat3 GradPG = tensor_product(pah, GradPcosb * rapn + GradPrpan * cosb) + GradPpah * rapn * cosb;
+            coord3d GradPK1 = GradPcotp * cosb + cotp * GradPcosb;
+            coord3d GradPK2 = GradPrpan * cscp + GradPcscp * rapn;
+            coord3d GradPK = GradPK1 * K2 + K1 * GradPK2;
+            mat3 GradPH = tensor_product((pmh - pah * cosp), GradPK) + K_ * (GradPpmh - tensor_product(pah, GradPcosp) - GradPpah * cosp);
+
+            mat3 GradGradPcosb = GradPF - GradPG + GradPH;
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_m, j), cosb, GradAcosb, GradPcosb, GradGradPcosb); // Harmonic Energy Hessian
+        }
+
+        auto outer_dihedral_hessian_p_terms() const
+        {
+            coord3d pah = -aph;
+            real_t cosa = dot(aph, amh);
+            real_t cosp = dot(pbh, pah);
+            real_t sina = sqrt(1 - cosa * cosa);
+            real_t sinp = sqrt(1 - cosp * cosp);
+            real_t csca = 1 / sina;
+            real_t cscp = 1 / sinp;
+            real_t cotp = cosp / sinp;
+            real_t cota = cosa / sina;
+            coord3d nbpa = cross(pbh, pah) * cscp;
+            coord3d npam = cross(aph, amh) * csca;
+            real_t cosb = dot(nbpa, npam);
+
+            real_t rpan = rapn;
+            real_t C1 = rpan * cscp;
+            real_t C2 = cota * cosb * csca;
+            coord3d F1 = cross(npam, pbh);
+            coord3d F2 = pah * cosb * sinp;
+            coord3d F3 = cotp * cosb * (pbh - pah * cosp);
+            coord3d G1 = aph * cosb;
+            coord3d G2 = cross(amh, nbpa) * csca;
+            coord3d G3 = amh * cosb;
+            coord3d G4 = cross(nbpa, aph) * csca;
+            coord3d H1 = aph * cosa * rapn;
+            coord3d H2 = amh * rapn;
+            coord3d H3 = amh * cosa * ramn;
+            coord3d H4 = aph * ramn;
+
+            coord3d GradAcosb = C1 * (F1 - F2 + F3) + rapn * (G1 - G2) + ramn * (G3 - G4) + C2 * (H1 - H2 + H3 - H4);
+            return std::tuple(cosa, cosp, sina, sinp, csca, cscp, cotp, cota, nbpa, npam, cosb, C1, C2, F1, F2, F3, G1, G2, G3, G4, H1, H2, H3, H4, GradAcosb);
+        }
+
+        mat3 outer_dihedral_hessian_p_a(const Constants &c) const
+        {
+            auto [cosa, cosp, sina, sinp, csca, cscp, cotp, cota, nbpa, npam, cosb, C1, C2, F1, F2, F3, G1, G2, G3, G4, H1, H2, H3, H4, GradAcosb] = outer_dihedral_hessian_p_terms();
+
+            coord3d GradAcosa = (aph * cosa - amh) * rapn + (amh * cosa - aph) * ramn;
+            coord3d GradAsina = -cosa * csca * GradAcosa;
+            coord3d GradAcsca = -GradAsina * csca * csca;
+            coord3d GradAcota = (sina * GradAcosa - cosa * GradAsina) * csca * csca;
+            coord3d GradAcosp = (pbh - pah * cosp) * rapn;
+            coord3d GradAsinp = -cosp * cscp * GradAcosp;
+            coord3d GradAcscp = -GradAsinp * cscp * cscp;
+            coord3d GradAcotp = (sinp * GradAcosp - cosp * GradAsinp) * cscp * cscp;
+
+            mat3 GradAamh = (tensor_product(amh, amh) - identity3()) * ramn;
+            coord3d GradAramn = amh * ramn * ramn;
+            mat3 GradAaph = (tensor_product(aph, aph) - identity3()) * rapn;
+            coord3d GradArapn = aph * rapn * rapn;
+
+            mat3 GradApah = (identity3() - tensor_product(pah, pah)) * rapn;
+            coord3d GradArpan = -pah * rapn * rapn;
+
+            coord3d GradAC1 = cscp * GradArpan + rapn * GradAcscp;
+            coord3d GradAC2 = cosb * (cota * GradAcsca + csca * GradAcota) + cota * csca * GradAcosb;
+
+            mat3 GradAnpam = (sina * (cross(aph, GradAamh) - cross(amh, GradAaph)) - tensor_product(cross(aph, amh), GradAsina)) * csca * csca;
+
+            mat3 GradAF1 = -cross(pbh, GradAnpam);
+            mat3 GradAF2 = tensor_product(pah, sinp * GradAcosb + cosb * GradAsinp) + GradApah * sinp * cosb;
+            mat3 GradAF3 = cotp * cosb * (-tensor_product(pah, GradAcosp) - GradApah * cosp) + tensor_product(pbh - pah * cosp, GradAcotp * cosb) + tensor_product(pbh - pah * cosp, cotp * GradAcosb);
+
+            mat3 GradAnbpa = (sinp * (cross(pbh, GradApah)) - tensor_product(cross(pbh, pah), GradAsinp)) * cscp * cscp;
+
+            mat3 GradAG1 = tensor_product(aph, GradAcosb) + GradAaph * cosb;
+            mat3 GradAG2 = tensor_product(cross(amh, nbpa), GradAcsca) + csca * (cross(amh, GradAnbpa) - cross(nbpa, GradAamh));
+            mat3 GradAG3 = tensor_product(amh, GradAcosb) + GradAamh * cosb;
+            mat3 GradAG4 = tensor_product(cross(nbpa, aph), GradAcsca) + csca * (cross(nbpa, GradAaph) - cross(aph, GradAnbpa));
+
+            mat3 GradAH1 = tensor_product(aph, GradAcosa * rapn + GradArapn * cosa) + GradAaph * cosa * rapn;
+            mat3 GradAH2 = tensor_product(amh, GradArapn) + GradAamh * rapn;
+            mat3 GradAH3 = tensor_product(amh, GradAcosa * ramn + GradAramn * cosa) + GradAamh * cosa * ramn;
+            mat3 GradAH4 = tensor_product(aph, GradAramn) + GradAaph * ramn;
+
+            mat3 GradGradAcosb = C1 * (GradAF1 - GradAF2 + GradAF3) + tensor_product(F1 - F2 + F3, GradAC1) + rapn * (GradAG1 - GradAG2) + tensor_product(G1 - G2, GradArapn) + ramn * (GradAG3 - GradAG4) + tensor_product(G3 - G4, GradAramn) + C2 * (GradAH1 - GradAH2 + GradAH3 - GradAH4) + tensor_product(H1 - H2 + H3 - H4, GradAC2);
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_p, j), cosb, GradAcosb, GradAcosb, GradGradAcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_p_b(const Constants &c) const
+        {
+            auto [cosa, cosp, sina, sinp, csca, cscp, cotp, cota, nbpa, npam, cosb, C1, C2, F1, F2, F3, G1, G2, G3, G4, H1, H2, H3, H4, GradAcosb] = outer_dihedral_hessian_p_terms();
+
+            coord3d GradBcosp = (pah - pbh * cosp) * rbpn;
+            coord3d GradBsinp = -cosp * cscp * GradBcosp;
+            coord3d GradBcscp = -GradBsinp * cscp * cscp;
+            coord3d GradBcotp = (sinp * GradBcosp - cosp * GradBsinp) * cscp * cscp;
+
+            mat3 GradBpbh = (identity3() - tensor_product(pbh, pbh)) * rbpn;
+            coord3d GradBrpbn = -pbh * rbpn * rbpn;
+            coord3d GradBcosb = ((dot(npam, cross(pah, pbh)) * pbh - cross(npam, pah)) * sinp * rbpn - dot(npam, cross(pbh, pah)) * GradBsinp) * cscp * cscp;
+
+            coord3d GradBC1 = GradBcscp * rapn;
+            coord3d GradBC2 = cota * csca * GradBcosb;
+
+            mat3 GradBF1 = cross(npam, GradBpbh);
+            mat3 GradBF2 = tensor_product(pah, sinp * GradBcosb + cosb * GradBsinp);
+            mat3 GradBF3 = cotp * cosb * (GradBpbh - tensor_product(pah, GradBcosp)) + tensor_product(pbh - pah * cosp, GradBcotp * cosb) + tensor_product(pbh - pah * cosp, cotp * GradBcosb);
+
+            mat3 GradBnbpa = (sinp * (-cross(pah, GradBpbh)) - tensor_product(cross(pbh, pah), GradBsinp)) * cscp * cscp;
+            mat3 GradBG1 = tensor_product(aph, GradBcosb);
+            mat3 GradBG2 = csca * (cross(amh, GradBnbpa));
+            mat3 GradBG3 = tensor_product(amh, GradBcosb);
+            mat3 GradBG4 = csca * (-cross(aph, GradBnbpa));
+
+            mat3 GradGradBcosb = C1 * (GradBF1 - GradBF2 + GradBF3) + tensor_product(F1 - F2 + F3, GradBC1) + rapn * (GradBG1 - GradBG2) + ramn * (GradBG3 - GradBG4) + tensor_product(H1 - H2 + H3 - H4, GradBC2);
+
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_p, j), cosb, GradAcosb, GradBcosb, GradGradBcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_p_m(const Constants &c) const
+        {
+            auto [cosa, cosp, sina, sinp, csca, cscp, cotp, cota, nbpa, npam, cosb, C1, C2, F1, F2, F3, G1, G2, G3, G4, H1, H2, H3, H4, GradAcosb] = outer_dihedral_hessian_p_terms();
+
+            coord3d GradMcosa = (aph - amh * cosa) * ramn;
+            coord3d GradMsina = -cosa * csca * GradMcosa;
+            coord3d GradMcsca = -GradMsina * csca * csca;
+            coord3d GradMcota = (sina * GradMcosa - cosa * GradMsina) * csca * csca;
+            coord3d GradMcosb = ((cross(nbpa, aph) - dot(cross(nbpa, aph), amh) * amh) * sina * ramn - dot(nbpa, cross(aph, amh)) * GradMsina) * csca * csca;
+
+            mat3 GradMamh = (identity3() - tensor_product(amh, amh)) * ramn;
+            coord3d GradMramn = -amh * ramn * ramn;
+
+            coord3d GradMC2 = cosb * (cota * GradMcsca + csca * GradMcota) + cota * csca * GradMcosb;
+            mat3 GradMnpam = (sina * (cross(aph, GradMamh)) - tensor_product(cross(aph, amh), GradMsina)) * csca * csca;
+            mat3 GradMF1 = -cross(pbh, GradMnpam);
+            mat3 GradMF2 = tensor_product(pah, sinp * GradMcosb);
+            mat3 GradMF3 = tensor_product(pbh - pah * cosp, cotp * GradMcosb);
+
+            mat3 GradMG1 = tensor_product(aph, GradMcosb);
+            mat3 GradMG2 = tensor_product(cross(amh, nbpa), GradMcsca) + csca * (-cross(nbpa, GradMamh));
+            mat3 GradMG3 = tensor_product(amh, GradMcosb) + GradMamh * cosb;
+            mat3 GradMG4 = tensor_product(cross(nbpa, aph), GradMcsca);
+
+            mat3 GradMH1 = tensor_product(aph, GradMcosa * rapn);
+            mat3 GradMH2 = GradMamh * rapn;
+            mat3 GradMH3 = tensor_product(amh, GradMcosa * ramn + GradMramn * cosa) + GradMamh * cosa * ramn;
+            mat3 GradMH4 = tensor_product(aph, GradMramn);
+
+            mat3 GradGradMcosb = C1 * (GradMF1 - GradMF2 + GradMF3) + rapn * (GradMG1 - GradMG2) + ramn * (GradMG3 - GradMG4) + tensor_product(G3 - G4, GradMramn) + C2 * (GradMH1 - GradMH2 + GradMH3 - GradMH4) + tensor_product(H1 - H2 + H3 - H4, GradMC2);
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_p, j), cosb, GradAcosb, GradMcosb, GradGradMcosb); // Harmonic Energy Hessian
+        }
+
+        mat3 outer_dihedral_hessian_p_p(const Constants &c) const
+        {
+            auto [cosa, cosp, sina, sinp, csca, cscp, cotp, cota, nbpa, npam, cosb, C1, C2, F1, F2, F3, G1, G2, G3, G4, H1, H2, H3, H4, GradAcosb] = outer_dihedral_hessian_p_terms();
+
+            coord3d GradPcosa = (amh - aph * cosa) * rapn;
+            coord3d GradPsina = -cosa * csca * GradPcosa;
+            coord3d GradPcsca = -GradPsina * csca * csca;
+            coord3d GradPcota = (sina * GradPcosa - cosa * GradPsina) * csca * csca;
+            coord3d GradPcosp = (pbh * cosp - pah) * rbpn + (pah * cosp - pbh) * rapn;
+            coord3d GradPsinp = -cosp * cscp * GradPcosp;
+            coord3d GradPcscp = -GradPsinp * cscp * cscp;
+            coord3d GradPcotp = (sinp * GradPcosp - cosp * GradPsinp) * cscp * cscp;
+
+            mat3 GradPaph = (identity3() - tensor_product(aph, aph)) * rapn;
+            coord3d GradPrapn = -aph * rapn * rapn;
+            mat3 GradPpbh = (tensor_product(pbh, pbh) - identity3()) * rbpn;
+            coord3d GradPrpbn = pbh * rbpn * rbpn;
+            mat3 GradPpah = (tensor_product(pah, pah) - identity3()) * rapn;
+            coord3d GradPrpan = pah * rapn * rapn;
+            coord3d GradPcosbP1 = (((dot(cross(npam, pbh), pah) * pah - cross(npam, pbh)) * rapn - (dot(cross(npam, pah), pbh) * pbh - cross(npam, pah)) * rbpn) * sinp - dot(npam, cross(pbh, pah)) * GradPsinp) * cscp * cscp;
+            coord3d GradPcosbP2 = (-(cross(nbpa, amh) - dot(cross(nbpa, amh), aph) * aph) * sina * rapn - dot(nbpa, cross(aph, amh)) * GradPsina) * csca * csca;
+            coord3d GradPcosb = GradPcosbP1 + GradPcosbP2;
+
+            coord3d GradPC1 = cscp * GradPrpan + rapn * GradPcscp;
+            coord3d GradPC2 = cosb * (cota * GradPcsca + csca * GradPcota) + cota * csca * GradPcosb;
+
+            mat3 GradPnpam = (sina * (-cross(amh, GradPaph)) - tensor_product(cross(aph, amh), GradPsina)) * csca * csca;
+            mat3 GradPF1 = cross(npam, GradPpbh) - cross(pbh, GradPnpam);
+            mat3 GradPF2 = tensor_product(pah, sinp * GradPcosb + cosb * GradPsinp) + GradPpah * sinp * cosb;
+            mat3 GradPF3 = cotp * cosb * (GradPpbh - tensor_product(pah, GradPcosp) - GradPpah * cosp) + tensor_product(pbh - pah * cosp, GradPcotp * cosb) + tensor_product(pbh - pah * cosp, cotp * GradPcosb);
+
+            mat3 GradPG1 = tensor_product(aph, GradPcosb) + GradPaph * cosb;
+            mat3 GradPnbpa = (sinp * (cross(pbh, GradPpah) - cross(pah, GradPpbh)) - tensor_product(cross(pbh, pah), GradPsinp)) * cscp * cscp;
+            mat3 GradPG2 = tensor_product(cross(amh, nbpa), GradPcsca) + csca * (cross(amh, GradPnbpa));
+            mat3 GradPG3 = tensor_product(amh, GradPcosb);
+            mat3 GradPG4 = tensor_product(cross(nbpa, aph), GradPcsca) + csca * (cross(nbpa, GradPaph) - cross(aph, GradPnbpa));
+
+            mat3 GradPH1 = tensor_product(aph, GradPcosa * rapn + GradPrapn * cosa) + GradPaph * cosa * rapn;
+            mat3 GradPH2 = tensor_product(amh, GradPrapn);
+            mat3 GradPH3 = tensor_product(amh, GradPcosa * ramn);
+            mat3 GradPH4 = GradPaph * ramn;
+
+            mat3 GradGradPcosb = C1 * (GradPF1 - GradPF2 + GradPF3) + tensor_product(F1 - F2 + F3, GradPC1) + rapn * (GradPG1 - GradPG2) + tensor_product(G1 - G2, GradPrapn) + ramn * (GradPG3 - GradPG4) + C2 * (GradPH1 - GradPH2 + GradPH3 - GradPH4) + tensor_product(H1 - H2 + H3 - H4, GradPC2);
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_hessian(d_get(c.outer_dih0_p, j), cosb, GradAcosb, GradPcosb, GradGradPcosb); // Harmonic Energy Hessian
+        }
+
+        // Computes gradient related to bending of outer angles. ~20 FLOPs
+        /**
+         * @brief Compute the gradient of the outer angle-m term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the outer angle-m term.
+         */
+        coord3d outer_angle_gradient_m(const Constants &c) const
+        {
+            real_t cos_angle = -dot(abh, bmh);                                                                          // Compute outer angle. ab,bm
+            coord3d grad = (bmh + abh * cos_angle) * rabn;                                                              // Derivative of outer angles Eq. 30. Buster Thesis
+            return d_get(c.f_outer_angle_m, j) * harmonic_energy_gradient(d_get(c.outer_angle_m0, j), cos_angle, grad); // Harmonic Energy Gradient: Eq. 30 multiplied by harmonic term.
+        }
+
+        /**
+         * @brief Compute the gradient of the outer angle-p term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the outer angle-p term.
+         */
+        coord3d outer_angle_gradient_p(const Constants &c) const
+        {
+            real_t cos_angle = -dot(abh, bph);                                                                          // Compute outer angle. ab,bp
+            coord3d grad = (bph + abh * cos_angle) * rabn;                                                              // Derivative of outer angles Eq. 28. Buster Thesis
+            return d_get(c.f_outer_angle_p, j) * harmonic_energy_gradient(d_get(c.outer_angle_p0, j), cos_angle, grad); // Harmonic Energy Gradient: Eq. 28 multiplied by harmonic term.
+        }
+        // Chain rule terms for dihedral calculation
+        // Computes gradient related to dihedral/out-of-plane term. ~75 FLOPs
+        /**
+         * @brief Compute the gradient of the inner dihedral term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the inner dihedral term.
+         */
+        coord3d inner_dihedral_gradient(const Constants &c) const
+        {
+            coord3d nabc, nbcd;
+            real_t cos_b, cos_c, r_sin_b, r_sin_c;
+            cos_b = dot(bah, bch);
+            r_sin_b = sycl::rsqrt((real_t)1.0 - cos_b * cos_b);
+            nabc = cross(bah, bch) * r_sin_b;
+            cos_c = dot(-bch, cdh);
+            r_sin_c = sycl::rsqrt((real_t)1.0 - cos_c * cos_c);
+            nbcd = cross(-bch, cdh) * r_sin_c;
+
+            real_t cos_beta = dot(nabc, nbcd);        // Inner dihedral angle from planes abc,bcd.
+            real_t cot_b = cos_b * r_sin_b * r_sin_b; // cos(b)/sin(b)^2
+
+            // Derivative w.r.t. inner dihedral angle F and G in Eq. 26
+            coord3d grad = cross(bch, nbcd) * r_sin_b * rabn - bah * cos_beta * rabn + (cot_b * cos_beta * rabn) * (bch - bah * cos_b);
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy_gradient(d_get(c.inner_dih0, j), cos_beta, grad); // Eq. 26.
+        }
+
+        // Computes gradient from dihedral angles constituted by the planes bam, amp ~162 FLOPs
+        /**
+         * @brief Compute the gradient of the outer dihedral-a term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the outer dihedral-a term.
+         */
+        coord3d outer_dihedral_gradient_a(const Constants &c) const
+        {
+            coord3d nbam_hat, namp_hat;
+            real_t cos_a, cos_m, r_sin_a, r_sin_m;
+
+            cos_a = dot(abh, amh);
+            r_sin_a = sycl::rsqrt((real_t)1.0 - cos_a * cos_a);
+            nbam_hat = cross(abh, amh) * r_sin_a;
+            cos_m = dot(-amh, mph);
+            r_sin_m = sycl::rsqrt((real_t)1.0 - cos_m * cos_m);
+            namp_hat = cross(-amh, mph) * r_sin_m;
+
+            real_t cos_beta = dot(nbam_hat, namp_hat); // Outer Dihedral angle bam, amp
+            real_t cot_a = cos_a * r_sin_a * r_sin_a;
+            real_t cot_m = cos_m * r_sin_m * r_sin_m;
+
+            // Derivative w.r.t. outer dihedral angle, factorized version of Eq. 31.
+            coord3d grad = cross(mph, nbam_hat) * ramn * r_sin_m - (cross(namp_hat, abh) * ramn + cross(amh, namp_hat) * rabn) * r_sin_a +
+                           cos_beta * (abh * rabn + ramn * ((real_t)2.0 * amh + cot_m * (mph + cos_m * amh)) - cot_a * (ramn * (abh - amh * cos_a) + rabn * (amh - abh * cos_a)));
+
+            // Eq. 31 multiplied by harmonic term.
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_gradient(d_get(c.outer_dih0_a, j), cos_beta, grad);
+        }
+
+        // Computes gradient from dihedral angles constituted by the planes nbmp, nmpa ~92 FLOPs
+        /**
+         * @brief Compute the gradient of the outer dihedral-m term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the outer dihedral-m term.
+         */
+        coord3d outer_dihedral_gradient_m(const Constants &c) const
+        {
+            coord3d nbmp_hat, nmpa_hat;
+            real_t cos_m, cos_p, r_sin_m, r_sin_p;
+            cos_m = dot(mbh, mph);
+            r_sin_m = sycl::rsqrt((real_t)1.0 - cos_m * cos_m);
+            nbmp_hat = cross(mbh, mph) * r_sin_m;
+            cos_p = dot(-mph, pah);
+            r_sin_p = sycl::rsqrt((real_t)1.0 - cos_p * cos_p);
+            nmpa_hat = cross(-mph, pah) * r_sin_p;
+
+            // Cosine to the outer dihedral angle constituted by the planes bmp and mpa
+            real_t cos_beta = dot(nbmp_hat, nmpa_hat); // Outer dihedral angle bmp,mpa.
+            real_t cot_p = cos_p * r_sin_p * r_sin_p;
+
+            // Derivative w.r.t. outer dihedral angle, factorized version of Eq. 32.
+            coord3d grad = rapn * (cot_p * cos_beta * (-mph - pah * cos_p) - cross(nbmp_hat, mph) * r_sin_p - pah * cos_beta);
+
+            // Eq. 32 multiplied by harmonic term.
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_gradient(d_get(c.outer_dih0_m, j), cos_beta, grad);
+        }
+
+        // Computes gradient from dihedral angles constituted by the planes bpa, pam ~162 FLOPs
+        /**
+         * @brief Compute the gradient of the outer dihedral-p term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the outer dihedral-p term.
+         */
+        coord3d outer_dihedral_gradient_p(const Constants &c) const
+        {
+            coord3d nbpa_hat, npam_hat;
+            real_t cos_p, cos_a, r_sin_p, r_sin_a;
+            cos_a = dot(aph, amh);
+            r_sin_a = sycl::rsqrt((real_t)1.0 - cos_a * cos_a);
+            npam_hat = cross(aph, amh) * r_sin_a;
+            cos_p = dot(pbh, -aph);
+            r_sin_p = sycl::rsqrt((real_t)1.0 - cos_p * cos_p);
+            nbpa_hat = cross(pbh, -aph) * r_sin_p;
+
+            real_t cos_beta = dot(nbpa_hat, npam_hat); // Outer dihedral angle bpa, pam.
+            real_t cot_p = cos_p * r_sin_p * r_sin_p;
+            real_t cot_a = cos_a * r_sin_a * r_sin_a;
+
+            // Derivative w.r.t. outer dihedral angle, factorized version of Eq. 33.
+            coord3d grad = cross(npam_hat, pbh) * rapn * r_sin_p - (cross(amh, nbpa_hat) * rapn + cross(nbpa_hat, aph) * ramn) * r_sin_a +
+                           cos_beta * (amh * ramn + rapn * ((real_t)2.0 * aph + cot_p * (pbh + cos_p * aph)) - cot_a * (rapn * (amh - aph * cos_a) + ramn * (aph - amh * cos_a)));
+
+            // Eq. 33 multiplied by harmonic term.
+            return d_get(c.f_outer_dihedral, j) * harmonic_energy_gradient(d_get(c.outer_dih0_p, j), cos_beta, grad);
+        }
+
+        // Internal coordinate gradients
+        /**
+         * @brief Compute the gradient of the bond length term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the bond length term.
+         */
+        coord3d bond_length_gradient(const Constants &c) const
+        {
+            return c.f_bond[j] * harmonic_energy_gradient(bond(), c.r0[j], abh);
+        }
+        // Sum of angular gradient components.
+        /**
+         * @brief Compute the sum of the gradients of the bending terms.
+         * @param c The constants for the threadIdx^th node.
+         * @return The sum of the gradients of the bending terms.
+         */
+        coord3d angle_gradient(const Constants &c) const { return inner_angle_gradient(c) + outer_angle_gradient_p(c) + outer_angle_gradient_m(c); }
+        // Sum of inner and outer dihedral gradient components.
+        /**
+         * @brief Compute the sum of the gradients of the dihedral terms.
+         * @param c The constants for the threadIdx^th node.
+         * @return The sum of the gradients of the dihedral terms.
+         */
+        coord3d dihedral_gradient(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case PEDERSEN:
+                return inner_dihedral_gradient(c) + outer_dihedral_gradient_a(c) + outer_dihedral_gradient_m(c) + outer_dihedral_gradient_p(c);
+            case WIRZ:
+                return inner_dihedral_gradient(c);
+            default:
+                return inner_dihedral_gradient(c) + outer_dihedral_gradient_a(c) + outer_dihedral_gradient_m(c) + outer_dihedral_gradient_p(c);
+            }
+        }
+        /**
+         * @brief Compute the energy contribution of the bond length term.
+         * @param c The constants for the threadIdx^th node.
+         * @return The energy contribution of the bond length term.
+         */
+        real_t bond_energy(const Constants &c) const
+        {
+            return (real_t)0.5 * d_get(c.f_bond, j) * harmonic_energy(bond(), d_get(c.r0, j));
+        }
+        /**
+         * @brief Compute the total energy contribution of the bending terms.
+         * @param c The constants for the threadIdx^th node.
+         * @return The energy contribution of the bending terms.
+         */
+        real_t bend_energy(const Constants &c) const
+        {
+            return d_get(c.f_inner_angle, j) * harmonic_energy(angle(), d_get(c.angle0, j));
+        }
+
+        /**
+         * @brief Compute the total energy contribution of the dihedral terms.
+         * @param c The constants for the threadIdx^th node.
+         * @return The energy contribution of the dihedral terms.
+         */
+        real_t dihedral_energy(const Constants &c) const
+        {
+            return d_get(c.f_inner_dihedral, j) * harmonic_energy(dihedral(), d_get(c.inner_dih0, j));
+        }
+        // Harmonic energy contribution from bond stretching, angular bending and dihedral angle bending.
+        // 71 FLOPs
+        /**
+         * @brief Compute the total energy contribution of the bond length, bending and dihedral terms.
+         * @param c The constants for the threadIdx^th node.
+         * @return The energy contribution of the bond length, bending and dihedral terms.
+         */
+        real_t energy(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case FLAT_BOND:
+                return bond_energy(c);
+            case BOND:
+                return bond_energy(c);
+            case BOND_ANGLE:
+                return bond_energy(c) + bend_energy(c);
+            default:
+                return bond_energy(c) + bend_energy(c) + dihedral_energy(c);
+            }
+        }
+        // Sum of bond, angular and dihedral gradient components.
+        /**
+         * @brief Compute the total gradient of the bond length, bending and dihedral terms w.r.t. the coordinates of the threadIdx^th node.
+         * @param c The constants for the threadIdx^th node.
+         * @return The gradient of the bond length, bending and dihedral terms w.r.t. the coordinates of the threadIdx^th node.
+         */
+        coord3d gradient(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case FLAT_BOND:
+                return bond_length_gradient(c);
+            case BOND:
+                return bond_length_gradient(c);
+            case BOND_ANGLE:
+                return bond_length_gradient(c) + angle_gradient(c);
+            case ANGLE:
+                return inner_angle_gradient(c);
+            case DIH:
+                return inner_dihedral_gradient(c);
+            case ANGLE_M:
+                return outer_angle_gradient_m(c);
+            case ANGLE_P:
+                return outer_angle_gradient_p(c);
+            case DIH_A:
+                return outer_dihedral_gradient_a(c);
+            case DIH_M:
+                return outer_dihedral_gradient_m(c);
+            case DIH_P:
+                return outer_dihedral_gradient_p(c);
+            default:
+                return bond_length_gradient(c) + angle_gradient(c) + dihedral_gradient(c);
+            }
+        }
+
+        mat3 hessian_a(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return bond_hessian_a(c);
+            case BOND_ANGLE:
+                return bond_hessian_a(c) + inner_angle_hessian_a(c) + outer_angle_hessian_m_a(c) + outer_angle_hessian_p_a(c);
+            case ANGLE:
+                return inner_angle_hessian_a(c);
+            case ANGLE_M:
+                return outer_angle_hessian_m_a(c);
+            case ANGLE_P:
+                return outer_angle_hessian_p_a(c);
+            case DIH:
+                return dihedral_hessian_a(c);
+            case DIH_A:
+                return outer_dihedral_hessian_a_a(c);
+            case DIH_M:
+                return outer_dihedral_hessian_m_a(c);
+            case DIH_P:
+                return outer_dihedral_hessian_p_a(c);
+            default:
+                return bond_hessian_a(c) + inner_angle_hessian_a(c) + outer_angle_hessian_m_a(c) + outer_angle_hessian_p_a(c) + dihedral_hessian_a(c) + outer_dihedral_hessian_a_a(c) + outer_dihedral_hessian_m_a(c) + outer_dihedral_hessian_p_a(c);
+            }
+        }
+
+        mat3 hessian_b(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return bond_hessian_b(c);
+            case BOND_ANGLE:
+                return bond_hessian_b(c) + inner_angle_hessian_b(c) + outer_angle_hessian_m_b(c) + outer_angle_hessian_p_b(c);
+            case ANGLE:
+                return inner_angle_hessian_b(c);
+            case ANGLE_M:
+                return outer_angle_hessian_m_b(c);
+            case ANGLE_P:
+                return outer_angle_hessian_p_b(c);
+            case DIH:
+                return dihedral_hessian_b(c);
+            case DIH_A:
+                return outer_dihedral_hessian_a_b(c);
+            case DIH_M:
+                return outer_dihedral_hessian_m_b(c);
+            case DIH_P:
+                return outer_dihedral_hessian_p_b(c);
+            default:
+                return bond_hessian_b(c) + inner_angle_hessian_b(c) + outer_angle_hessian_m_b(c) + outer_angle_hessian_p_b(c) + dihedral_hessian_b(c) + outer_dihedral_hessian_a_b(c) + outer_dihedral_hessian_m_b(c) + outer_dihedral_hessian_p_b(c);
+            }
+        }
+
+        mat3 hessian_c(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return mat3();
+            case BOND_ANGLE:
+                return inner_angle_hessian_c(c);
+            case ANGLE:
+                return inner_angle_hessian_c(c);
+            case ANGLE_M:
+                return mat3();
+            case ANGLE_P:
+                return mat3();
+            case DIH:
+                return dihedral_hessian_c(c);
+            case DIH_A:
+                return mat3();
+            case DIH_M:
+                return mat3();
+            case DIH_P:
+                return mat3();
+            default:
+                return inner_angle_hessian_c(c) + dihedral_hessian_c(c);
+            }
+        }
+
+        mat3 hessian_d(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return mat3();
+            case BOND_ANGLE:
+                return mat3();
+            case ANGLE:
+                return mat3();
+            case ANGLE_M:
+                return mat3();
+            case ANGLE_P:
+                return mat3();
+            case DIH:
+                return dihedral_hessian_d(c);
+            case DIH_A:
+                return mat3();
+            case DIH_M:
+                return mat3();
+            case DIH_P:
+                return mat3();
+            default:
+                return dihedral_hessian_d(c);
+            }
+            return dihedral_hessian_d(c);
+        }
+
+        mat3 hessian_m(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return mat3();
+            case BOND_ANGLE:
+                return outer_angle_hessian_m_m(c);
+            case ANGLE:
+                return mat3();
+            case ANGLE_M:
+                return outer_angle_hessian_m_m(c);
+            case ANGLE_P:
+                return mat3();
+            case DIH:
+                return mat3();
+            case DIH_A:
+                return outer_dihedral_hessian_a_m(c);
+            case DIH_M:
+                return outer_dihedral_hessian_m_m(c);
+            case DIH_P:
+                return outer_dihedral_hessian_p_m(c);
+            default:
+                return outer_angle_hessian_m_m(c) + outer_dihedral_hessian_a_m(c) + outer_dihedral_hessian_m_m(c) + outer_dihedral_hessian_p_m(c);
+            }
+        }
+
+        mat3 hessian_p(const Constants &c) const
+        {
+            switch (FFT)
+            {
+            case BOND:
+                return mat3();
+            case BOND_ANGLE:
+                return outer_angle_hessian_p_p(c);
+            case ANGLE:
+                return mat3();
+            case ANGLE_M:
+                return mat3();
+            case ANGLE_P:
+                return outer_angle_hessian_p_p(c);
+            case DIH:
+                return mat3();
+            case DIH_A:
+                return outer_dihedral_hessian_a_p(c);
+            case DIH_M:
+                return outer_dihedral_hessian_m_p(c);
+            case DIH_P:
+                return outer_dihedral_hessian_p_p(c);
+            default:
+                return outer_angle_hessian_p_p(c) + outer_dihedral_hessian_a_p(c) + outer_dihedral_hessian_m_p(c) + outer_dihedral_hessian_p_p(c);
+            }
+        }
+
+        // Reciprocal lengths of arcs ab, ac, am, ap.
+        real_t
+            rab,
+            rabn,
+            racn,
+            radn,
+            ramn,
+            rbmn,
+            rbpn,
+            rbcn,
+            rdbn,
+            rmpn,
+            rapn;
+
+        // Base Arcs,
+        coord3d
+            ab,
+            ac,
+            ad;
+
+        // All normalized arcs required to perform energy & gradient calculations.
+        // Note that all these arcs are cyclical the arc ab becomes: ab->ac->ad,  the arc ac becomes: ac->ad->ab , the arc bc becomes: bc->cd->db (For iterations 0, 1, 2)
+        // As such the naming convention here is related to the arcs as they are used in the 0th iteration.
+        coord3d
+            abh,
+            ach,
+            adh,
+            bph,
+            bmh,
+            amh,
+            aph,
+            bah,
+            bch,
+            cdh,
+            dbh,
+            mph,
+            mbh,
+            pah,
+            pbh;
+
+        coord3d
+            face_center, // Center of the face to the left of the arc a->b, a->b, a->c
+            face_offset; // Difference between the node coordinates X and the face-center coordinates face_center
+
+        coord3d A[3];
+    };
+
+    /**
+     * @brief Compute the total gradient of the bond, flatness, bending and dihedral terms w.r.t. the coordinates of the threadIdx^th node.
+     * @param c The constants for the threadIdx^th node.
+     * @return The gradient of the bond, flatness, bending and dihedral terms w.r.t. the coordinates of the threadIdx^th node.
+     */
+    coord3d gradient(const sycl::local_accessor<coord3d, 1> &X) const
+    {
+        sycl::group_barrier(cta);
+        coord3d grad = {0.0, 0.0, 0.0};
+        for (int j = 0; j < 3; j++)
+        {
+            ArcData arc = ArcData(cta, j, X, node_graph);
+            grad += arc.gradient(constants);
+        }
+        return grad;
+        // switch (FFT)
+        //{
+        // case FLATNESS_ENABLED: {
+        //     FaceData face(cta, X, node_graph);
+        //     auto face_grad = face.flatness_gradient(constants, reinterpret_cast<coord3d*>(sdata));
+        //     return grad + face_grad;
+        //     }
+        // case FLAT_BOND:{
+        //     FaceData face(cta, X, node_graph);
+        //     auto face_grad = face.flatness_gradient(constants, reinterpret_cast<coord3d*>(sdata));
+        //     return grad + face_grad;
+        //     }
+        // default:
+        //     return grad;
+        // }
+    }
+
+    hessian_t<T, K> hessian(const sycl::local_accessor<coord3d, 1> &X) const
+    {
+        sycl::group_barrier(cta);
+        hessian_t<T, K> hess(cta, node_graph);
+        for (int j = 0; j < 3; j++)
+        {
+            ArcData arc = ArcData(cta, j, X, node_graph);
+            hess.A[0] += arc.hessian_a(constants);
+            hess.A[1 + j] += arc.hessian_b(constants);
+            hess.A[1 + (j + 1) % 3] += arc.hessian_c(constants);
+            hess.A[1 + (j + 2) % 3] += arc.hessian_d(constants);
+            hess.A[4 + j] += arc.hessian_m(constants);
+            hess.A[7 + j] += arc.hessian_p(constants);
+        }
+        return hess;
+    }
+
+    /**
+     * @brief The block-Jacobi preconditioner of this node: the inverse of its 3x3 diagonal hessian block, made positive definite by symMat3::positive_inverse.
+     *        Bond terms are several times stiffer than angle and dihedral terms, scaling the gradient by the local curvature evens out the directions CG has to resolve.
+     */
+    symMat3<T> diagonal_block_inverse(const sycl::local_accessor<coord3d, 1> &X) const
+    {
+        sycl::group_barrier(cta);
+        mat3 H;
+        for (int j = 0; j < 3; j++) H += ArcData(cta, j, X, node_graph).hessian_a(constants);
+        // The block is symmetric up to rounding.
+        return symMat3<T>(H.A[0], (H.A[1] + H.A[3]) / 2, (H.A[2] + H.A[6]) / 2, H.A[4], (H.A[5] + H.A[7]) / 2, H.A[8]).positive_inverse((real_t)1e-2);
+    }
+
+    // Uses finite difference to compute the hessian
+    hessian_t<T, K> fd_hessian(const sycl::local_accessor<coord3d, 1> &X, const float reldelta = 1e-7) const
+    {
+        hessian_t<T, K> hess_fd(cta, node_graph);
+        for (uint16_t i = 0; i < N; i++)
+        {
+            for (int j = 0; j < 10; j++)
+            {
+                auto node = hess_fd.indices[j];
+                coord3d X0 = X[node];
+                for (int k = 0; k < 3; k++)
+                {
+                    if (i == node_id)
+                    {
+                        X[node][k] = X0[k] + X0[k] * reldelta;
+                    }
+                    coord3d grad_X0_p = gradient(X);
+                    sycl::group_barrier(cta);
+                    if (i == node_id)
+                    {
+                        X[node][k] = X0[k] - X0[k] * reldelta;
+                    }
+                    coord3d grad_X0_m = gradient(X);
+                    sycl::group_barrier(cta);
+                    if (i == node_id)
+                    {
+                        hess_fd.A[j][0][k] = (grad_X0_p[0] - grad_X0_m[0]) / (2 * X0[k] * reldelta);
+                        hess_fd.A[j][1][k] = (grad_X0_p[1] - grad_X0_m[1]) / (2 * X0[k] * reldelta);
+                        hess_fd.A[j][2][k] = (grad_X0_p[2] - grad_X0_m[2]) / (2 * X0[k] * reldelta);
+                        X[node][k] = X0[k];
+                    }
+                    sycl::group_barrier(cta);
+                }
+            }
+        }
+        return hess_fd;
+    }
+
+    /**
+     * @brief Compute the total energy of the bond, flatness, bending and dihedral terms from all nodes in the isomer.
+     * @param c The constants for the threadIdx^th node.
+     * @return Total energy.
+     */
+    real_t energy(const sycl::local_accessor<coord3d, 1> &X) const
+    {
+        sycl::group_barrier(cta);
+        return energy_reduce(std::array<real_t, 1>{node_energy(X)})[0];
+    }
+
+    //Sums M node energies over the isomer, compensated for float when COMPENSATED_ENERGY is set.
+    template <size_t M>
+    std::array<real_t, M> energy_reduce(const std::array<real_t, M> &energies) const
+    {
+        if constexpr (COMPENSATED_ENERGY && std::is_same_v<T, float>)
+            return compensated_sum(cta, energies, sdata);
+        else
+            return custom_reduce(cta, sg, energies, sdata, sycl::plus<real_t>{});
+    }
+
+    /**
+     * @brief The energy contribution of the threadIdx^th node, not reduced over the isomer. X must be visible to the whole group.
+     * @param X The coordinates of all nodes in the isomer.
+     * @return Energy of the three arcs starting in this node.
+     */
+    real_t node_energy(const sycl::local_accessor<coord3d, 1> &X) const
+    {
+        real_t arc_energy = (real_t)0.0;
+
+        //(71 + 124) * 3 * N  = 585*N FLOPs
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            ArcData arc = ArcData(cta, j, X, node_graph);
+            arc_energy += arc.energy(constants);
+            /* if (isnan(arc_energy)){
+                if(isnan(arc.bond_energy(constants))) printf ("Thread: %d, %d, Bond energy is nan\n", node_id, j);
+                if(isnan(arc.dihedral_energy(constants))) {
+                    printf ("Thread: %d, %d, Dihedral energy is nan\n", node_id, j);
+                    printf("Dihedral = %f\n", arc.dihedral());
+                    printf("Dihedral0 = %f\n", constants.inner_dih0[j]);
+                    printf("DihedralForce = %f\n", constants.f_inner_dihedral[j]);
+                }
+                if(isnan(arc.bend_energy(constants))) printf ("Thread: %d, %d, Bend energy is nan\n", node_id, j);
+            } */
+        }
+        return arc_energy;
+
+        // switch (FFT)
+        //{
+        // case FLATNESS_ENABLED: {
+        //     FaceData face(cta, X, node_graph);
+        //     return reduce_over_group(cta, arc_energy + face.flatness_energy(constants), sycl::plus<real_t>{});
+        //     }
+        // case FLAT_BOND: {
+        //     FaceData face(cta, X, node_graph);
+        //     return reduce_over_group(cta, arc_energy + face.flatness_energy(constants), sycl::plus<real_t>{});
+        //     }
+        // default:
+        //     return reduce_over_group(cta, arc_energy, sycl::plus<real_t>{});
+        // }
+    }
+
+    // Golden Section Search, using fixed iterations.
+    /**
+     * @brief Golden Section Search for line-search.
+     * @param X The coordinates of the nodes.
+     * @param r0 The direction of the line-search.
+     * @param X1 memory for storing temporary coordinates at x1.
+     * @param X2 memory for storing temporary coordinates at x2.
+     * @return The step-size alpha
+     */
+    real_t GSS(const sycl::local_accessor<coord3d, 1> &X, const coord3d &r0, const sycl::local_accessor<coord3d, 1> &X1, const sycl::local_accessor<coord3d, 1> &X2, real_t &E0) const
+    {
+        const real_t tau = (real_t)0.6180339887;
+        // Line search x - values;
+        real_t a = 0.0;
+        real_t b = (real_t)1.0;
+
+        real_t x1, x2;
+        x1 = (a + ((real_t)1. - tau) * (b - a));
+        x2 = (a + tau * (b - a));
+        // Actual coordinates resulting from each traversal
+        X1[node_id] = X[node_id] + x1 * r0;
+        X2[node_id] = X[node_id] + x2 * r0;
+
+        // The energies at both inner points and at the starting point are needed up front, reduce them together.
+        sycl::group_barrier(cta);
+        auto [f0, f1, f2] = energy_reduce(std::array<real_t, 3>{node_energy(X), node_energy(X1), node_energy(X2)});
+        E0 = f0;
+
+        for (int i = 0; i < 20; i++)
+        {
+            if (f1 > f2)
+            {
+                a = x1;
+                x1 = x2;
+                f1 = f2;
+                x2 = a + tau * (b - a);
+                X2[node_id] = X[node_id] + x2 * r0;
+                f2 = energy(X2);
+            }
+            else
+            {
+                b = x2;
+                x2 = x1;
+                f2 = f1;
+                x1 = a + ((real_t)1.0 - tau) * (b - a);
+                X1[node_id] = X[node_id] + x1 * r0;
+                f1 = energy(X1);
+            }
+        }
+        if (f1 > f0)
+        {
+            return (real_t)0.0;
+        }
+        // Line search coefficient
+        real_t alpha = (a + b) / (real_t)2.0;
+        return alpha;
+    }
+
+    //Rounds multi_point_search needs to shrink the bracket at least as far as the 20 iterations of GSS do, to tau^20 ~ 6.6e-5.
+    static constexpr int multi_point_rounds(const size_t P)
+    {
+        double width = 1.0;
+        int rounds = 0;
+        for (; width > 6.6e-5; rounds++) width *= 2.0 / (P + 1);
+        return rounds;
+    }
+
+    /**
+     * @brief Line search that evaluates P equally spaced trial points of the bracket at once and narrows the bracket to the neighbours of the best one.
+     *        GSS pays one group reduction per trial point, here the P energies of a round share a single fused reduction, so the search needs
+     *        multi_point_rounds(P) reductions instead of 21. The first round also reduces the energy at X.
+     * @param X The coordinates of the nodes.
+     * @param r0 The direction of the line-search.
+     * @param XP P arrays for the coordinates at the trial points.
+     * @param E0 Receives the energy at X.
+     * @return The best trial point, or 0 if no trial point lowers the energy.
+     */
+    template <size_t P>
+    real_t multi_point_search(const sycl::local_accessor<coord3d, 1> &X, const coord3d &r0, const std::array<sycl::local_accessor<coord3d, 1>, P> &XP, real_t &E0) const
+    {
+        static_assert(P >= 3, "multi_point_search needs at least three trial points to use fewer reductions than GSS");
+        real_t a = 0.0, b = (real_t)1.0;
+        real_t x_best = 0.0, f_best = 0.0;
+        for (int round = 0; round < multi_point_rounds(P); round++)
+        {
+            real_t h = (b - a) / (real_t)(P + 1);
+            for (size_t j = 0; j < P; j++) XP[j][node_id] = X[node_id] + (a + (real_t)(j + 1) * h) * r0;
+            sycl::group_barrier(cta);
+            std::array<real_t, P + 1> f;
+            f[0] = round == 0 ? node_energy(X) : (real_t)0.0;
+            for (size_t j = 0; j < P; j++) f[j + 1] = node_energy(XP[j]);
+            f = energy_reduce(f);
+            if (round == 0) E0 = f[0];
+
+            // Every work-item sees the same sums, so the choice is uniform across the group. Ties go to the shorter step.
+            size_t j_best = 0;
+            for (size_t j = 1; j < P; j++)
+                if (f[j + 1] < f[j_best + 1]) j_best = j;
+            x_best = a + (real_t)(j_best + 1) * h;
+            f_best = f[j_best + 1];
+            b = x_best + h;
+            a = x_best - h;
+        }
+        return f_best > E0 ? (real_t)0.0 : x_best;
+    }
+
+    //Line search selected by LINE_SEARCH_POINTS along r0, on the bracket [0, 1].
+    real_t line_search(const sycl::local_accessor<coord3d, 1> &X, const coord3d &r0, const sycl::local_accessor<coord3d, 1> &X1, const sycl::local_accessor<coord3d, 1> &X2, const std::array<sycl::local_accessor<coord3d, 1>, LINE_SEARCH_POINTS> &XP, real_t &E0) const
+    {
+#if LINE_SEARCH_POINTS > 0
+        return multi_point_search(X, r0, XP, E0);
+#else
+        return GSS(X, r0, X1, X2, E0);
+#endif
+    }
+
+    /**
+     * @brief Conjugate Gradient Method for energy minimization.
+     * @param X The coordinates of the nodes.
+     * @param X1 memory for storing temporary coordinates.
+     * @param X2 memory for storing temporary coordinates.
+     * @param XP Coordinates of the trial points of multi_point_search, empty when LINE_SEARCH_POINTS is 0.
+     * @param MaxIter The maximum number of iterations.
+     * @param tolerance The isomer is converged when the gradient norm divided by N drops below this value.
+     * @param telemetry Ring receiving energy, gradient norm and step length of every stride'th iteration, records nothing by default.
+     * @return The number of iterations performed, less than MaxIter if the isomer converged.
+     */
+    size_t CG(const sycl::local_accessor<coord3d, 1> &X, const sycl::local_accessor<coord3d, 1> &X1, const sycl::local_accessor<coord3d, 1> &X2, const std::array<sycl::local_accessor<coord3d, 1>, LINE_SEARCH_POINTS> &XP, const size_t MaxIter, const real_t tolerance, const TelemetryView<T> &telemetry = {})
+    {
+#if BLOCK_JACOBI_INTERVAL > 0
+        return preconditioned_CG(X, X1, X2, XP, MaxIter, tolerance, telemetry);
+#else
+        real_t alpha, beta, g0_norm2, s_norm, E0;
+        coord3d g0, g1, s;
+        g0 = gradient(X);
+        s = -g0;
+
+        // Normalize To match reference python implementation by Buster.
+        g0_norm2 = custom_reduce(cta, dot(g0, g0), sdata, sycl::plus<real_t>{});
+        s_norm = SQRT(g0_norm2);
+        // s_norm = SQRT(reduction(sdata, dot(s,s)));
+        // A zero gradient is converged before the first step, s stays zero instead of 0 / 0.
+        if (s_norm > (real_t)0.0) s /= s_norm;
+
+        sycl::group_barrier(cta);
+        size_t i = 0;
+        for (; i < MaxIter; i++)
+        {
+            if (SQRT(g0_norm2) / (real_t)N < tolerance)
+                break;
+
+            alpha = line_search(X, s, X1, X2, XP, E0);
+            if (node_id == 0) telemetry.record(i, E0, SQRT(g0_norm2), alpha);
+
+            if (alpha > (real_t)0.0)
+            {
+                X1[node_id] = X[node_id] + alpha * s;
+            }
+            g1 = gradient(X1);
+
+            // One fused reduction gives everything the update needs: g1.g1 is the next g0_norm2, g1.g0 gives the Polak Ribiere numerator,
+            // and since s is normalised |-g1 + beta*s|^2 = g1.g1 - 2*beta*g1.s + beta^2.
+            auto [g1_norm2, g1_dot_g0, g1_dot_s] = custom_reduce(cta, sg, std::array<real_t, 3>{dot(g1, g1), dot(g1, g0), dot(g1, s)}, sdata, sycl::plus<real_t>{});
+
+            // Polak Ribiere method
+            beta = sycl::max((g1_norm2 - g1_dot_g0) / g0_norm2, (real_t)0.0);
+
+            if (alpha > (real_t)0.0)
+            {
+                X[node_id] = X1[node_id];
+                s_norm = SQRT(sycl::max(g1_norm2 - (real_t)2.0 * beta * g1_dot_s + beta * beta, (real_t)0.0));
+                g0_norm2 = g1_norm2;
+            }
+            else
+            {
+                g1 = g0;
+                beta = (real_t)0.0;
+                s_norm = SQRT(g0_norm2);
+            }
+
+            s = -g1 + beta * s;
+            g0 = g1;
+// Normalize Search Direction using MaxNorm or 2Norm
+#if USE_MAX_NORM == 1
+            s_norm = custom_reduce(cta, sycl::max(sycl::max(s.x, s.y), s.z), sdata, sycl::greater<real_t>{});
+#endif
+            if (s_norm > (real_t)0.0) s /= s_norm;
+
+            // if (node_id == 0) printf("s_norm = %f\n", s_norm);
+            // printf("s = (%f, %f, %f)\n", s[0], s[1], s[2]);
+        }
+        return i;
+#endif
+    }
+
+#if BLOCK_JACOBI_INTERVAL > 0
+    /**
+     * @brief Polak Ribiere CG preconditioned with the block-Jacobi preconditioner P of diagonal_block_inverse: the search direction follows z = P g instead of g.
+     *        P is recomputed every BLOCK_JACOBI_INTERVAL iterations, and CG restarts from -z whenever it is, so that beta never mixes two preconditioners.
+     *        The parameters and result are those of CG.
+     */
+    size_t preconditioned_CG(const sycl::local_accessor<coord3d, 1> &X, const sycl::local_accessor<coord3d, 1> &X1, const sycl::local_accessor<coord3d, 1> &X2, const std::array<sycl::local_accessor<coord3d, 1>, LINE_SEARCH_POINTS> &XP, const size_t MaxIter, const real_t tolerance, const TelemetryView<T> &telemetry)
+    {
+        real_t alpha, beta, s_norm, E0;
+        coord3d g0, g1, z0, z1, s;
+        symMat3<T> P = diagonal_block_inverse(X);
+        g0 = gradient(X);
+        z0 = dot(P.mat(), g0);
+        auto [g0_norm2, g0_dot_z0, z0_norm2] = custom_reduce(cta, sg, std::array<real_t, 3>{dot(g0, g0), dot(g0, z0), dot(z0, z0)}, sdata, sycl::plus<real_t>{});
+        // P is positive definite, so z0 is only zero together with the gradient, which is converged before the first step.
+        s = z0_norm2 > (real_t)0.0 ? -z0 / SQRT(z0_norm2) : -z0;
+
+        sycl::group_barrier(cta);
+        size_t i = 0;
+        for (; i < MaxIter; i++)
+        {
+            if (SQRT(g0_norm2) / (real_t)N < tolerance)
+                break;
+
+            alpha = line_search(X, s, X1, X2, XP, E0);
+            if (node_id == 0) telemetry.record(i, E0, SQRT(g0_norm2), alpha);
+
+            if (alpha > (real_t)0.0)
+            {
+                X1[node_id] = X[node_id] + alpha * s;
+            }
+            g1 = gradient(X1);
+            bool refresh = (i + 1) % BLOCK_JACOBI_INTERVAL == 0;
+            if (alpha > (real_t)0.0)
+            {
+                X[node_id] = X1[node_id];
+                if (refresh) P = diagonal_block_inverse(X);
+            }
+            else
+            {
+                g1 = g0;
+            }
+            z1 = dot(P.mat(), g1);
+
+            // As in CG, one fused reduction: g1.z1 and g1.z0 give the Polak Ribiere numerator, and since s is normalised |-z1 + beta*s|^2 = z1.z1 - 2*beta*z1.s + beta^2.
+            auto [g1_norm2, g1_dot_z1, g1_dot_z0, z1_norm2, z1_dot_s] = custom_reduce(cta, sg, std::array<real_t, 5>{dot(g1, g1), dot(g1, z1), dot(g1, z0), dot(z1, z1), dot(z1, s)}, sdata, sycl::plus<real_t>{});
+
+            beta = (alpha > (real_t)0.0 && !refresh) ? sycl::max((g1_dot_z1 - g1_dot_z0) / g0_dot_z0, (real_t)0.0) : (real_t)0.0;
+            s_norm = SQRT(sycl::max(z1_norm2 - (real_t)2.0 * beta * z1_dot_s + beta * beta, (real_t)0.0));
+            s = -z1 + beta * s;
+            if (s_norm > (real_t)0.0) s /= s_norm;
+            g0 = g1;
+            z0 = z1;
+            g0_norm2 = g1_norm2;
+            g0_dot_z0 = g1_dot_z1;
+        }
+        return i;
+    }
+#endif
+
+    /**
+     * @brief Truncated Newton method for the final polish of isomers that are already close to their minimum, where it converges quadratically.
+     *        Every step solves H p = -g approximately with an inner CG on the sparse hessian rows of hessian(). The inner CG stops once the residual
+     *        has dropped by min(1/2, sqrt|g|), or at a direction of negative curvature (Steihaug). The step length is then searched on [0, 2p].
+     *        A step that is not a descent direction, or along which the energy does not drop, is replaced by a step along the normalised -g.
+     * @param X The coordinates of the nodes.
+     * @param X1 memory for storing temporary coordinates.
+     * @param X2 memory for storing temporary coordinates, also holds the direction of the inner CG.
+     * @param XP Coordinates of the trial points of multi_point_search, empty when LINE_SEARCH_POINTS is 0.
+     * @param MaxIter The maximum number of Newton steps.
+     * @param MaxInner The maximum number of inner CG iterations per step.
+     * @param tolerance The isomer is converged when the gradient norm divided by N drops below this value.
+     * @return The number of Newton steps performed, less than MaxIter if the isomer converged. MaxIter if the energy cannot be lowered any further.
+     */
+    size_t Newton(const sycl::local_accessor<coord3d, 1> &X, const sycl::local_accessor<coord3d, 1> &X1, const sycl::local_accessor<coord3d, 1> &X2, const std::array<sycl::local_accessor<coord3d, 1>, LINE_SEARCH_POINTS> &XP, const size_t MaxIter, const size_t MaxInner, const real_t tolerance)
+    {
+        real_t E0;
+        size_t i = 0;
+        for (; i < MaxIter; i++)
+        {
+            coord3d g = gradient(X);
+            hessian_t<T, K> H = hessian(X);
+            real_t g_norm2 = custom_reduce(cta, dot(g, g), sdata, sycl::plus<real_t>{});
+            if (SQRT(g_norm2) / (real_t)N < tolerance)
+                break;
+
+            // Inner CG on H p = -g, starting from p = 0.
+            coord3d p = {0.0, 0.0, 0.0}, r = -g, d = r;
+            real_t r_norm2 = g_norm2;
+            real_t forcing = sycl::min((real_t)0.5, SQRT(SQRT(g_norm2)));
+            for (size_t k = 0; k < MaxInner; k++)
+            {
+                sycl::group_barrier(cta);
+                X2[node_id] = d;
+                sycl::group_barrier(cta);
+                coord3d Hd = {0.0, 0.0, 0.0};
+                for (int j = 0; j < 10; j++) Hd += dot(H.A[j], X2[H.indices[j]]);
+                real_t d_H_d = custom_reduce(cta, dot(d, Hd), sdata, sycl::plus<real_t>{});
+                if (d_H_d <= (real_t)0.0)
+                {
+                    if (k == 0) p = d;
+                    break;
+                }
+                real_t a = r_norm2 / d_H_d;
+                p += a * d;
+                r -= a * Hd;
+                real_t r1_norm2 = custom_reduce(cta, dot(r, r), sdata, sycl::plus<real_t>{});
+                if (r1_norm2 <= forcing * forcing * g_norm2)
+                    break;
+                d = r + (r1_norm2 / r_norm2) * d;
+                r_norm2 = r1_norm2;
+            }
+
+            auto [g_dot_p, p_norm2] = custom_reduce(cta, sg, std::array<real_t, 2>{dot(g, p), dot(p, p)}, sdata, sycl::plus<real_t>{});
+            real_t alpha = (real_t)0.0;
+            coord3d s = (real_t)2.0 * p;
+            if (g_dot_p < (real_t)0.0 && p_norm2 > (real_t)0.0) alpha = line_search(X, s, X1, X2, XP, E0);
+            if (alpha == (real_t)0.0)
+            {
+                s = -g / SQRT(g_norm2);
+                alpha = line_search(X, s, X1, X2, XP, E0);
+            }
+            if (alpha == (real_t)0.0) return MaxIter;
+            sycl::group_barrier(cta);
+            X[node_id] = X[node_id] + alpha * s;
+        }
+        return i;
+    }
+};
+
+/**
+ * @brief The forcefield for isomers larger than a work-group: work-item t owns the nodes t, t + L, t + 2L, ... of an isomer, where L is the group size.
+ *        Coordinates, search direction and gradients do not fit in local memory and live in global memory, and each reduction first sums the nodes
+ *        of a work-item in registers before the group reduction. Only the reduction scratch is local.
+ */
+template <ForcefieldType FFT, typename T, typename K>
+struct StridedForceField
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    typedef typename ForceField<FFT, T, K>::ArcData ArcData;
+
+    const NodeNeighbours<K> *node_graph; // Neighbours of every node in the isomer.
+    const Constants<T, K> *constants;    // Forcefield constants of every node in the isomer.
+    size_t first, stride;                // The nodes of this work-item are first, first + stride, ...
+    size_t N;
+    const sycl::group<1> cta;
+    const sycl::sub_group sg;
+    real_t *sdata; // Local memory used exclusively for reduction.
+
+    StridedForceField(const NodeNeighbours<K> *G, const Constants<T, K> *c, const size_t N, sycl::group<1> cta, sycl::sub_group sg, real_t *sdata)
+        : node_graph(G), constants(c), N(N), cta(cta), sg(sg), sdata(sdata)
+    {
+        first = cta.get_local_linear_id();
+        stride = cta.get_local_linear_range();
+    }
+
+    //Sums M per work-item partial sums over the group, compensated for float energies like ForceField::energy_reduce.
+    template <size_t M>
+    std::array<real_t, M> reduce(const std::array<real_t, M> &partial) const
+    {
+        if constexpr (COMPENSATED_ENERGY && std::is_same_v<T, float>)
+            return compensated_sum(cta, partial, sdata);
+        else
+            return custom_reduce(cta, sg, partial, sdata, sycl::plus<real_t>{});
+    }
+
+    coord3d gradient(const coord3d *X, const size_t node) const
+    {
+        coord3d grad = {0.0, 0.0, 0.0};
+        for (int j = 0; j < 3; j++) grad += ArcData((node_t)node, j, X, node_graph[node]).gradient(constants[node]);
+        return grad;
+    }
+
+    real_t node_energy(const coord3d *X, const size_t node) const
+    {
+        real_t arc_energy = (real_t)0.0;
+        for (int j = 0; j < 3; j++) arc_energy += ArcData((node_t)node, j, X, node_graph[node]).energy(constants[node]);
+        return arc_energy;
+    }
+
+    //Energies of M coordinate sets in one fused reduction. The sets must be complete, the barrier makes the writes of the other work-items visible.
+    template <size_t M>
+    std::array<real_t, M> energies(const std::array<const coord3d *, M> &Xs) const
+    {
+        sycl::group_barrier(cta);
+        std::array<real_t, M> partial{};
+        for (size_t node = first; node < N; node += stride)
+            for (size_t m = 0; m < M; m++) partial[m] += node_energy(Xs[m], node);
+        return reduce(partial);
+    }
+
+    //Golden section search along r0, as ForceField::GSS.
+    real_t GSS(const coord3d *X, const coord3d *r0, coord3d *X1, coord3d *X2, real_t &E0) const
+    {
+        const real_t tau = (real_t)0.6180339887;
+        real_t a = 0.0;
+        real_t b = (real_t)1.0;
+        real_t x1 = (a + ((real_t)1. - tau) * (b - a));
+        real_t x2 = (a + tau * (b - a));
+        for (size_t node = first; node < N; node += stride)
+        {
+            X1[node] = X[node] + x1 * r0[node];
+            X2[node] = X[node] + x2 * r0[node];
+        }
+        auto [f0, f1, f2] = energies<3>({X, X1, X2});
+        E0 = f0;
+
+        for (int i = 0; i < 20; i++)
+        {
+            if (f1 > f2)
+            {
+                a = x1;
+                x1 = x2;
+                f1 = f2;
+                x2 = a + tau * (b - a);
+                for (size_t node = first; node < N; node += stride) X2[node] = X[node] + x2 * r0[node];
+                f2 = energies<1>({X2})[0];
+            }
+            else
+            {
+                b = x2;
+                x2 = x1;
+                f2 = f1;
+                x1 = a + ((real_t)1.0 - tau) * (b - a);
+                for (size_t node = first; node < N; node += stride) X1[node] = X[node] + x1 * r0[node];
+                f1 = energies<1>({X1})[0];
+            }
+        }
+        if (f1 > f0) return (real_t)0.0;
+        return (a + b) / (real_t)2.0;
+    }
+
+    /**
+     * @brief Conjugate gradient minimisation, the same iteration as ForceField::CG with every per-node quantity in global memory.
+     * @param X The coordinates of the isomer, optimised in place.
+     * @param X1 Scratch for N coordinates, holds the trial coordinates.
+     * @param X2 Scratch for N coordinates, holds the trial coordinates during the line search and the new gradient after it.
+     * @param g0 Scratch for the N gradients.
+     * @param s Scratch for the N components of the search direction.
+     * @param MaxIter The maximum number of iterations.
+     * @param tolerance The isomer is converged when the gradient norm divided by N drops below this value.
+     * @param telemetry Ring receiving energy, gradient norm and step length of every stride'th iteration, records nothing by default.
+     * @return The number of iterations performed, less than MaxIter if the isomer converged.
+     */
+    size_t CG(coord3d *X, coord3d *X1, coord3d *X2, coord3d *g0, coord3d *s, const size_t MaxIter, const real_t tolerance, const TelemetryView<T> &telemetry = {}) const
+    {
+        real_t alpha, beta, s_norm, E0;
+        sycl::group_barrier(cta);
+        real_t partial = 0.0;
+        for (size_t node = first; node < N; node += stride)
+        {
+            g0[node] = gradient(X, node);
+            partial += dot(g0[node], g0[node]);
+        }
+        real_t g0_norm2 = reduce(std::array<real_t, 1>{partial})[0];
+        s_norm = SQRT(g0_norm2);
+        // A zero gradient is converged before the first step, s stays zero instead of 0 / 0.
+        for (size_t node = first; node < N; node += stride) s[node] = s_norm > (real_t)0.0 ? -g0[node] / s_norm : -g0[node];
+
+        size_t i = 0;
+        for (; i < MaxIter; i++)
+        {
+            if (SQRT(g0_norm2) / (real_t)N < tolerance)
+                break;
+
+            alpha = GSS(X, s, X1, X2, E0);
+            if (first == 0) telemetry.record(i, E0, SQRT(g0_norm2), alpha);
+
+            if (alpha > (real_t)0.0)
+                for (size_t node = first; node < N; node += stride) X1[node] = X[node] + alpha * s[node];
+            sycl::group_barrier(cta);
+            // The line search is done with X2, it receives the new gradient.
+            std::array<real_t, 3> partials = {0.0, 0.0, 0.0};
+            for (size_t node = first; node < N; node += stride)
+            {
+                coord3d g1 = gradient(X1, node);
+                partials[0] += dot(g1, g1);
+                partials[1] += dot(g1, g0[node]);
+                partials[2] += dot(g1, s[node]);
+                X2[node] = g1;
+            }
+            auto [g1_norm2, g1_dot_g0, g1_dot_s] = custom_reduce(cta, sg, partials, sdata, sycl::plus<real_t>{});
+
+            // Polak Ribiere method
+            beta = sycl::max((g1_norm2 - g1_dot_g0) / g0_norm2, (real_t)0.0);
+            bool accept = alpha > (real_t)0.0;
+            if (accept)
+            {
+                s_norm = SQRT(sycl::max(g1_norm2 - (real_t)2.0 * beta * g1_dot_s + beta * beta, (real_t)0.0));
+                g0_norm2 = g1_norm2;
+            }
+            else
+            {
+                beta = (real_t)0.0;
+                s_norm = SQRT(g0_norm2);
+            }
+
+#if USE_MAX_NORM == 1
+            real_t s_max = std::numeric_limits<real_t>::lowest();
+            for (size_t node = first; node < N; node += stride)
+            {
+                coord3d s1 = -(accept ? X2[node] : g0[node]) + beta * s[node];
+                s_max = sycl::max(s_max, sycl::max(sycl::max(s1[0], s1[1]), s1[2]));
+            }
+            s_norm = custom_reduce(cta, s_max, sdata, sycl::greater<real_t>{});
+#endif
+            // Every work-item only touches its own nodes here, the next line search starts with a barrier.
+            for (size_t node = first; node < N; node += stride)
+            {
+                coord3d g1 = accept ? X2[node] : g0[node];
+                if (accept) X[node] = X1[node];
+                coord3d s1 = -g1 + beta * s[node];
+                s[node] = s_norm > (real_t)0.0 ? s1 / s_norm : s1;
+                g0[node] = g1;
+            }
+        }
+        return i;
+    }
+};
+
+// Kernel names, templated since the kernels are instantiated for both precisions.
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class optimise_kernel;
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class energies_kernel;
+template <ForcefieldType FFT, typename K, StoragePolicy S> class polish_begin;
+template <ForcefieldType FFT, typename K, StoragePolicy S> class polish_end;
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class optimise_strided_kernel;
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class energies_strided_kernel;
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class optimise_persistent_kernel;
+template <ForcefieldType FFT, typename T, typename K> class optimise_ragged_kernel;
+template <typename T, typename K, StoragePolicy S> class optimise_staged_kernel;
+template <ForcefieldType FFT, typename T, typename K, StoragePolicy S> class newton_kernel;
+
+//Elements of reduction scratch the forcefield kernels need: three fused reductions (five in the preconditioned CG), or LINE_SEARCH_POINTS + 1 in the multi-point line search.
+//Compensated energies need twice the room.
+template <typename T>
+size_t forcefield_scratch_size(const size_t N)
+{
+    size_t M = std::max<size_t>(BLOCK_JACOBI_INTERVAL > 0 ? 5 : 3, LINE_SEARCH_POINTS + 1);
+    return std::max(reduction_scratch_size(N, M), (COMPENSATED_ENERGY && std::is_same_v<T, float>) ? 2 * M * N : 0);
+}
+
+//Local memory used by one work-group of forcefield_optimise: the reduction scratch, the three coordinate arrays and the trial points of the line search.
+template <typename T>
+size_t forcefield_local_bytes(const size_t N)
+{
+    return forcefield_scratch_size<T>(N) * sizeof(T) + (3 + LINE_SEARCH_POINTS) * N * sizeof(std::array<T, 3>);
+}
+
+//P local arrays of n elements each.
+template <typename U, size_t... I>
+std::array<sycl::local_accessor<U, 1>, sizeof...(I)> make_local_arrays(const size_t n, sycl::handler &h, std::index_sequence<I...>)
+{
+    return {((void)I, sycl::local_accessor<U, 1>(n, h))...};
+}
+
+//Work-group size of the strided kernels for isomers that do not fit a work-group of N work-items.
+inline size_t strided_group_size(const sycl::device &device, const size_t N)
+{
+    return std::min(N, device.get_info<sycl::info::device::max_work_group_size>());
+}
+
+/**
+ * @brief forcefield_optimise for isomers too large for a work-group of N work-items or for local memory, e.g. C1000 and beyond.
+ *        Each work-group still optimises one isomer, but with strided_group_size work-items that own several nodes each.
+ *        The coordinates are optimised in place in B.X, the trial coordinates, gradients, search directions and per-node constants live in global scratch taken from the UsmPool of Q.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param iterations The number of CG iterations to run in this launch.
+ * @param max_iterations The total iteration budget per isomer, an isomer which exhausts it is marked FAILED.
+ * @param telemetry Convergence telemetry, one ring per slot of B.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch, which holds the scratch until it is done.
+ * @throws sycl::exception if the reduction scratch does not fit in local memory.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_optimise_strided(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, Telemetry<T> &telemetry, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    size_t N = B.N(), L = strided_group_size(Q.get_device(), N);
+    check_launch(Q.get_device(), L, forcefield_scratch_size<T>(L) * sizeof(T), "forcefield_optimise_strided");
+    // X1, X2, g0 and s for every slot.
+    coord3d *scratch = pool_malloc<coord3d>(4 * N * B.capacity(), Q);
+    NodeNeighbours<K> *graphs = pool_malloc<NodeNeighbours<K>>(N * B.capacity(), Q);
+    Constants<T, K> *constants = pool_malloc<Constants<T, K>>(N * B.capacity(), Q);
+    // The scratch goes back to the pool once the kernel is done, or right away if the submission throws.
+    auto done = std::make_shared<sycl::event>();
+    std::vector<std::shared_ptr<void>> keep_alive = {pool_hold(scratch, Q, done), pool_hold(graphs, Q, done), pool_hold(constants, Q, done)};
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        h.depends_on(dependencies);
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(L), h);
+        auto X_acc = B.X.view(h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h);
+        auto iterations_acc = B.iterations.view(h);
+        auto IDs_acc = B.IDs.view(h, sycl::read_only);
+        sycl::accessor samples_acc(telemetry.samples, h, sycl::read_write);
+        sycl::accessor counts_acc(telemetry.counts, h, sycl::read_write);
+        uint32_t stride = telemetry.stride, depth = telemetry.depth;
+        h.parallel_for<optimise_strided_kernel<FFT, T, K, S>>(sycl::nd_range(sycl::range{L*B.capacity()}, sycl::range{L}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            if (statuses_acc[bid] != IsomerStatus::NOT_CONVERGED) return;
+
+            coord3d *X = &X_acc[bid*N];
+            coord3d *X1 = scratch + bid*4*N, *X2 = X1 + N, *g0 = X2 + N, *s = g0 + N;
+            NodeNeighbours<K> *G = graphs + bid*N;
+            Constants<T,K> *C = constants + bid*N;
+            for (size_t node = tid; node < N; node += L)
+            {
+                G[node] = NodeNeighbours<K>(cubic_neighbours_acc, bid, N, node);
+                C[node] = Constants<T,K>(cubic_neighbours_acc, bid, N, node);
+            }
+            StridedForceField<FFT,T,K> FF(G, C, N, cta, nditem.get_sub_group(), sdata.get_pointer());
+            size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(iterations_acc[bid], (size_t)max_iterations));
+            TelemetryView<T> telemetry_view;
+            if (stride > 0) telemetry_view = TelemetryView<T>{&samples_acc[bid*depth], &counts_acc[bid], IDs_acc[bid], (uint32_t)iterations_acc[bid], stride, depth};
+            size_t n_iterations = FF.CG(X, X1, X2, g0, s, budget, tolerance, telemetry_view);
+            if (tid == 0)
+            {
+                iterations_acc[bid] += n_iterations;
+                if (n_iterations < budget) statuses_acc[bid] = IsomerStatus::CONVERGED;
+                else if (iterations_acc[bid] >= (size_t)max_iterations) statuses_acc[bid] = IsomerStatus::FAILED;
+            }
+        }); });
+    *done = event;
+    profile("forcefield_optimise_strided", Q, event);
+    return {event, keep_alive};
+}
+
+/**
+ * @brief forcefield_optimise for a ragged batch of isomers of mixed sizes, in one launch. Like forcefield_optimise_strided, each work-group optimises one isomer,
+ *        with as many work-items as the largest isomer of the batch (up to the work-group limit), so isomers smaller than that leave work-items idle, see bucket_by_size.
+ * @param Q The queue to submit the kernel to.
+ * @param R The ragged batch, optimised in place.
+ * @param iterations The number of CG iterations to run in this launch.
+ * @param max_iterations The total iteration budget per isomer, an isomer which exhausts it is marked FAILED.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch, which holds the scratch until it is done.
+ * @throws sycl::exception if the reduction scratch does not fit in local memory.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t>
+LaunchFuture forcefield_optimise_ragged(sycl::queue &Q, RaggedBatch<T, K> &R, const int iterations, const int max_iterations, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    if (R.capacity() == 0) return {};
+    size_t n_atoms = R.total_atoms(), L = strided_group_size(Q.get_device(), R.max_N());
+    check_launch(Q.get_device(), L, forcefield_scratch_size<T>(L) * sizeof(T), "forcefield_optimise_ragged");
+    // X1, X2, g0 and s for every atom of the batch, at 4 * offset(i) for slot i.
+    coord3d *scratch = pool_malloc<coord3d>(4 * n_atoms, Q);
+    NodeNeighbours<K> *graphs = pool_malloc<NodeNeighbours<K>>(n_atoms, Q);
+    Constants<T, K> *constants = pool_malloc<Constants<T, K>>(n_atoms, Q);
+    auto done = std::make_shared<sycl::event>();
+    std::vector<std::shared_ptr<void>> keep_alive = {pool_hold(scratch, Q, done), pool_hold(graphs, Q, done), pool_hold(constants, Q, done)};
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        h.depends_on(dependencies);
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(L), h);
+        sycl::accessor X_acc(R.X, h, sycl::read_write);
+        sycl::accessor cubic_neighbours_acc(R.cubic_neighbours, h, sycl::read_only);
+        sycl::accessor offsets_acc(R.offsets, h, sycl::read_only);
+        sycl::accessor statuses_acc(R.statuses, h, sycl::read_write);
+        sycl::accessor iterations_acc(R.iterations, h, sycl::read_write);
+        h.parallel_for<optimise_ragged_kernel<FFT, T, K>>(sycl::nd_range(sycl::range{L*R.capacity()}, sycl::range{L}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            if (statuses_acc[bid] != IsomerStatus::NOT_CONVERGED) return;
+
+            size_t offset = offsets_acc[bid], N = offsets_acc[bid + 1] - offset;
+            coord3d *X = &X_acc[offset];
+            coord3d *X1 = scratch + 4*offset, *X2 = X1 + N, *g0 = X2 + N, *s = g0 + N;
+            NodeNeighbours<K> *G = graphs + offset;
+            Constants<T,K> *C = constants + offset;
+            // The graph of this isomer seen as isomer 0 of a batch of size N.
+            UsmView<const K> graph{&cubic_neighbours_acc[offset*3]};
+            for (size_t node = tid; node < N; node += L)
+            {
+                G[node] = NodeNeighbours<K>(graph, 0, N, node);
+                C[node] = Constants<T,K>(graph, 0, N, node);
+            }
+            StridedForceField<FFT,T,K> FF(G, C, N, cta, nditem.get_sub_group(), sdata.get_pointer());
+            size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(iterations_acc[bid], (size_t)max_iterations));
+            size_t n_iterations = FF.CG(X, X1, X2, g0, s, budget, tolerance, TelemetryView<T>{});
+            if (tid == 0)
+            {
+                iterations_acc[bid] += n_iterations;
+                if (n_iterations < budget) statuses_acc[bid] = IsomerStatus::CONVERGED;
+                else if (iterations_acc[bid] >= (size_t)max_iterations) statuses_acc[bid] = IsomerStatus::FAILED;
+            }
+        }); });
+    *done = event;
+    profile("forcefield_optimise_ragged", Q, event);
+    return {event, keep_alive};
+}
+
+/**
+ * @brief Optimises a mixed-size sweep held as ragged batches, typically one per bucket of bucket_by_size.
+ *        The queues of the scheduler claim batches from a shared counter, so the buckets run concurrently and a faster device takes more of them.
+ * @param scheduler The queues to run on.
+ * @param batches The ragged batches, optimised in place.
+ * @param max_iterations The iteration budget per isomer, run in a single launch per batch.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ */
+template <ForcefieldType FFT, typename T, typename K>
+void forcefield_optimise_ragged(DeviceScheduler &scheduler, std::vector<RaggedBatch<T, K>> &batches, const int max_iterations, const T tolerance = T(1e-3))
+{
+    WorkCounter next(batches.size());
+    scheduler.for_each_queue([&](sycl::queue &Q, size_t)
+                             {
+        std::vector<LaunchFuture> launches;
+        for (auto [b, n] = next.claim(1); n > 0; std::tie(b, n) = next.claim(1))
+            launches.push_back(forcefield_optimise_ragged<FFT>(Q, batches[b], max_iterations, max_iterations, tolerance));
+        for (auto &launch : launches) launch.wait(); });
+}
+
+//The slot a persistent work-group has claimed, as seen by the per-slot body of optimise_persistent. The coordinates of the slot are loaded into X,
+//and the body leaves the optimised ones there.
+template <typename T, typename K>
+struct PersistentSlot
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    NodeNeighbours<K> nodeG;
+    Constants<T, K> constants;
+    sycl::group<1> cta;
+    sycl::sub_group sg;
+    real_t *sdata;
+    sycl::local_accessor<coord3d, 1> X, X1, X2;
+    std::array<sycl::local_accessor<coord3d, 1>, LINE_SEARCH_POINTS> XP;
+    size_t done;                 //Iterations from earlier launches
+    TelemetryView<T> telemetry;  //Disabled unless the launch records telemetry, starts at done
+};
+
+//What the per-slot body of optimise_persistent reports: the iterations it ran, all of which count against max_iterations, and whether its last CG converged.
+struct SlotOutcome
+{
+    size_t iterations;
+    bool converged;
+};
+
+/**
+ * @brief The launch shared by forcefield_optimise_persistent and forcefield_optimise_staged: only as many work-groups as the device keeps resident are launched,
+ *        and each pulls the next slot from a global atomic counter. For every NOT_CONVERGED slot the group loads the coordinates into local memory,
+ *        runs optimise on them, stores them back and updates the iterations and status of the slot.
+ * @tparam Kernel Name of the kernel.
+ * @param name Name of the launch in errors and profiles.
+ * @param optimise Called by every work-item of the group as SlotOutcome optimise(const PersistentSlot<T, K> &) for each slot it claims.
+ * @return The launch, which holds the slot counter until it is done.
+ * @throws sycl::exception if a work-group of N work-items or its local memory does not fit on the device.
+ */
+template <typename Kernel, typename T, typename K, StoragePolicy S, typename Body>
+LaunchFuture optimise_persistent(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int max_iterations, Telemetry<T> &telemetry, const char *name, const std::vector<sycl::event> &dependencies, Body optimise)
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    auto device = Q.get_device();
+    size_t N = B.N(), capacity = B.capacity(), local_bytes = forcefield_local_bytes<T>(N);
+    check_launch(device, N, local_bytes, name);
+    // Resident groups per compute unit, bounded like in LaunchTuner by local memory and by twice the maximum group size of work-items.
+    size_t groups_per_unit = std::max<size_t>(1, std::min(device.get_info<sycl::info::device::local_mem_size>() / local_bytes, 2 * device.get_info<sycl::info::device::max_work_group_size>() / N));
+    size_t n_groups = std::min(capacity, device.get_info<sycl::info::device::max_compute_units>() * groups_per_unit);
+    auto next_slot = std::make_shared<sycl::buffer<uint32_t, 1>>(sycl::range<1>(1));
+    sycl::host_accessor(*next_slot, sycl::write_only, sycl::no_init)[0] = 0;
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        h.depends_on(dependencies);
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(N), h);
+        sycl::local_accessor<coord3d,1> X(N,h);
+        sycl::local_accessor<coord3d,1> X1(N,h);
+        sycl::local_accessor<coord3d,1> X2(N,h);
+        auto XP = make_local_arrays<coord3d>(N, h, std::make_index_sequence<LINE_SEARCH_POINTS>{});
+        sycl::accessor next_slot_acc(*next_slot, h, sycl::read_write);
+        auto X_acc = B.X.view(h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h);
+        auto iterations_acc = B.iterations.view(h);
+        auto IDs_acc = B.IDs.view(h, sycl::read_only);
+        sycl::accessor samples_acc(telemetry.samples, h, sycl::read_write);
+        sycl::accessor counts_acc(telemetry.counts, h, sycl::read_write);
+        uint32_t stride = telemetry.stride, depth = telemetry.depth;
+        h.parallel_for<Kernel>(sycl::nd_range(sycl::range{N*n_groups}, sycl::range{N}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device> next(next_slot_acc[0]);
+            while (true)
+            {
+                uint32_t slot = 0;
+                if (tid == 0) slot = next.fetch_add(1u);
+                slot = sycl::group_broadcast(cta, slot, 0);
+                if (slot >= capacity) break;
+                // The status is uniform across the work-group, so the whole group moves on together.
+                if (statuses_acc[slot] != IsomerStatus::NOT_CONVERGED) continue;
+
+                // The slot is not the group id, so the per-node data is built for an explicit isomer.
+                PersistentSlot<T,K> claimed{NodeNeighbours<K>(cubic_neighbours_acc, slot, N, tid), Constants<T,K>(cubic_neighbours_acc, slot, N, tid),
+                                            cta, nditem.get_sub_group(), sdata.get_pointer(), X, X1, X2, XP, iterations_acc[slot], TelemetryView<T>{}};
+                if (stride > 0) claimed.telemetry = TelemetryView<T>{&samples_acc[slot*depth], &counts_acc[slot], IDs_acc[slot], (uint32_t)claimed.done, stride, depth};
+                X[tid] = X_acc[slot*N + tid];
+                sycl::group_barrier(cta);
+                SlotOutcome outcome = optimise(claimed);
+                sycl::group_barrier(cta);
+                X_acc[slot*N + tid] = X[tid];
+                if (tid == 0)
+                {
+                    iterations_acc[slot] = claimed.done + outcome.iterations;
+                    if (outcome.converged) statuses_acc[slot] = IsomerStatus::CONVERGED;
+                    else if (iterations_acc[slot] >= (size_t)max_iterations) statuses_acc[slot] = IsomerStatus::FAILED;
+                }
+            }
+        }); });
+    profile(name, Q, event);
+    return {event, {next_slot}};
+}
+
+/**
+ * @brief forcefield_optimise with persistent work-groups: only as many work-groups as the device keeps resident are launched, and each pulls the next slot
+ *        from a global atomic counter whenever its current isomer converges or exhausts its budget. A few slow isomers then occupy a few work-groups,
+ *        instead of holding back the launch of a whole batch of one-shot groups behind them. Selected by PERSISTENT_OPTIMISE.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param iterations The number of CG iterations to run in this launch.
+ * @param max_iterations The total iteration budget per isomer, an isomer which exhausts it is marked FAILED.
+ * @param telemetry Convergence telemetry, one ring per slot of B.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch, which holds the slot counter until it is done.
+ * @throws sycl::exception if a work-group of N work-items or its local memory does not fit on the device.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_optimise_persistent(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, Telemetry<T> &telemetry, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    return optimise_persistent<optimise_persistent_kernel<FFT, T, K, S>>(Q, B, max_iterations, telemetry, "forcefield_optimise_persistent", dependencies, [=](const PersistentSlot<T, K> &slot)
+                                                                         {
+        ForceField<FFT,T,K> FF(slot.nodeG, slot.constants, slot.cta, slot.sg, slot.sdata);
+        size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(slot.done, (size_t)max_iterations));
+        size_t n_iterations = FF.CG(slot.X, slot.X1, slot.X2, slot.XP, budget, tolerance, slot.telemetry);
+        return SlotOutcome{n_iterations, n_iterations < budget}; });
+}
+
+//Iteration budgets and tolerances of the warm-up stages of forcefield_optimise_staged. Tolerances are on the gradient norm divided by N, like forcefield_optimise's.
+template <typename T>
+struct StagedSchedule
+{
+    int bond_iterations = 50;
+    T bond_tolerance = T(1e-1);
+    int angle_iterations = 100;
+    T angle_tolerance = T(1e-2);
+};
+
+/**
+ * @brief forcefield_optimise in stages of increasing cost, for poor starting geometries: an isomer that has not been optimised before (B.iterations is 0)
+ *        first runs CG on the bond terms alone, which are cheap and fix the gross geometry, then on bonds and angles, and only then on the full PEDERSEN forcefield.
+ *        All stages run in one launch of persistent work-groups, see forcefield_optimise_persistent. Isomers with iterations from earlier launches only run the last stage.
+ *        The warm-up iterations are added to B.iterations and count against max_iterations, but not against iterations.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param iterations The number of full forcefield CG iterations to run in this launch.
+ * @param max_iterations The total iteration budget per isomer, an isomer which exhausts it is marked FAILED.
+ * @param schedule Budgets and tolerances of the warm-up stages.
+ * @param telemetry Convergence telemetry of the last stage, one ring per slot of B.
+ * @param tolerance Convergence threshold of the last stage on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch, which holds the slot counter until it is done.
+ * @throws sycl::exception if a work-group of N work-items or its local memory does not fit on the device.
+ */
+template <typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_optimise_staged(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, const StagedSchedule<T> &schedule, Telemetry<T> &telemetry, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    StagedSchedule<T> stages = schedule;
+    return optimise_persistent<optimise_staged_kernel<T, K, S>>(Q, B, max_iterations, telemetry, "forcefield_optimise_staged", dependencies, [=](const PersistentSlot<T, K> &slot)
+                                                                {
+        size_t n_warmup = 0;
+        if (slot.done == 0)
+        {
+            // Each stage starts from the geometry the previous one left in X. Stages that do not converge within their budget simply hand over.
+            ForceField<BOND,T,K> bonds(slot.nodeG, slot.constants, slot.cta, slot.sg, slot.sdata);
+            n_warmup += bonds.CG(slot.X, slot.X1, slot.X2, slot.XP, stages.bond_iterations, stages.bond_tolerance);
+            ForceField<BOND_ANGLE,T,K> angles(slot.nodeG, slot.constants, slot.cta, slot.sg, slot.sdata);
+            n_warmup += angles.CG(slot.X, slot.X1, slot.X2, slot.XP, stages.angle_iterations, stages.angle_tolerance);
+        }
+        ForceField<PEDERSEN,T,K> FF(slot.nodeG, slot.constants, slot.cta, slot.sg, slot.sdata);
+        size_t done = slot.done + n_warmup;
+        size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(done, (size_t)max_iterations));
+        TelemetryView<T> telemetry = slot.telemetry;
+        telemetry.iteration_offset = (uint32_t)done;
+        size_t n_iterations = FF.CG(slot.X, slot.X1, slot.X2, slot.XP, budget, tolerance, telemetry);
+        return SlotOutcome{n_warmup + n_iterations, n_iterations < budget}; });
+}
+
+/**
+ * @brief Submits the optimisation of every NOT_CONVERGED isomer in the batch and returns without waiting, the other slots are left untouched.
+ *        The optimisation is restartable: every launch runs at most `iterations` CG iterations per isomer and adds them to B.iterations.
+ *        B and telemetry must outlive the launch. Buffer backed batches are ordered by the runtime, USM batches by the in-order queue or the dependencies.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param iterations The number of CG iterations to run in this launch.
+ * @param max_iterations The total iteration budget per isomer, an isomer which exhausts it is marked FAILED.
+ * @param telemetry Convergence telemetry, one ring per slot of B. Drain it before the slots are refilled.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch. Errors while it runs go to the asynchronous handler of Q.
+ * @throws sycl::exception if the launch does not fit on the device.
+ *        Isomers that do not fit a work-group of N work-items, or whose coordinates do not fit in local memory, are optimised by forcefield_optimise_strided.
+ *        With PERSISTENT_OPTIMISE the others are optimised by forcefield_optimise_persistent.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_optimise_async(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, Telemetry<T> &telemetry, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    if (!fits_launch(Q.get_device(), B.N(), forcefield_local_bytes<T>(B.N())))
+        return forcefield_optimise_strided<FFT>(Q, B, iterations, max_iterations, telemetry, tolerance, dependencies);
+#if PERSISTENT_OPTIMISE
+    return forcefield_optimise_persistent<FFT>(Q, B, iterations, max_iterations, telemetry, tolerance, dependencies);
+#else
+    check_launch(Q.get_device(), B.N(), forcefield_local_bytes<T>(B.N()), "forcefield_optimise");
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        h.depends_on(dependencies);
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(B.N()), h);
+        sycl::local_accessor<coord3d,1> X(B.N(),h);
+        sycl::local_accessor<coord3d,1> X1(B.N(),h);
+        sycl::local_accessor<coord3d,1> X2(B.N(),h);
+        auto XP = make_local_arrays<coord3d>(B.N(), h, std::make_index_sequence<LINE_SEARCH_POINTS>{});
+        auto X_acc = B.X.view(h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h);
+        auto iterations_acc = B.iterations.view(h);
+        auto IDs_acc = B.IDs.view(h, sycl::read_only);
+        sycl::accessor samples_acc(telemetry.samples, h, sycl::read_write);
+        sycl::accessor counts_acc(telemetry.counts, h, sycl::read_write);
+        uint32_t stride = telemetry.stride, depth = telemetry.depth;
+        auto N = B.N();
+        h.parallel_for<optimise_kernel<FFT, T, K, S>>(sycl::nd_range(sycl::range{B.N()*B.capacity()}, sycl::range{B.N()}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            // The status is uniform across the work-group, so the whole group leaves together.
+            if (statuses_acc[bid] != IsomerStatus::NOT_CONVERGED) return;
+
+//          Create an accessor to the neighbourlist offset by the block id.
+//
+            Constants<T,K> constants(cubic_neighbours_acc, cta);
+            NodeNeighbours<K> nodeG(cubic_neighbours_acc, cta);
+            
+            X[tid] = X_acc[bid*N + tid];
+            sycl::group_barrier(cta);
+            ForceField FF = ForceField<FFT,T,K>(nodeG, constants, cta, nditem.get_sub_group(), sdata.get_pointer());
+            size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(iterations_acc[bid], (size_t)max_iterations));
+            TelemetryView<T> telemetry_view;
+            if (stride > 0) telemetry_view = TelemetryView<T>{&samples_acc[bid*depth], &counts_acc[bid], IDs_acc[bid], (uint32_t)iterations_acc[bid], stride, depth};
+            size_t n_iterations = FF.CG(X, X1, X2, XP, budget, tolerance, telemetry_view);
+            sycl::group_barrier(cta);
+            //
+            X_acc[bid*N + tid] = X[tid];
+            if (tid == 0)
+            {
+                iterations_acc[bid] += n_iterations;
+                if (n_iterations < budget) statuses_acc[bid] = IsomerStatus::CONVERGED;
+                else if (iterations_acc[bid] >= (size_t)max_iterations) statuses_acc[bid] = IsomerStatus::FAILED;
+            }
+        }); });
+    profile("forcefield_optimise", Q, event);
+    return {event, {}};
+#endif
+}
+
+//forcefield_optimise_async without telemetry.
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_optimise_async(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, const T tolerance = T(1e-3), const std::vector<sycl::event> &dependencies = {})
+{
+    auto disabled = std::make_shared<Telemetry<T>>(B.capacity(), 0, 0);
+    LaunchFuture launch = forcefield_optimise_async<FFT>(Q, B, iterations, max_iterations, *disabled, tolerance, dependencies);
+    launch.keep_alive.push_back(disabled);
+    return launch;
+}
+
+/**
+ * @brief Optimises every NOT_CONVERGED isomer in the batch and waits for it, see forcefield_optimise_async.
+ * @throws sycl::exception if a work-group of N work-items or its local memory does not fit on the device, and the asynchronous errors of the launch.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+void forcefield_optimise(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, Telemetry<T> &telemetry, const T tolerance = T(1e-3))
+{
+    forcefield_optimise_async<FFT>(Q, B, iterations, max_iterations, telemetry, tolerance).wait();
+}
+
+//forcefield_optimise without telemetry.
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+void forcefield_optimise(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, const T tolerance = T(1e-3))
+{
+    forcefield_optimise_async<FFT>(Q, B, iterations, max_iterations, tolerance).wait();
+}
+
+/**
+ * @brief Submits Newton steps, see ForceField::Newton, on every NOT_CONVERGED isomer in the batch and returns without waiting, like forcefield_optimise_async does with CG.
+ *        Every launch runs at most `iterations` Newton steps per isomer and adds them to B.iterations.
+ *        Isomers that do not fit a work-group of N work-items are optimised by forcefield_optimise_async with CG instead, `iterations` then counts CG iterations.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param iterations The number of Newton steps to run in this launch.
+ * @param max_iterations The total budget of steps per isomer, an isomer which exhausts it is marked FAILED.
+ * @param inner_iterations The maximum number of inner CG iterations per Newton step.
+ * @param tolerance Convergence threshold on the gradient norm divided by N.
+ * @param dependencies Events the launch waits for.
+ * @return The launch. Errors while it runs go to the asynchronous handler of Q.
+ */
+template <ForcefieldType FFT, typename T = double, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+LaunchFuture forcefield_newton_async(sycl::queue &Q, IsomerBatch<T, K, S> &B, const int iterations, const int max_iterations, const int inner_iterations, const T tolerance, const std::vector<sycl::event> &dependencies = {})
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    if (!fits_launch(Q.get_device(), B.N(), forcefield_local_bytes<T>(B.N())))
+        return forcefield_optimise_async<FFT>(Q, B, iterations, max_iterations, tolerance, dependencies);
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        h.depends_on(dependencies);
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(B.N()), h);
+        sycl::local_accessor<coord3d,1> X(B.N(),h);
+        sycl::local_accessor<coord3d,1> X1(B.N(),h);
+        sycl::local_accessor<coord3d,1> X2(B.N(),h);
+        auto XP = make_local_arrays<coord3d>(B.N(), h, std::make_index_sequence<LINE_SEARCH_POINTS>{});
+        auto X_acc = B.X.view(h);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h);
+        auto iterations_acc = B.iterations.view(h);
+        auto N = B.N();
+        h.parallel_for<newton_kernel<FFT, T, K, S>>(sycl::nd_range(sycl::range{B.N()*B.capacity()}, sycl::range{B.N()}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            if (statuses_acc[bid] != IsomerStatus::NOT_CONVERGED) return;
+
+            Constants<T,K> constants(cubic_neighbours_acc, cta);
+            NodeNeighbours<K> nodeG(cubic_neighbours_acc, cta);
+            X[tid] = X_acc[bid*N + tid];
+            sycl::group_barrier(cta);
+            ForceField FF = ForceField<FFT,T,K>(nodeG, constants, cta, nditem.get_sub_group(), sdata.get_pointer());
+            size_t budget = sycl::min((size_t)iterations, (size_t)max_iterations - sycl::min(iterations_acc[bid], (size_t)max_iterations));
+            size_t n_iterations = FF.Newton(X, X1, X2, XP, budget, inner_iterations, tolerance);
+            sycl::group_barrier(cta);
+            X_acc[bid*N + tid] = X[tid];
+            if (tid == 0)
+            {
+                iterations_acc[bid] += n_iterations;
+                if (n_iterations < budget) statuses_acc[bid] = IsomerStatus::CONVERGED;
+                else if (iterations_acc[bid] >= (size_t)max_iterations) statuses_acc[bid] = IsomerStatus::FAILED;
+            }
+        }); });
+    profile("forcefield_newton", Q, event);
+    return {event, {}};
+}
+
+/**
+ * @brief Polishes a batch optimised in float with a short double precision Newton stage, which reaches double precision accuracy at a fraction of the cost of optimising in double throughout.
+ *        The float CG leaves the isomers close to their minimum, where Newton converges quadratically on the hessian blocks of the forcefield, see ForceField::Newton.
+ *        B is converted into P on the device, the isomers that converged in float are optimised again in double for at most `iterations` Newton steps.
+ *        Those that reach the tolerance stay CONVERGED, the others are marked FAILED. P.iterations holds the float iterations and the Newton steps together.
+ *        Returns without waiting, B and P must outlive the launch. Buffer backed batches are ordered by the runtime, USM batches by the in-order queue.
+ * @param Q The queue to submit the kernels to.
+ * @param B The batch optimised in float, left untouched.
+ * @param P Batch receiving the polished isomers, same N as B.
+ * @param iterations Newton steps per isomer.
+ * @param tolerance Convergence threshold of the double precision stage on the gradient norm divided by N.
+ * @param inner_iterations The maximum number of inner CG iterations per Newton step.
+ * @return The launch of the last kernel. Errors while the kernels run go to the asynchronous handler of Q.
+ */
+template <ForcefieldType FFT, typename K, StoragePolicy S>
+LaunchFuture polish(sycl::queue &Q, IsomerBatch<float, K, S> &B, IsomerBatch<double, K, S> &P, const int iterations, const double tolerance, const int inner_iterations = 50)
+{
+    convert(Q, B, P);
+    // The double stage counts its own iterations from 0 so that the budget applies to it alone, the float iterations are added back afterwards.
+    Q.submit([&](sycl::handler &h)
+             {
+        auto statuses_acc = P.statuses.view(h);
+        auto iterations_acc = P.iterations.view(h, sycl::write_only);
+        h.parallel_for<polish_begin<FFT, K, S>>(sycl::range{P.capacity()}, [=](sycl::item<1> item) {
+            auto i = item.get_linear_id();
+            iterations_acc[i] = 0;
+            if (statuses_acc[i] == IsomerStatus::CONVERGED) statuses_acc[i] = IsomerStatus::NOT_CONVERGED;
+        }); });
+    LaunchFuture newton = forcefield_newton_async<FFT>(Q, P, iterations, iterations, inner_iterations, tolerance);
+    sycl::event event = Q.submit([&](sycl::handler &h)
+             {
+        auto float_iterations_acc = B.iterations.view(h, sycl::read_only);
+        auto iterations_acc = P.iterations.view(h);
+        h.parallel_for<polish_end<FFT, K, S>>(sycl::range{P.capacity()}, [=](sycl::item<1> item) {
+            auto i = item.get_linear_id();
+            iterations_acc[i] += float_iterations_acc[i];
+        }); });
+    return {event, newton.keep_alive};
+}
+
+/**
+ * @brief Computes the forcefield energy of every non-empty isomer in the batch, EMPTY slots are left untouched.
+ * @param Q The queue to submit the kernel to.
+ * @param B The batch of isomers.
+ * @param energies Output buffer of at least B.capacity() elements.
+ *        Isomers that do not fit a work-group of N work-items are summed by strided work-groups, see forcefield_optimise_strided.
+ */
+template <ForcefieldType FFT, typename T = float, typename K = uint16_t, StoragePolicy S = StoragePolicy::BUFFER>
+void forcefield_energies(sycl::queue &Q, IsomerBatch<T, K, S> &B, sycl::buffer<T, 1> &energies)
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    if (!fits_launch(Q.get_device(), B.N(), forcefield_scratch_size<T>(B.N()) * sizeof(T) + B.N() * sizeof(coord3d)))
+    {
+        size_t N = B.N(), L = strided_group_size(Q.get_device(), N);
+        check_launch(Q.get_device(), L, forcefield_scratch_size<T>(L) * sizeof(T), "forcefield_energies");
+        auto event = Q.submit([&](sycl::handler &h)
+                 {
+            sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(L), h);
+            auto X_acc = B.X.view(h, sycl::read_only);
+            auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+            auto statuses_acc = B.statuses.view(h, sycl::read_only);
+            sycl::accessor energies_acc(energies, h, sycl::write_only);
+            h.parallel_for<energies_strided_kernel<FFT, T, K, S>>(sycl::nd_range(sycl::range{L*B.capacity()}, sycl::range{L}), [=](sycl::nd_item<1> nditem) {
+                auto cta = nditem.get_group();
+                auto tid = nditem.get_local_linear_id();
+                auto bid = nditem.get_group_linear_id();
+                if (statuses_acc[bid] == IsomerStatus::EMPTY) return;
+                const coord3d *X = &X_acc[bid*N];
+                StridedForceField<FFT,T,K> FF(nullptr, nullptr, N, cta, nditem.get_sub_group(), sdata.get_pointer());
+                // Every node is visited once, so its neighbours and constants are built in registers instead of global scratch.
+                T partial = 0;
+                for (size_t node = tid; node < N; node += L)
+                {
+                    NodeNeighbours<K> G(cubic_neighbours_acc, bid, N, node);
+                    Constants<T,K> C(cubic_neighbours_acc, bid, N, node);
+                    for (int j = 0; j < 3; j++) partial += typename ForceField<FFT,T,K>::ArcData((node_t)node, j, X, G).energy(C);
+                }
+                T energy = FF.reduce(std::array<T,1>{partial})[0];
+                if (tid == 0) energies_acc[bid] = energy;
+            }); });
+        profile("forcefield_energies_strided", Q, event);
+        return;
+    }
+    check_launch(Q.get_device(), B.N(), forcefield_scratch_size<T>(B.N()) * sizeof(T) + B.N() * sizeof(coord3d), "forcefield_energies");
+    auto event = Q.submit([&](sycl::handler &h)
+             {
+        sycl::local_accessor<T,1> sdata(forcefield_scratch_size<T>(B.N()), h);
+        sycl::local_accessor<coord3d,1> X(B.N(),h);
+        auto X_acc = B.X.view(h, sycl::read_only);
+        auto cubic_neighbours_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto statuses_acc = B.statuses.view(h, sycl::read_only);
+        sycl::accessor energies_acc(energies, h, sycl::write_only);
+        auto N = B.N();
+        h.parallel_for<energies_kernel<FFT, T, K, S>>(sycl::nd_range(sycl::range{B.N()*B.capacity()}, sycl::range{B.N()}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            auto tid = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            if (statuses_acc[bid] == IsomerStatus::EMPTY) return;
+            Constants<T,K> constants(cubic_neighbours_acc, cta);
+            NodeNeighbours<K> nodeG(cubic_neighbours_acc, cta);
+            X[tid] = X_acc[bid*N + tid];
+            ForceField FF = ForceField<FFT,T,K>(nodeG, constants, cta, nditem.get_sub_group(), sdata.get_pointer());
+            T energy = FF.energy(X);
+            if (tid == 0) energies_acc[bid] = energy;
+        }); });
+    profile("forcefield_energies", Q, event);
+}
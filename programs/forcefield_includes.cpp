@@ -5,9 +5,23 @@
 #define SEMINARIO_FORCE_CONSTANTS 0
 
 #include "coord3d.cpp"
-#include "isomer_batch.hh"
+#include "isomer_batch.cpp"
 #include "sym_mat3.cpp"
+#include "group_scan.cpp"
 #include "cubic_graph.cpp"
 #include "node_neighbours.cpp"
 #include "constants.cpp"
-#include "matrix3.cpp"
\ No newline at end of file
+#include "matrix3.cpp"
+#include "launch_config.cpp"
+#include "reductions.cpp"
+#include "stone_wales.cpp"
+#include "embedding.cpp"
+#include "batch_refill.cpp"
+#include "ragged_batch.cpp"
+#include "work_queue.cpp"
+#include "result_file.cpp"
+#include "staging_ring.cpp"
+#include "device_scheduler.cpp"
+#include "checkpoint.cpp"
+#include "telemetry.cpp"
+#include "precision.cpp"
\ No newline at end of file
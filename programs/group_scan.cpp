@@ -0,0 +1,122 @@
+#pragma once
+#include <cstddef>
+
+// Work-efficient (Blelloch) work-group scans that only use local memory and group barriers.
+// exclusive_scan_over_group() relies on sub-group shuffles, which do nothing on nvc++ (see SYCL_INFO_SHEET.md), these work on every backend.
+// Every scan takes a local memory scratch array of scan_scratch_size(group size) elements, must be called by the whole group,
+// and leaves the scratch free for reuse when it returns.
+
+//Number of scratch elements a scan over a group of group_size work-items needs: the next power of two.
+inline size_t scan_scratch_size(const size_t group_size)
+{
+    size_t n = 1;
+    while (n < group_size) n <<= 1;
+    return n;
+}
+
+/**
+ * @brief Exclusive scan over the work-group, work-item i receives op(val_0, ..., val_{i-1}) and work-item 0 receives identity.
+ * @param cta The work-group.
+ * @param val The value contributed by the calling work-item.
+ * @param sdata Local memory scratch of scan_scratch_size(group size) elements.
+ * @param op Associative operator, it need not be commutative.
+ * @param identity The identity of op.
+ * @return The exclusive prefix of the calling work-item.
+ */
+template <typename T, typename BinOp>
+T exclusive_scan(const sycl::group<1> &cta, const T val, T *sdata, BinOp op, const T identity)
+{
+    const size_t tid = cta.get_local_linear_id();
+    const size_t lrange = cta.get_local_linear_range();
+    const size_t n = scan_scratch_size(lrange);
+    for (size_t i = tid; i < n; i += lrange) sdata[i] = i == tid ? val : identity;
+    sycl::group_barrier(cta);
+
+    //Up-sweep: builds the reduction tree in place, the last element ends up holding the total.
+    for (size_t d = 1; d < n; d <<= 1)
+    {
+        for (size_t k = tid; k < n / (2 * d); k += lrange)
+        {
+            size_t i = (k + 1) * 2 * d - 1;
+            sdata[i] = op(sdata[i - d], sdata[i]);
+        }
+        sycl::group_barrier(cta);
+    }
+    if (tid == 0) sdata[n - 1] = identity;
+    sycl::group_barrier(cta);
+
+    //Down-sweep: every right child receives the prefix of its parent combined with the total of its left sibling.
+    for (size_t d = n / 2; d >= 1; d >>= 1)
+    {
+        for (size_t k = tid; k < n / (2 * d); k += lrange)
+        {
+            size_t i = (k + 1) * 2 * d - 1;
+            T left = sdata[i - d];
+            sdata[i - d] = sdata[i];
+            sdata[i] = op(sdata[i], left);
+        }
+        sycl::group_barrier(cta);
+    }
+    T result = sdata[tid];
+    sycl::group_barrier(cta);
+    return result;
+}
+
+/**
+ * @brief Inclusive scan over the work-group, work-item i receives op(val_0, ..., val_i).
+ * @param cta The work-group.
+ * @param val The value contributed by the calling work-item.
+ * @param sdata Local memory scratch of scan_scratch_size(group size) elements.
+ * @param op Associative operator, it need not be commutative.
+ * @param identity The identity of op.
+ * @return The inclusive prefix of the calling work-item.
+ */
+template <typename T, typename BinOp>
+T inclusive_scan(const sycl::group<1> &cta, const T val, T *sdata, BinOp op, const T identity)
+{
+    return op(exclusive_scan(cta, val, sdata, op, identity), val);
+}
+
+//Element of a segmented scan, head is non-zero for the first work-item of a segment. An int rather than a bool since nvc++ chokes on byte sized types.
+template <typename T>
+struct Segment
+{
+    T value;
+    int head;
+};
+
+/**
+ * @brief Segmented exclusive scan, the scan restarts at every work-item that is the head of a segment.
+ *        Implemented as a plain scan with the operator (a, b) -> b.head ? b : a op b, which is associative.
+ * @param cta The work-group.
+ * @param val The value contributed by the calling work-item.
+ * @param is_head True if the calling work-item starts a new segment, work-item 0 always does.
+ * @param sdata Local memory scratch of scan_scratch_size(group size) elements.
+ * @param op Associative operator, it need not be commutative.
+ * @param identity The identity of op.
+ * @return The exclusive prefix of the calling work-item within its segment, identity for the head of a segment.
+ */
+template <typename T, typename BinOp>
+T segmented_exclusive_scan(const sycl::group<1> &cta, const T val, const bool is_head, Segment<T> *sdata, BinOp op, const T identity)
+{
+    auto segment_op = [op](const Segment<T> &a, const Segment<T> &b) -> Segment<T>
+    { return b.head ? b : Segment<T>{op(a.value, b.value), a.head}; };
+    Segment<T> prefix = exclusive_scan(cta, Segment<T>{val, is_head}, sdata, segment_op, Segment<T>{identity, 0});
+    return is_head ? identity : prefix.value;
+}
+
+/**
+ * @brief Segmented inclusive scan, the scan restarts at every work-item that is the head of a segment.
+ * @param cta The work-group.
+ * @param val The value contributed by the calling work-item.
+ * @param is_head True if the calling work-item starts a new segment, work-item 0 always does.
+ * @param sdata Local memory scratch of scan_scratch_size(group size) elements.
+ * @param op Associative operator, it need not be commutative.
+ * @param identity The identity of op.
+ * @return The inclusive prefix of the calling work-item within its segment.
+ */
+template <typename T, typename BinOp>
+T segmented_inclusive_scan(const sycl::group<1> &cta, const T val, const bool is_head, Segment<T> *sdata, BinOp op, const T identity)
+{
+    return op(segmented_exclusive_scan(cta, val, is_head, sdata, op, identity), val);
+}
@@ -1,79 +1,166 @@
+#pragma once
 #include "isomer_batch.hh"
-#include <tuple>
 
-using std::get;
+template <typename T, typename K, StoragePolicy S>
+template <typename F, typename... Batches>
+void IsomerBatch<T, K, S>::for_each_member(const size_t n_atoms, F &&f, Batches &...b)
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    const size_t n_faces = n_atoms / 2 + 2;
+    f(n_atoms,         coord3d{},                            b.X...);
+    f(n_atoms,         coord2d{},                            b.xys...);
+    f(n_atoms * 3,     std::numeric_limits<K>::max(),        b.cubic_neighbours...);
+    f(n_faces * 6,     std::numeric_limits<K>::max(),        b.dual_neighbours...);
+    f(n_faces,         std::numeric_limits<K>::max(),        b.face_degrees...);
+    f((size_t)1,       std::numeric_limits<size_t>::max(),   b.IDs...);
+    f((size_t)1,       (size_t)0,                            b.iterations...);
+    f((size_t)1,       IsomerStatus::EMPTY,                  b.statuses...);
+}
+
+template <typename T, typename K, StoragePolicy S>
+size_t IsomerBatch<T, K, S>::bytes_per_isomer(const size_t n_atoms)
+{
+    size_t bytes = 0;
+    for_each_member(n_atoms, [&](size_t per_isomer, auto empty)
+                    { bytes += per_isomer * sizeof(empty); });
+    return bytes;
+}
 
-template<typename T, typename K>
-IsomerBatch<T,K>::IsomerBatch(size_t n_atoms, size_t n_isomers, sycl::queue& Q){
-    TEMPLATE_TYPEDEFS(T,K);
-    this->n_atoms          = n_atoms;
-    this->isomer_capacity  = n_isomers;
-    this->n_faces          = n_atoms/2 + 2;
-    this->ctx              = Q.get_context();
-    pointers =   {{"cubic_neighbours",(void**)&cubic_neighbours, sizeof(node_t)*n_atoms*3, true}, {"dual_neighbours", (void**)&dual_neighbours, sizeof(node_t) * (n_atoms/2 +2) * 6, true}, {"face_degrees", (void**)&face_degrees, sizeof(node_t)*(n_atoms/2 +2), true},{"X", (void**)&X, sizeof(real_t)*n_atoms*3, true}, {"xys", (void**)&xys, sizeof(real_t)*n_atoms*2, true}, {"statuses", (void**)&statuses, sizeof(IsomerStatus), false}, {"IDs", (void**)&IDs, sizeof(size_t), false}, {"iterations", (void**)&iterations, sizeof(size_t), false}};
-    if (!Q.is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-    //        std::cout << "Allocating " << isomer_capacity * get<2>(pointers[i]) << " bytes of device memory for " << get<0>(pointers[i]) << std::endl;
-            *get<1>(pointers[i]) = sycl::malloc_device(n_isomers * get<2>(pointers[i]), Q); 
-            Q.memset(*get<1>(pointers[i]),0,n_isomers*get<2>(pointers[i]));
-        }
-    } else if(Q.is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            //For asynchronous memory transfers host memory must be pinned.
-            *get<1>(pointers[i]) = sycl::malloc_host(n_isomers * get<2>(pointers[i]), Q); 
-            Q.memset(*get<1>(pointers[i]),0, n_isomers*get<2>(pointers[i]));
-        }
-    }
+template <typename T, typename K, StoragePolicy S>
+IsomerBatch<T, K, S>::IsomerBatch(size_t n_atoms, size_t n_isomers, sycl::queue &Q) : X(Q, n_isomers * n_atoms),
+                                                                                       xys(Q, n_isomers * n_atoms),
+                                                                                       cubic_neighbours(Q, n_isomers * n_atoms * 3),
+                                                                                       dual_neighbours(Q, n_isomers * (n_atoms / 2 + 2) * 6),
+                                                                                       face_degrees(Q, n_isomers * (n_atoms / 2 + 2)),
+                                                                                       IDs(Q, n_isomers),
+                                                                                       iterations(Q, n_isomers),
+                                                                                       statuses(Q, n_isomers),
+                                                                                       m_capacity(n_isomers),
+                                                                                       n_atoms(n_atoms),
+                                                                                       n_faces(n_atoms / 2 + 2)
+{
+    //USM has no dependency tracking, kernels on the batch are only ordered if the queue is.
+    assert(S == StoragePolicy::BUFFER || Q.is_in_order());
+    for_each_member(n_atoms, [&](size_t per_isomer, auto empty, auto &array)
+                    { array.fill(Q, empty, 0, n_isomers * per_isomer); }, *this);
     Q.wait_and_throw();
     allocated = true;
 }
 
-template<typename T, typename K>
-void IsomerBatch<T,K>::operator=(const IsomerBatch<T,K>& input){
-    //TODO: Implementation of copy assignment operator for IsomerBatch, not sure exactly how to do this in SYCL.
+template <typename T, typename K, StoragePolicy S>
+IsomerBatch<T, K, S>::IsomerBatch(IsomerBatch<T, K, S> &&other) noexcept : X(std::move(other.X)),
+                                                                           xys(std::move(other.xys)),
+                                                                           cubic_neighbours(std::move(other.cubic_neighbours)),
+                                                                           dual_neighbours(std::move(other.dual_neighbours)),
+                                                                           face_degrees(std::move(other.face_degrees)),
+                                                                           IDs(std::move(other.IDs)),
+                                                                           iterations(std::move(other.iterations)),
+                                                                           statuses(std::move(other.statuses)),
+                                                                           allocated(std::exchange(other.allocated, false)),
+                                                                           m_capacity(std::exchange(other.m_capacity, 0)),
+                                                                           m_size(std::exchange(other.m_size, 0)),
+                                                                           n_atoms(other.n_atoms),
+                                                                           n_faces(other.n_faces),
+                                                                           verbose(other.verbose) {}
+
+template <typename T, typename K, StoragePolicy S>
+IsomerBatch<T, K, S> &IsomerBatch<T, K, S>::operator=(IsomerBatch<T, K, S> &&other) noexcept
+{
+    if (this == &other) return *this;
+    for_each_member(n_atoms, [](size_t, auto, auto &dst, auto &src)
+                    { dst = std::move(src); }, *this, other);
+    allocated = std::exchange(other.allocated, false);
+    m_capacity = std::exchange(other.m_capacity, 0);
+    m_size = std::exchange(other.m_size, 0);
+    n_atoms = other.n_atoms;
+    n_faces = other.n_faces;
+    verbose = other.verbose;
+    return *this;
+}
+
+//Moves the contents into arrays of the given capacity, new slots are EMPTY.
+template <typename T, typename K, StoragePolicy S>
+void IsomerBatch<T, K, S>::reallocate(sycl::queue &Q, const size_t capacity)
+{
+    for_each_member(n_atoms, [&](size_t per_isomer, auto empty, auto &array)
+                    {
+        array.resize(Q, capacity * per_isomer);
+        if (capacity > m_capacity) array.fill(Q, empty, m_capacity * per_isomer, (capacity - m_capacity) * per_isomer); }, *this);
+    Q.wait_and_throw();
+    m_capacity = capacity;
+    m_size = std::min(m_size, capacity);
+}
+
+template <typename T, typename K, StoragePolicy S>
+void IsomerBatch<T, K, S>::reserve(sycl::queue &Q, const size_t capacity)
+{
+    if (capacity > m_capacity) reallocate(Q, capacity);
+}
 
+template <typename T, typename K, StoragePolicy S>
+void IsomerBatch<T, K, S>::resize(sycl::queue &Q, const size_t n, const LaunchPolicy policy)
+{
+    reserve(Q, n);
+    //Slots that fall outside the batch are reset to EMPTY.
+    if (n < m_size)
+        for_each_member(n_atoms, [&](size_t per_isomer, auto empty, auto &array)
+                        { array.fill(Q, empty, n * per_isomer, (m_size - n) * per_isomer); }, *this);
+    m_size = n;
+    if (policy == LaunchPolicy::SYNC) Q.wait_and_throw();
+}
 
-    /* TEMPLATE_TYPEDEFS(T,K);
-    pointers =   {{"cubic_neighbours",(void**)&cubic_neighbours, sizeof(node_t)*n_atoms*3, true}, {"dual_neighbours", (void**)&dual_neighbours, sizeof(node_t) * (n_atoms/2 +2) * 6, true}, {"face_degrees", (void**)&face_degrees, sizeof(node_t)*(n_atoms/2 +2), true},{"X", (void**)&X, sizeof(real_t)*n_atoms*3, true}, {"xys", (void**)&xys, sizeof(real_t)*n_atoms*2, true}, {"statuses", (void**)&statuses, sizeof(IsomerStatus), false}, {"IDs", (void**)&IDs, sizeof(size_t), false}, {"iterations", (void**)&iterations, sizeof(size_t), false}};
-    if (allocated == true){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            sycl::free(*get<1>(pointers[i]), ctx);
-        }
-        allocated = false;
-    }
-    //Construct a tempory batch: allocates the needed amount of memory.
-    this->Q_ptr           = input.Q_ptr;
-    this->isomer_capacity = input.isomer_capacity;
-    this->n_atoms = input.n_atoms;
-    this->n_faces = input.n_faces;
-    
-    
-    //Copy contents of old batch into newly allocated memory.
-    if (!Q_ptr->is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            *get<1>(pointers[i]) = sycl::malloc_device(isomer_capacity * get<2>(pointers[i]), *Q_ptr);
-            //cudaMalloc(get<1>(pointers[i]), isomer_capacity * get<2>(pointers[i]));
-            Q_ptr -> memcpy(*get<1>(pointers[i]), *get<1>(input.pointers[i]), isomer_capacity * get<2>(pointers[i]));
-            //cudaMemcpy(*get<1>(pointers[i]), *get<1>(input.pointers[i]), isomer_capacity * get<2>(pointers[i]), cudaMemcpyDeviceToDevice);
-        }
-    } else if(Q_ptr->is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            *get<1>(pointers[i]) = sycl::malloc_host(isomer_capacity * get<2>(pointers[i]), *Q_ptr);
-            //cudaMallocHost(get<1>(pointers[i]), isomer_capacity * get<2>(pointers[i]));
-            Q_ptr -> memcpy(*get<1>(pointers[i]), *get<1>(input.pointers[i]), isomer_capacity * get<2>(pointers[i]));
-	    //TODO: Isn't this a bug? Nothing is being copied!
-        }
-    }
-    printLastCudaError("Failed to copy IsomerBatch"); */
+template <typename T, typename K, StoragePolicy S>
+void IsomerBatch<T, K, S>::shrink_to_fit(sycl::queue &Q)
+{
+    if (m_size < m_capacity) reallocate(Q, m_size);
 }
 
-template<typename T, typename K>
-IsomerBatch<T,K>::~IsomerBatch(){
-    //if (allocated == true);
-    //{
-    //    for (size_t i = 0; i < pointers.size(); i++) {
-    //        sycl::free(*get<1>(pointers[i]), ctx);
-    //    }
-    //}
-    //allocated = false;
-}
\ No newline at end of file
+template <typename T, typename K, StoragePolicy S>
+void IsomerBatch<T, K, S>::clear(sycl::queue &Q, const LaunchPolicy policy)
+{
+    for_each_member(n_atoms, [&](size_t per_isomer, auto empty, auto &array)
+                    { array.fill(Q, empty, 0, m_capacity * per_isomer); }, *this);
+    m_size = 0;
+    if (policy == LaunchPolicy::SYNC) Q.wait_and_throw();
+}
+
+template <typename T, typename K, StoragePolicy S>
+std::vector<size_t> IsomerBatch<T, K, S>::find_ids(const IsomerStatus status)
+{
+    std::vector<IsomerStatus> h_statuses(m_capacity);
+    std::vector<size_t> h_IDs(m_capacity);
+    copy(h_statuses.data(), statuses);
+    copy(h_IDs.data(), IDs);
+    std::vector<size_t> result;
+    for (size_t i = 0; i < m_capacity; i++) if (h_statuses[i] == status) result.push_back(h_IDs[i]);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+template <typename T, typename K, StoragePolicy S>
+bool IsomerBatch<T, K, S>::operator==(IsomerBatch<T, K, S> &b)
+{
+    if (n_atoms != b.n_atoms || m_capacity != b.m_capacity || m_size != b.m_size) return false;
+    bool equal = true;
+    for_each_member(n_atoms, [&](size_t per_isomer, auto empty, auto &lhs, auto &rhs)
+                    {
+        std::vector<decltype(empty)> h_lhs(m_capacity * per_isomer), h_rhs(m_capacity * per_isomer);
+        copy(h_lhs.data(), lhs);
+        copy(h_rhs.data(), rhs);
+        equal = equal && std::memcmp(h_lhs.data(), h_rhs.data(), h_lhs.size() * sizeof(decltype(empty))) == 0; }, *this, b);
+    return equal;
+}
+
+//Device to device copy of src into dst, dst is only reallocated if it cannot hold src.
+template <typename T, typename K, StoragePolicy S>
+void copy(sycl::queue &Q, IsomerBatch<T, K, S> &dst, IsomerBatch<T, K, S> &src, const LaunchPolicy policy = LaunchPolicy::SYNC)
+{
+    if (dst.n_atoms != src.n_atoms || !dst.allocated) dst = IsomerBatch<T, K, S>(src.n_atoms, src.m_capacity, Q);
+    dst.reserve(Q, src.m_capacity);
+    IsomerBatch<T, K, S>::for_each_member(src.n_atoms, [&](size_t per_isomer, auto empty, auto &to, auto &from)
+                                          {
+        to.copy_from(Q, from, src.m_capacity * per_isomer);
+        to.fill(Q, empty, src.m_capacity * per_isomer, (dst.m_capacity - src.m_capacity) * per_isomer); }, dst, src);
+    dst.m_size = src.m_size;
+    if (policy == LaunchPolicy::SYNC) Q.wait_and_throw();
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <CL/sycl.hpp>
 #include <iostream>
 #include "numeric"
@@ -5,6 +6,13 @@
 #include <tuple>
 #include <iterator>
 #include <type_traits>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include "profiler.cpp"
+#include "usm_pool.cpp"
 using namespace cl::sycl;
 
 #define UINT_TYPE uint16_t
@@ -16,6 +24,14 @@ enum class IsomerStatus
     FAILED,
     NOT_CONVERGED
 };
+enum BatchMember {COORDS3D, COORDS2D, CUBIC_NEIGHBOURS, DUAL_NEIGHBOURS, FACE_DEGREES, IDS, ITERATIONS, STATUSES};
+enum SortOrder {ASCENDING, DESCENDING};
+enum class LaunchPolicy {SYNC, ASYNC};
+enum Device   {CPU, GPU};
+
+// Where the batch lives. BUFFER lets the runtime track dependencies through the accessors each kernel creates,
+// the USM policies have no dependency tracking and are ordered by the queue the batch was created on, which must be in-order.
+enum class StoragePolicy {BUFFER, USM_DEVICE, USM_SHARED, USM_HOST};
 
 template <typename T>
 sycl::exception copy(sycl::buffer<T, 1> &dst, sycl::buffer<T, 1> &src)
@@ -91,90 +107,265 @@ copy(sycl::buffer<T, 1> &dst, Iterator src)
     return sycl::exception(std::error_code());
 }
 
-template <typename T, typename K>
+//Kernel side view of a USM array, indexes like an accessor.
+template <typename U>
+struct UsmView
+{
+    using value_type = U;
+    U *ptr;
+    inline U &operator[](const size_t i) const { return ptr[i]; }
+    U *get_pointer() const { return ptr; }
+};
+
+/**
+ * @brief One member array of an IsomerBatch, stored according to the storage policy S.
+ *        Kernels obtain a uniform view through view(h, ...), which is an accessor for BUFFER storage and a UsmView otherwise,
+ *        the access mode and property arguments are forwarded to the accessor and ignored for USM.
+ *        The primary template covers the USM policies, the array owns its allocation and remembers the queue it was made on.
+ */
+template <typename U, StoragePolicy S>
+struct BatchArray
+{
+    BatchArray(sycl::queue &Q, const size_t n) : Q(Q), n(n), ptr(allocate(Q, n)) {}
+    BatchArray(const BatchArray &) = delete;
+    BatchArray &operator=(const BatchArray &) = delete;
+    BatchArray(BatchArray &&other) noexcept : Q(other.Q), n(std::exchange(other.n, 0)), ptr(std::exchange(other.ptr, nullptr)), last_transfer(other.last_transfer) {}
+    BatchArray &operator=(BatchArray &&other) noexcept
+    {
+        std::swap(Q, other.Q);
+        std::swap(n, other.n);
+        std::swap(ptr, other.ptr);
+        std::swap(last_transfer, other.last_transfer);
+        return *this;
+    }
+    //Kernels may still use the memory when the array goes out of scope, it only returns to the pool once they are done.
+    ~BatchArray()
+    {
+        if (ptr) wait_for_uses();
+        pool_free(ptr, Q);
+    }
+
+    size_t size() const { return n; }
+
+    template <typename... Props>
+    UsmView<U> view(sycl::handler &, Props...) const { return {ptr}; }
+
+    //Reallocates to n elements keeping the first min(n, size()) of them, the queue is drained before the old memory is released.
+    void resize(sycl::queue &Q, const size_t n)
+    {
+        U *old = std::exchange(ptr, allocate(Q, n));
+        if (std::min(n, this->n) > 0) profile("BatchArray::resize", Q, Q.memcpy(ptr, old, std::min(n, this->n) * sizeof(U)));
+        Q.wait_and_throw();
+        wait_for_uses();
+        pool_free(old, this->Q);
+        this->Q = Q;
+        this->n = n;
+    }
+    void fill(sycl::queue &Q, const U &value, const size_t offset, const size_t count) { if (count > 0) profile("BatchArray::fill", Q, track(Q, Q.fill(ptr + offset, value, count))); }
+    void copy_from(sycl::queue &Q, const BatchArray &src, const size_t count) { if (count > 0) profile("BatchArray::copy_from", Q, track(Q, Q.memcpy(ptr, src.ptr, count * sizeof(U)))); }
+    void to_host(U *dst)
+    {
+        auto event = Q.memcpy(dst, ptr, n * sizeof(U));
+        profile("BatchArray::to_host", Q, event);
+        event.wait();
+    }
+    void from_host(const U *src)
+    {
+        auto event = Q.memcpy(ptr, src, n * sizeof(U));
+        profile("BatchArray::from_host", Q, event);
+        event.wait();
+    }
+    //Asynchronous copies from and to pinned host memory, which must stay valid until the returned event completes.
+    sycl::event upload(sycl::queue &Q, const U *src, const size_t offset, const size_t count)
+    {
+        if (count == 0) return {};
+        auto event = track(Q, Q.memcpy(ptr + offset, src, count * sizeof(U)));
+        profile("BatchArray::upload", Q, event);
+        return event;
+    }
+    sycl::event download(sycl::queue &Q, U *dst, const size_t count)
+    {
+        if (count == 0) return {};
+        auto event = track(Q, Q.memcpy(dst, ptr, count * sizeof(U)));
+        profile("BatchArray::download", Q, event);
+        return event;
+    }
+
+  private:
+    sycl::queue Q;
+    size_t n = 0;
+    U *ptr = nullptr;
+    sycl::event last_transfer; // The last command on a queue other than Q, such as the in-order copy queue of the DeviceScheduler
+
+    sycl::event track(const sycl::queue &Q, const sycl::event &event)
+    {
+        if (Q != this->Q) last_transfer = event;
+        return event;
+    }
+    //Waits for everything on the owning queue, kernels included, and for the last transfer on another queue.
+    void wait_for_uses()
+    {
+        Q.wait();
+        last_transfer.wait();
+    }
+
+    //Allocations come from the UsmPool of the queue's device, so batches that are created and destroyed repeatedly reuse their memory.
+    static U *allocate(sycl::queue &Q, const size_t n)
+    {
+        if constexpr (S == StoragePolicy::USM_DEVICE) return pool_malloc<U>(n, Q, sycl::usm::alloc::device);
+        else if constexpr (S == StoragePolicy::USM_SHARED) return pool_malloc<U>(n, Q, sycl::usm::alloc::shared);
+        else return pool_malloc<U>(n, Q, sycl::usm::alloc::host);
+    }
+};
+
+template <typename U>
+struct BatchArray<U, StoragePolicy::BUFFER>
+{
+    sycl::buffer<U, 1> data;
+
+    BatchArray(sycl::queue &, const size_t n) : data(range<1>(n)) {}
+
+    size_t size() const { return data.size(); }
+
+    template <typename... Props>
+    auto view(sycl::handler &h, Props... props) { return sycl::accessor(data, h, props...); }
+
+    //Replaces the buffer with one of n elements, the first min(n, size()) elements are copied over on the device.
+    void resize(sycl::queue &Q, const size_t n)
+    {
+        sycl::buffer<U, 1> old = data;
+        data = sycl::buffer<U, 1>(range<1>(n));
+        size_t n_copy = std::min(n, old.size());
+        if (n_copy > 0) profile("BatchArray::resize", Q, Q.submit([&](sycl::handler &h)
+                                 {
+            sycl::accessor src(old, h, range<1>(n_copy), sycl::read_only);
+            sycl::accessor dst(data, h, range<1>(n_copy), sycl::write_only, sycl::no_init);
+            h.copy(src, dst); }));
+    }
+    void fill(sycl::queue &Q, const U &value, const size_t offset, const size_t count)
+    {
+        if (count > 0) profile("BatchArray::fill", Q, Q.submit([&](sycl::handler &h)
+                                {
+            sycl::accessor acc(data, h, range<1>(count), id<1>(offset), sycl::write_only);
+            h.fill(acc, value); }));
+    }
+    void copy_from(sycl::queue &Q, BatchArray &src, const size_t count)
+    {
+        if (count > 0) profile("BatchArray::copy_from", Q, Q.submit([&](sycl::handler &h)
+                                {
+            sycl::accessor src_acc(src.data, h, range<1>(count), sycl::read_only);
+            sycl::accessor dst_acc(data, h, range<1>(count), sycl::write_only);
+            h.copy(src_acc, dst_acc); }));
+    }
+    //Host accessors are not commands on a queue, they show up as host phases.
+    void to_host(U *dst)
+    {
+        ProfilePhase phase("BatchArray::to_host");
+        sycl::host_accessor acc(data, sycl::read_only);
+        for (size_t i = 0; i < data.size(); i++) dst[i] = acc[i];
+    }
+    void from_host(const U *src)
+    {
+        ProfilePhase phase("BatchArray::from_host");
+        sycl::host_accessor acc(data, sycl::write_only, sycl::no_init);
+        for (size_t i = 0; i < data.size(); i++) acc[i] = src[i];
+    }
+    //Asynchronous copies from and to pinned host memory, which must stay valid until the returned event completes.
+    sycl::event upload(sycl::queue &Q, const U *src, const size_t offset, const size_t count)
+    {
+        if (count == 0) return {};
+        auto event = Q.submit([&](sycl::handler &h)
+                              {
+            sycl::accessor acc(data, h, range<1>(count), id<1>(offset), sycl::write_only);
+            h.copy(src, acc); });
+        profile("BatchArray::upload", Q, event);
+        return event;
+    }
+    sycl::event download(sycl::queue &Q, U *dst, const size_t count)
+    {
+        if (count == 0) return {};
+        auto event = Q.submit([&](sycl::handler &h)
+                              {
+            sycl::accessor acc(data, h, range<1>(count), sycl::read_only);
+            h.copy(acc, dst); });
+        profile("BatchArray::download", Q, event);
+        return event;
+    }
+};
+
+template <typename U, StoragePolicy S>
+sycl::exception copy(BatchArray<U, S> &dst, const U *src)
+{
+    try { dst.from_host(src); }
+    catch (sycl::exception e) { return e; }
+    return sycl::exception(std::error_code());
+}
+
+template <typename U, StoragePolicy S>
+sycl::exception copy(U *dst, BatchArray<U, S> &src)
+{
+    try { src.to_host(dst); }
+    catch (sycl::exception e) { return e; }
+    return sycl::exception(std::error_code());
+}
+
+/**
+ * @brief A batch of isomers of the same size, stored according to the storage policy S.
+ *        Empty slots hold the sentinel values: zero geometry, K max for graph data, size_t max for IDs and IsomerStatus::EMPTY.
+ *        The batch owns its memory, it can be moved but copies go through copy(Q, dst, src) so that they are ordered on a queue.
+ */
+template <typename T, typename K, StoragePolicy S = StoragePolicy::BUFFER>
 struct IsomerBatch
 {
     TEMPLATE_TYPEDEFS(T, K);
-    private:
-      size_t m_capacity = 0;
-      size_t m_size = 0;
-      size_t n_atoms = 0;
-      size_t n_faces = 0;
-    public:
-      buffer<coord3d, 1> X;
-      buffer<coord2d, 1> xys;
-      buffer<K, 1> cubic_neighbours;
-      buffer<K, 1> dual_neighbours;
-      buffer<K, 1> face_degrees;
-      buffer<size_t, 1> IDs;
-      buffer<size_t, 1> iterations;
-      buffer<IsomerStatus, 1> statuses;
-
-      bool allocated = false;
-
-      // std::vector<std::tuple<void**,size_t,bool>> pointers;
-
-      IsomerBatch(size_t n_atoms, size_t n_isomers) : n_atoms(n_atoms), m_capacity(n_isomers),
-                                                      n_faces(n_atoms / 2 + 2),
-                                                      X                 (range<1>(n_isomers * n_atoms)), 
-                                                      xys               (range<1>(n_isomers * n_atoms)), 
-                                                      cubic_neighbours  (range<1>(n_isomers * n_atoms * 3)), 
-                                                      dual_neighbours   (range<1>(6 * n_isomers * (n_atoms / 2 + 2))), 
-                                                      face_degrees      (range<1>((n_atoms / 2 + 2) * 1)), 
-                                                      IDs               (range<1>(n_isomers)), 
-                                                      iterations        (range<1>(n_isomers)), 
-                                                      statuses          (range<1>(n_isomers))
-      {   
-          X                 = buffer<coord3d, 1>( range<1>(n_isomers * n_atoms));
-          xys               = buffer<coord2d, 1>( range<1>(n_isomers * n_atoms));
-          cubic_neighbours  = buffer<K, 1>( range<1>(n_isomers * n_atoms * 3));
-          dual_neighbours   = buffer<K, 1>( range<1>(6 * n_isomers * n_faces));
-          face_degrees      = buffer<K, 1>( range<1>(n_isomers * n_faces));
-          IDs               = buffer<size_t, 1>( range<1>(n_isomers));
-          iterations        = buffer<size_t, 1>( range<1>(n_isomers));
-          statuses          = buffer<IsomerStatus, 1>( range<1>(n_isomers));
-          
-          host_accessor X_acc(X, no_init);
-          host_accessor xys_acc(xys, no_init);
-          host_accessor cubic_neighbours_acc(cubic_neighbours, no_init);
-          host_accessor dual_neighbours_acc(dual_neighbours, no_init);
-          host_accessor face_degrees_acc(face_degrees, no_init);
-          host_accessor IDs_acc(IDs, no_init);
-          host_accessor iterations_acc(iterations, no_init);
-          host_accessor statuses_acc(statuses, no_init);
-
-          
-
-
-          for (size_t i = 0; i < n_isomers; i++)
-          {
-              for (size_t j = 0; j < n_atoms; j++)
-              {
-                    X_acc[i * n_atoms + j] = coord3d{0.0, 0.0, 0.0};
-                    xys_acc[i * n_atoms + j] = coord2d{0.0, 0.0};
-                  cubic_neighbours_acc[i * n_atoms * 3 + j * 3 + 0] = std::numeric_limits<K>::max();
-                  cubic_neighbours_acc[i * n_atoms * 3 + j * 3 + 1] = std::numeric_limits<K>::max();
-                  cubic_neighbours_acc[i * n_atoms * 3 + j * 3 + 2] = std::numeric_limits<K>::max();
-              }
-              for (size_t j = 0; j < 6 * n_faces; j++)
-              {
-                  dual_neighbours_acc[i * 6 * n_faces + j] = std::numeric_limits<K>::max();
-              }
-              for (size_t j = 0; j < n_faces; j++)
-              {
-                  face_degrees_acc[i * n_faces + j] = std::numeric_limits<K>::max();
-              }
-              IDs_acc[i] = std::numeric_limits<size_t>::max();
-              iterations_acc[i] = 0;
-              statuses_acc[i] = IsomerStatus::EMPTY;
-          }
-      }
-
-      size_t size() const {return m_size;}
-      size_t capacity() const {return m_capacity;}
-      size_t N() const {return n_atoms;}
-      size_t Nf() const {return n_faces;}
+    static constexpr StoragePolicy storage = S;
 
+    BatchArray<coord3d, S> X;
+    BatchArray<coord2d, S> xys;
+    BatchArray<K, S> cubic_neighbours;
+    BatchArray<K, S> dual_neighbours;
+    BatchArray<K, S> face_degrees;
+    BatchArray<size_t, S> IDs;
+    BatchArray<size_t, S> iterations;
+    BatchArray<IsomerStatus, S> statuses;
 
-};
+    bool allocated = false;
+
+    IsomerBatch(size_t n_atoms, size_t n_isomers, sycl::queue &Q);
+    IsomerBatch(const IsomerBatch &) = delete;
+    IsomerBatch &operator=(const IsomerBatch &) = delete;
+    IsomerBatch(IsomerBatch &&other) noexcept;
+    IsomerBatch &operator=(IsomerBatch &&other) noexcept;
+
+    void set_print_simple() {verbose = false;}
+    void set_print_verbose() {verbose = true;}
+    bool get_print_mode() const {return verbose;}
+    size_t size() const {return m_size;}
+    size_t capacity() const {return m_capacity;}
+    size_t N() const {return n_atoms;}
+    size_t Nf() const {return n_faces;}
+    static size_t bytes_per_isomer(const size_t n_atoms); //Memory footprint of one slot
 
+    std::vector<size_t> find_ids(const IsomerStatus status); //Returns a vector of IDs with a given status
+    void resize(sycl::queue &Q, const size_t n, const LaunchPolicy = LaunchPolicy::SYNC); //Sets the size, only reallocates if n exceeds the capacity
+    void reserve(sycl::queue &Q, const size_t capacity);                                  //Grows the capacity, keeping the contents
+    void shrink_to_fit(sycl::queue &Q);                                                   //Reallocates so that capacity == size
+    void clear(sycl::queue &Q, const LaunchPolicy = LaunchPolicy::SYNC);                  //Resets every slot to EMPTY and the size to 0
+    bool operator==(IsomerBatch &b); //Returns true if the two batches are equal
+    bool operator!=(IsomerBatch &b) {return !(*this == b);}
+
+  private:
+    size_t m_capacity = 0;
+    size_t m_size = 0;
+    size_t n_atoms = 0;
+    size_t n_faces = 0;
+    bool verbose = false;
+
+    //Calls f(elements per isomer, empty value, arrays...) for every member, taking the same member from each of the batches.
+    template <typename F, typename... Batches>
+    static void for_each_member(const size_t n_atoms, F &&f, Batches &...b);
+    void reallocate(sycl::queue &Q, const size_t capacity);
+
+    template <typename U, typename V, StoragePolicy P>
+    friend void copy(sycl::queue &Q, IsomerBatch<U, V, P> &dst, IsomerBatch<U, V, P> &src, const LaunchPolicy policy);
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+//Launch parameters for a kernel that works on whole isomers.
+struct LaunchConfig
+{
+    size_t group_size = 0;          //Work-items per work-group
+    size_t isomers_per_group = 1;   //Isomers handled by one work-group
+    size_t capacity = 0;            //Isomers per batch
+};
+
+/**
+ * @brief Checks a launch against the limits of the device. Some backends fail silently on an oversized work-group (see SYCL_INFO_SHEET.md), so this throws before the kernel is submitted.
+ * @param device The device the kernel will run on.
+ * @param group_size Work-items per work-group.
+ * @param local_bytes Local memory used by one work-group.
+ * @param kernel Name of the kernel, used in the error message.
+ * @throws sycl::exception with errc::nd_range if the work-group is too large, or errc::memory_allocation if the local memory does not fit.
+ */
+inline void check_launch(const sycl::device &device, const size_t group_size, const size_t local_bytes, const std::string &kernel)
+{
+    size_t max_group_size = device.get_info<sycl::info::device::max_work_group_size>();
+    size_t max_local_bytes = device.get_info<sycl::info::device::local_mem_size>();
+    if (group_size > max_group_size)
+        throw sycl::exception(sycl::make_error_code(sycl::errc::nd_range), kernel + ": work-group size " + std::to_string(group_size) + " exceeds the device maximum of " + std::to_string(max_group_size));
+    if (local_bytes > max_local_bytes)
+        throw sycl::exception(sycl::make_error_code(sycl::errc::memory_allocation), kernel + ": " + std::to_string(local_bytes) + " bytes of local memory exceeds the device maximum of " + std::to_string(max_local_bytes));
+}
+
+//True if a work-group of group_size work-items using local_bytes of local memory can be launched on the device, check_launch without the exception.
+inline bool fits_launch(const sycl::device &device, const size_t group_size, const size_t local_bytes)
+{
+    return group_size <= device.get_info<sycl::info::device::max_work_group_size>() && local_bytes <= device.get_info<sycl::info::device::local_mem_size>();
+}
+
+/**
+ * @brief Picks the work-group size and batch capacity from the device limits, and caches the decisions per device, kernel, N and memory footprint in a small text file.
+ *        Each cache line holds: device name <tab> kernel <tab> N <tab> local bytes per isomer <tab> global bytes per isomer <tab> group_size isomers_per_group capacity.
+ *        Delete the file, or a line of it, to retune.
+ */
+struct LaunchTuner
+{
+    explicit LaunchTuner(const std::string &cache_path = "launch_config.cache") : cache_path(cache_path)
+    {
+        std::ifstream file(cache_path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            //Lines without the five key fields, e.g. written before the memory footprint was part of the key, are retuned.
+            size_t split = line.rfind('\t');
+            if (split == std::string::npos || std::count(line.begin(), line.begin() + split, '\t') != 4) continue;
+            LaunchConfig config;
+            std::istringstream(line.substr(split + 1)) >> config.group_size >> config.isomers_per_group >> config.capacity;
+            cache[line.substr(0, split)] = config;
+        }
+    }
+
+    /**
+     * @brief Returns the cached launch configuration for the kernel, or tunes one from the device limits and stores it.
+     * @param device The device the kernel will run on.
+     * @param kernel Name of the kernel.
+     * @param N Number of atoms per isomer, one work-item is used per atom.
+     * @param local_bytes_per_isomer Local memory the kernel uses per isomer.
+     * @param global_bytes_per_isomer Device memory needed per isomer, summed over every batch the program keeps alive.
+     * @param max_isomers_per_group Isomers a single work-group can handle, 1 for kernels that identify the isomer by the group id.
+     * @throws sycl::exception if a single isomer does not fit in a work-group.
+     */
+    LaunchConfig tune(const sycl::device &device, const std::string &kernel, const size_t N, const size_t local_bytes_per_isomer, const size_t global_bytes_per_isomer, const size_t max_isomers_per_group = 1)
+    {
+        //The capacity follows from the memory footprint, so a kernel that starts using more memory, or a program that keeps more batches alive, is retuned.
+        std::string key = device.get_info<sycl::info::device::name>() + '\t' + kernel + '\t' + std::to_string(N) + '\t' + std::to_string(local_bytes_per_isomer) + '\t' + std::to_string(global_bytes_per_isomer);
+        if (cache.count(key)) return cache[key];
+
+        check_launch(device, N, local_bytes_per_isomer, kernel);
+        size_t max_group_size = device.get_info<sycl::info::device::max_work_group_size>();
+        size_t local_bytes = device.get_info<sycl::info::device::local_mem_size>();
+        size_t compute_units = device.get_info<sycl::info::device::max_compute_units>();
+        size_t global_bytes = device.get_info<sycl::info::device::global_mem_size>();
+        size_t max_alloc_bytes = device.get_info<sycl::info::device::max_mem_alloc_size>();
+
+        LaunchConfig config;
+        config.isomers_per_group = std::max<size_t>(1, std::min({max_isomers_per_group, max_group_size / N, local_bytes / std::max<size_t>(1, local_bytes_per_isomer)}));
+        config.group_size = N * config.isomers_per_group;
+
+        //Resident groups per compute unit are bounded by local memory, and by twice the maximum group size of work-items which is what current GPUs keep in flight.
+        size_t local_bytes_per_group = std::max<size_t>(1, local_bytes_per_isomer * config.isomers_per_group);
+        size_t groups_per_unit = std::max<size_t>(1, std::min(local_bytes / local_bytes_per_group, 2 * max_group_size / config.group_size));
+        config.capacity = compute_units * groups_per_unit * config.isomers_per_group;
+
+        //Leave half of the device memory to the runtime, and keep every allocation under the device limit.
+        size_t memory_capacity = std::min(global_bytes / 2, max_alloc_bytes) / std::max<size_t>(1, global_bytes_per_isomer);
+        config.capacity = std::max<size_t>(1, std::min(config.capacity, memory_capacity));
+
+        cache[key] = config;
+        std::ofstream(cache_path, std::ios::app) << key << '\t' << config.group_size << ' ' << config.isomers_per_group << ' ' << config.capacity << '\n';
+        return config;
+    }
+
+  private:
+    std::string cache_path;
+    std::map<std::string, LaunchConfig> cache;
+};
+
+/**
+ * @brief Handle to a kernel launch that has been submitted but not waited for.
+ *        Scratch the launch allocated is held in keep_alive and released with the last copy of the future, a sycl::buffer among it blocks in its destructor until the kernel is done.
+ *        Errors raised while the kernel runs reach the asynchronous handler of the queue, see DeviceScheduler.
+ */
+struct LaunchFuture
+{
+    sycl::event event;
+    std::vector<std::shared_ptr<void>> keep_alive;
+
+    //Blocks until the launch is done, and hands its asynchronous errors to the queue's handler.
+    void wait() { event.wait_and_throw(); }
+
+    bool ready() const { return event.get_info<sycl::info::event::command_execution_status>() == sycl::info::event_command_status::complete; }
+
+    operator sycl::event() const { return event; }
+};
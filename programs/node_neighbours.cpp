@@ -17,7 +17,8 @@ struct NodeNeighbours{
      * @param  sdata: Pointer to shared memory.
      * @return NodeNeighbours object.
      */
-    NodeNeighbours(cl::sycl::group<1> cta, const sycl::accessor<K, 1, access::mode::read>& cubic_neighbours_acc, K* sdata){
+    template <typename View>
+    NodeNeighbours(cl::sycl::group<1> cta, const View& cubic_neighbours_acc, K* sdata){
         INT_TYPEDEFS(K);
         face_nodes.fill(UINT16_MAX);
         face_neighbours.fill(UINT16_MAX);
@@ -40,8 +41,8 @@ struct NodeNeighbours{
             edge_idx[j] = FG.dedge_ix(rep_edges[j][0], rep_edges[j][1]);
             if(rep_edges[j][0] == tid) {++represent_count; is_rep[j] = true;}
         }
-        //ex_scan<node_t>(reinterpret_cast<node_t*>(sdata), represent_count, bdim);
-        auto offset  = sycl::exclusive_scan_over_group(cta, represent_count, sycl::plus<node_t>{});  //reinterpret_cast<node_t*>(sdata)[tid];
+        //sdata is not in use yet, so it doubles as the scan scratch.
+        auto offset  = exclusive_scan(cta, (node_t)represent_count, reinterpret_cast<node_t*>(sdata), sycl::plus<node_t>{}, (node_t)0);
         int k = 0;
         for(int j = 0; j < 3; j++){
             if(is_rep[j]){
@@ -66,10 +67,20 @@ struct NodeNeighbours{
 * @param isomer_idx The index of the isomer to initialize based on.
 */
 
-NodeNeighbours(const sycl::accessor<K, 1, access::mode::read>& cubic_neighbours_acc, sycl::group<1>& cta){
-        int tid = cta.get_local_linear_id();
-        int isomer_idx = cta.get_group_linear_id();
-        int blockDim = cta.get_local_linear_range();
+template <typename View>
+NodeNeighbours(const View& cubic_neighbours_acc, sycl::group<1>& cta) : NodeNeighbours(cubic_neighbours_acc, cta.get_group_linear_id(), cta.get_local_linear_range(), cta.get_local_linear_id()) {}
+
+NodeNeighbours() = default;
+
+/**
+* @brief Constructor for the neighbours of an explicit node, for kernels where a work-item handles several nodes. Face information is not computed.
+* @param cubic_neighbours_acc All isomer graphs in the batch.
+* @param isomer_idx The index of the isomer.
+* @param blockDim Number of nodes per isomer.
+* @param tid The node.
+*/
+template <typename View>
+NodeNeighbours(const View& cubic_neighbours_acc, const size_t isomer_idx, const size_t blockDim, const size_t tid){
         const DeviceCubicGraph FG(cubic_neighbours_acc, isomer_idx*blockDim*3);
         this->cubic_neighbours   = {FG[tid*3], FG[tid*3 + 1], FG[tid*3 + 2]};
         this->next_on_face = {FG.next_on_face(tid, FG[tid*3]), FG.next_on_face(tid, FG[tid*3 + 1]), FG.next_on_face(tid ,FG[tid*3 + 2])};
@@ -0,0 +1,58 @@
+#pragma once
+
+template <typename T, typename U, typename K, StoragePolicy S> class convert_precision;
+
+/**
+ * @brief Copies a batch into a batch of another floating point precision on the device. Coordinates are cast, the graphs, IDs, iterations and statuses are copied as they are.
+ * @param Q The queue to submit the kernel to.
+ * @param src The batch to convert.
+ * @param dst Batch receiving the conversion, same N as src. It is grown to the capacity of src if it is smaller.
+ * @param policy Whether to wait for the kernel to finish.
+ */
+template <typename T, typename U, typename K, StoragePolicy S>
+void convert(sycl::queue &Q, IsomerBatch<T, K, S> &src, IsomerBatch<U, K, S> &dst, const LaunchPolicy policy = LaunchPolicy::SYNC)
+{
+    assert(src.N() == dst.N());
+    dst.resize(Q, src.capacity());
+    dst.resize(Q, src.size());
+    Q.submit([&](sycl::handler &h)
+             {
+        auto in_X_acc = src.X.view(h, sycl::read_only);
+        auto in_xys_acc = src.xys.view(h, sycl::read_only);
+        auto in_cubic_acc = src.cubic_neighbours.view(h, sycl::read_only);
+        auto in_dual_acc = src.dual_neighbours.view(h, sycl::read_only);
+        auto in_degrees_acc = src.face_degrees.view(h, sycl::read_only);
+        auto in_IDs_acc = src.IDs.view(h, sycl::read_only);
+        auto in_iterations_acc = src.iterations.view(h, sycl::read_only);
+        auto in_statuses_acc = src.statuses.view(h, sycl::read_only);
+        auto out_X_acc = dst.X.view(h, sycl::write_only);
+        auto out_xys_acc = dst.xys.view(h, sycl::write_only);
+        auto out_cubic_acc = dst.cubic_neighbours.view(h, sycl::write_only);
+        auto out_dual_acc = dst.dual_neighbours.view(h, sycl::write_only);
+        auto out_degrees_acc = dst.face_degrees.view(h, sycl::write_only);
+        auto out_IDs_acc = dst.IDs.view(h, sycl::write_only);
+        auto out_iterations_acc = dst.iterations.view(h, sycl::write_only);
+        auto out_statuses_acc = dst.statuses.view(h, sycl::write_only);
+        auto N = src.N();
+        auto Nf = src.Nf();
+        // One work-item per atom of every slot, the first Nf of them also copy the faces.
+        h.parallel_for<convert_precision<T, U, K, S>>(sycl::range{N * src.capacity()}, [=](sycl::item<1> item) {
+            auto i = item.get_linear_id();
+            auto slot = i / N, atom = i % N;
+            for (int d = 0; d < 3; d++) out_X_acc[i][d] = (U)in_X_acc[i][d];
+            for (int d = 0; d < 2; d++) out_xys_acc[i][d] = (U)in_xys_acc[i][d];
+            for (int j = 0; j < 3; j++) out_cubic_acc[i * 3 + j] = in_cubic_acc[i * 3 + j];
+            if (atom < Nf)
+            {
+                for (int j = 0; j < 6; j++) out_dual_acc[(slot * Nf + atom) * 6 + j] = in_dual_acc[(slot * Nf + atom) * 6 + j];
+                out_degrees_acc[slot * Nf + atom] = in_degrees_acc[slot * Nf + atom];
+            }
+            if (atom == 0)
+            {
+                out_IDs_acc[slot] = in_IDs_acc[slot];
+                out_iterations_acc[slot] = in_iterations_acc[slot];
+                out_statuses_acc[slot] = in_statuses_acc[slot];
+            }
+        }); });
+    if (policy == LaunchPolicy::SYNC) Q.wait_and_throw();
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <CL/sycl.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+
+// Opt-in timeline of the pipeline, written as a Chrome trace (load it in chrome://tracing or https://ui.perfetto.dev).
+// Device commands are recorded with profile(name, Q, event) right after they are submitted, host phases with a ProfilePhase scope.
+// Both are no-ops until Profiler::instance().enable(path) is called, and the queues must then be created with sycl::property::queue::enable_profiling.
+// Device timestamps and the host clock have different origins. A command is placed at the host time it was submitted plus its queueing delay on the device,
+// so commands from different queues line up with each other and with the host phases without synchronising clocks.
+
+struct Profiler
+{
+    using clock_type = std::chrono::steady_clock;
+
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    //Starts recording, the trace is written to path by write().
+    void enable(const std::string &path)
+    {
+        std::lock_guard lock(mutex);
+        trace_path = path;
+        origin = clock_type::now();
+        is_enabled = true;
+    }
+
+    bool enabled() const { return is_enabled; }
+
+    //Records a device command that was just submitted to Q.
+    void record(const std::string &name, const sycl::queue &Q, const sycl::event &event)
+    {
+        if (!is_enabled) return;
+        std::lock_guard lock(mutex);
+        pending.push_back({name, track(Q), event, clock_type::now()});
+        // Long runs submit millions of commands, the finished ones are turned into trace events now and then to bound the pending list.
+        if (pending.size() >= resolve_threshold)
+        {
+            resolve(false);
+            resolve_threshold = std::max<size_t>(4096, 2 * pending.size());
+        }
+    }
+
+    //Records a host phase of the calling thread.
+    void record_host(const std::string &name, const clock_type::time_point begin, const clock_type::time_point end)
+    {
+        if (!is_enabled) return;
+        std::lock_guard lock(mutex);
+        auto thread = std::this_thread::get_id();
+        if (!host_tracks.count(thread)) host_tracks.emplace(thread, host_tracks.size());
+        events.push_back({name, "host", 0, host_tracks[thread], us(begin), std::chrono::duration<double, std::micro>(end - begin).count()});
+    }
+
+    //Waits for every recorded command and writes the trace. Recording can continue afterwards, a later write() rewrites the whole file.
+    void write()
+    {
+        if (!is_enabled) return;
+        std::lock_guard lock(mutex);
+        resolve(true);
+        std::ofstream file(trace_path, std::ios::trunc);
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"host\"}},\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"devices\"}}";
+        for (auto &[thread, tid] : host_tracks) file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+        for (size_t tid = 0; tid < track_names.size(); tid++) file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"" << escape(track_names[tid]) << "\"}}";
+        file.precision(3);
+        file << std::fixed;
+        for (auto &e : events)
+            file << ",\n{\"name\":\"" << escape(e.name) << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":" << e.pid << ",\"tid\":" << e.tid << ",\"ts\":" << e.ts << ",\"dur\":" << e.dur << "}";
+        file << "\n]}\n";
+    }
+
+  private:
+    struct Pending
+    {
+        std::string name;
+        size_t track;
+        sycl::event event;
+        clock_type::time_point submitted;
+    };
+    struct TraceEvent
+    {
+        std::string name;
+        const char *category;
+        int pid;
+        size_t tid;
+        double ts, dur; //Microseconds since enable()
+    };
+
+    std::mutex mutex;
+    std::atomic<bool> is_enabled = false;
+    size_t resolve_threshold = 4096;
+    std::string trace_path;
+    clock_type::time_point origin;
+    std::vector<Pending> pending;
+    std::vector<TraceEvent> events;
+    std::vector<sycl::queue> device_tracks; // A handful of queues, the track of a queue is its index
+    std::vector<std::string> track_names;
+    std::unordered_map<std::thread::id, size_t> host_tracks;
+
+    double us(const clock_type::time_point t) const { return std::chrono::duration<double, std::micro>(t - origin).count(); }
+
+    size_t track(const sycl::queue &Q)
+    {
+        for (size_t i = 0; i < device_tracks.size(); i++)
+            if (device_tracks[i] == Q) return i;
+        device_tracks.push_back(Q);
+        track_names.push_back("queue " + std::to_string(track_names.size()) + ": " + Q.get_device().get_info<sycl::info::device::name>());
+        return device_tracks.size() - 1;
+    }
+
+    //Turns the finished commands into trace events, with wait = true every pending command is waited for.
+    void resolve(const bool wait)
+    {
+        std::vector<Pending> unfinished;
+        for (auto &p : pending)
+        {
+            if (!wait && p.event.get_info<sycl::info::event::command_execution_status>() != sycl::info::event_command_status::complete)
+            {
+                unfinished.push_back(p);
+                continue;
+            }
+            try
+            {
+                p.event.wait();
+                auto submit = p.event.get_profiling_info<sycl::info::event_profiling::command_submit>();
+                auto start = p.event.get_profiling_info<sycl::info::event_profiling::command_start>();
+                auto end = p.event.get_profiling_info<sycl::info::event_profiling::command_end>();
+                events.push_back({p.name, "device", 1, p.track, us(p.submitted) + (start - submit) * 1e-3, (end - start) * 1e-3});
+            }
+            // The queue was created without enable_profiling, or the command failed. Either way there is nothing to place on the timeline.
+            catch (sycl::exception &) {}
+        }
+        pending = std::move(unfinished);
+    }
+
+    static std::string escape(const std::string &s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+};
+
+//Records a device command that was just submitted to Q, if profiling is enabled.
+inline void profile(const char *name, const sycl::queue &Q, const sycl::event &event)
+{
+    if (Profiler::instance().enabled()) Profiler::instance().record(name, Q, event);
+}
+
+//Records the lifetime of the scope as a host phase, if profiling is enabled.
+struct ProfilePhase
+{
+    explicit ProfilePhase(const char *name) : name(name), begin(Profiler::clock_type::now()) {}
+    ~ProfilePhase() { Profiler::instance().record_host(name, begin, Profiler::clock_type::now()); }
+    ProfilePhase(const ProfilePhase &) = delete;
+    ProfilePhase &operator=(const ProfilePhase &) = delete;
+
+  private:
+    const char *name;
+    Profiler::clock_type::time_point begin;
+};
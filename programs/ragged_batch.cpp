@@ -0,0 +1,170 @@
+#pragma once
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+
+template <typename T, typename K, StoragePolicy S> class ragged_pack_kernel;
+template <typename T, typename K, StoragePolicy S> class ragged_unpack_kernel;
+
+/**
+ * @brief A batch of isomers of different sizes, stored packed: slot i owns atoms offset(i) .. offset(i + 1) of X, and three neighbours per atom of cubic_neighbours.
+ *        Kernels find the extent of their isomer in offsets. The layout is fixed when the batch is made,
+ *        slots are filled from uniform batches with pack() and read back with unpack(). Slots start out EMPTY.
+ */
+template <typename T, typename K>
+struct RaggedBatch
+{
+    TEMPLATE_TYPEDEFS(T, K);
+
+    sycl::buffer<coord3d, 1> X;
+    sycl::buffer<K, 1> cubic_neighbours;
+    sycl::buffer<size_t, 1> offsets; //capacity() + 1 entries, the last one is total_atoms()
+    sycl::buffer<size_t, 1> IDs;
+    sycl::buffer<size_t, 1> iterations;
+    sycl::buffer<IsomerStatus, 1> statuses;
+
+    //One slot per entry of sizes, in that order.
+    explicit RaggedBatch(const std::vector<size_t> &sizes)
+        : X(range<1>(std::accumulate(sizes.begin(), sizes.end(), size_t(0)))), cubic_neighbours(range<1>(3 * X.size())), offsets(range<1>(sizes.size() + 1)),
+          IDs(range<1>(sizes.size())), iterations(range<1>(sizes.size())), statuses(range<1>(sizes.size())), host_offsets(sizes.size() + 1, 0)
+    {
+        std::partial_sum(sizes.begin(), sizes.end(), host_offsets.begin() + 1);
+        sycl::host_accessor offsets_acc(offsets, sycl::write_only, sycl::no_init);
+        sycl::host_accessor IDs_acc(IDs, sycl::write_only, sycl::no_init);
+        sycl::host_accessor iterations_acc(iterations, sycl::write_only, sycl::no_init);
+        sycl::host_accessor statuses_acc(statuses, sycl::write_only, sycl::no_init);
+        for (size_t i = 0; i < host_offsets.size(); i++) offsets_acc[i] = host_offsets[i];
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            IDs_acc[i] = std::numeric_limits<size_t>::max();
+            iterations_acc[i] = 0;
+            statuses_acc[i] = IsomerStatus::EMPTY;
+        }
+    }
+
+    size_t capacity() const { return host_offsets.size() - 1; }
+    size_t total_atoms() const { return host_offsets.back(); }
+    size_t offset(const size_t i) const { return host_offsets[i]; }
+    size_t N(const size_t i) const { return host_offsets[i + 1] - host_offsets[i]; }
+    size_t max_N() const
+    {
+        size_t max_N = 0;
+        for (size_t i = 0; i < capacity(); i++) max_N = std::max(max_N, N(i));
+        return max_N;
+    }
+
+  private:
+    std::vector<size_t> host_offsets;
+};
+
+/**
+ * @brief Copies n slots of a uniform batch into consecutive slots of a ragged batch, which must all have the size of B.
+ * @param Q The queue to submit the kernel to.
+ * @param R The ragged batch.
+ * @param first First slot of R to fill.
+ * @param B The uniform batch, its slots 0 .. n - 1 are copied.
+ * @param n Number of slots to copy.
+ */
+template <typename T, typename K, StoragePolicy S>
+void pack(sycl::queue &Q, RaggedBatch<T, K> &R, const size_t first, IsomerBatch<T, K, S> &B, const size_t n)
+{
+    size_t N = B.N(), base = R.offset(first);
+    assert(first + n <= R.capacity() && n <= B.capacity() && R.offset(first + n) - base == n * N);
+    if (n == 0) return;
+    Q.submit([&](sycl::handler &h)
+             {
+        auto in_X_acc = B.X.view(h, sycl::read_only);
+        auto in_cubic_acc = B.cubic_neighbours.view(h, sycl::read_only);
+        auto in_IDs_acc = B.IDs.view(h, sycl::read_only);
+        auto in_iterations_acc = B.iterations.view(h, sycl::read_only);
+        auto in_statuses_acc = B.statuses.view(h, sycl::read_only);
+        sycl::accessor out_X_acc(R.X, h, sycl::write_only);
+        sycl::accessor out_cubic_acc(R.cubic_neighbours, h, sycl::write_only);
+        sycl::accessor out_IDs_acc(R.IDs, h, sycl::write_only);
+        sycl::accessor out_iterations_acc(R.iterations, h, sycl::write_only);
+        sycl::accessor out_statuses_acc(R.statuses, h, sycl::write_only);
+        // One work-item per atom, the slots of R being copied to are contiguous and equally sized.
+        h.parallel_for<ragged_pack_kernel<T, K, S>>(sycl::range{n * N}, [=](sycl::item<1> item) {
+            auto i = item.get_linear_id();
+            out_X_acc[base + i] = in_X_acc[i];
+            for (int j = 0; j < 3; j++) out_cubic_acc[(base + i) * 3 + j] = in_cubic_acc[i * 3 + j];
+            if (i % N == 0)
+            {
+                out_IDs_acc[first + i / N] = in_IDs_acc[i / N];
+                out_iterations_acc[first + i / N] = in_iterations_acc[i / N];
+                out_statuses_acc[first + i / N] = in_statuses_acc[i / N];
+            }
+        }); });
+}
+
+/**
+ * @brief Copies n consecutive slots of a ragged batch, which must all have the size of B, into the first slots of a uniform batch.
+ * @param Q The queue to submit the kernel to.
+ * @param B The uniform batch, its slots 0 .. n - 1 are overwritten.
+ * @param R The ragged batch.
+ * @param first First slot of R to copy.
+ * @param n Number of slots to copy.
+ */
+template <typename T, typename K, StoragePolicy S>
+void unpack(sycl::queue &Q, IsomerBatch<T, K, S> &B, RaggedBatch<T, K> &R, const size_t first, const size_t n)
+{
+    size_t N = B.N(), base = R.offset(first);
+    assert(first + n <= R.capacity() && n <= B.capacity() && R.offset(first + n) - base == n * N);
+    if (n == 0) return;
+    Q.submit([&](sycl::handler &h)
+             {
+        sycl::accessor in_X_acc(R.X, h, sycl::read_only);
+        sycl::accessor in_cubic_acc(R.cubic_neighbours, h, sycl::read_only);
+        sycl::accessor in_IDs_acc(R.IDs, h, sycl::read_only);
+        sycl::accessor in_iterations_acc(R.iterations, h, sycl::read_only);
+        sycl::accessor in_statuses_acc(R.statuses, h, sycl::read_only);
+        auto out_X_acc = B.X.view(h, sycl::write_only);
+        auto out_cubic_acc = B.cubic_neighbours.view(h, sycl::write_only);
+        auto out_IDs_acc = B.IDs.view(h, sycl::write_only);
+        auto out_iterations_acc = B.iterations.view(h, sycl::write_only);
+        auto out_statuses_acc = B.statuses.view(h, sycl::write_only);
+        h.parallel_for<ragged_unpack_kernel<T, K, S>>(sycl::range{n * N}, [=](sycl::item<1> item) {
+            auto i = item.get_linear_id();
+            out_X_acc[i] = in_X_acc[base + i];
+            for (int j = 0; j < 3; j++) out_cubic_acc[i * 3 + j] = in_cubic_acc[(base + i) * 3 + j];
+            if (i % N == 0)
+            {
+                out_IDs_acc[i / N] = in_IDs_acc[first + i / N];
+                out_iterations_acc[i / N] = in_iterations_acc[first + i / N];
+                out_statuses_acc[i / N] = in_statuses_acc[first + i / N];
+            }
+        }); });
+}
+
+/**
+ * @brief Groups isomers by size for ragged launches. A ragged launch runs work-groups as wide as its largest isomer,
+ *        so a bucket only takes sizes that keep at least 1 - max_idle of the work-items of its smallest isomer busy.
+ * @param sizes Atom count of every isomer.
+ * @param max_idle Largest fraction of idle work-items allowed for any isomer of a bucket.
+ * @param max_atoms Largest number of atoms in a bucket, so that buckets can be spread over several queues. 0 for no limit.
+ * @return Indices into sizes, one list per bucket, sorted by size within and across buckets.
+ */
+inline std::vector<std::vector<size_t>> bucket_by_size(const std::vector<size_t> &sizes, const double max_idle = 0.25, const size_t max_atoms = 0)
+{
+    //Sorted as pairs, the global swap() in sym_mat3.cpp makes std::sort ambiguous on our own structs.
+    std::vector<std::pair<size_t, size_t>> by_size(sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++) by_size[i] = {sizes[i], i};
+    std::sort(by_size.begin(), by_size.end());
+    std::vector<std::vector<size_t>> buckets;
+    size_t smallest = 0, atoms = 0;
+    for (auto [N, i] : by_size)
+    {
+        bool too_wide = !buckets.empty() && double(N - smallest) > max_idle * double(N);
+        bool too_large = max_atoms > 0 && atoms + N > max_atoms;
+        if (buckets.empty() || too_wide || too_large)
+        {
+            buckets.emplace_back();
+            smallest = N;
+            atoms = 0;
+        }
+        buckets.back().push_back(i);
+        atoms += N;
+    }
+    return buckets;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <array>
+#include <type_traits>
+
+// DETERMINISTIC_REDUCTION selects how custom_reduce combines the values of a work-group:
+// 0: sycl::reduce_over_group and sub-group shuffles, fastest, but the order of operations is implementation-defined
+//    so results differ between backends and sub-group sizes.
+// 1: tree_reduce, a fixed-order pairwise tree in local memory. Bit-reproducible on any backend for a given group size, as long as the compiler does not reassociate (no fast-math).
+// 2: as 1, but sums (sycl::plus) carry a compensation term through the tree, see compensated_sum.
+// Define it on the command line to select the mode, e.g. -DDETERMINISTIC_REDUCTION=1 for CI runs. sycl-tests/reduction-benchmark.cpp measures the cost of each mode.
+#ifndef DETERMINISTIC_REDUCTION
+#define DETERMINISTIC_REDUCTION 0
+#endif
+
+// SUBGROUP_SHUFFLES selects whether the fused custom_reduce of mode 0 reduces within sub-groups first. nvc++ compiles the sub-group shuffles to nothing
+// (see SYCL_INFO_SHEET.md), so for hipSYCL's nvc++ target, the default HIPSYCL_TARGETS of this repo, it falls back to tree_reduce.
+#ifndef SUBGROUP_SHUFFLES
+#if defined(__HIPSYCL__) && defined(__NVCOMPILER)
+#define SUBGROUP_SHUFFLES 0
+#else
+#define SUBGROUP_SHUFFLES 1
+#endif
+#endif
+
+//Local memory elements custom_reduce needs to reduce M values at a time over a group of group_size work-items.
+inline size_t reduction_scratch_size(const size_t group_size, const size_t M)
+{
+    return (DETERMINISTIC_REDUCTION == 2 ? 2 : 1) * M * group_size;
+}
+
+/**
+ * @brief Reduces M values across the work-group with a fixed-order pairwise tree in local memory, so the result does not depend on the backend.
+ *        Every level combines element i with element i + ceil(n/2), the middle element of an odd level is carried over unchanged.
+ * @param cta The work-group.
+ * @param vals The values contributed by the calling work-item.
+ * @param sdata Local memory of M * group size elements.
+ * @param Aop The associative operator.
+ * @return The M reductions, available to every work-item.
+ */
+template <typename T, size_t M, typename AssocOperator>
+std::array<T, M> tree_reduce(const sycl::group<1> &cta, const std::array<T, M> &vals, T *sdata, AssocOperator Aop)
+{
+    const size_t tid = cta.get_local_linear_id();
+    const size_t lrange = cta.get_local_linear_range();
+    // sdata may still be read by work-items finishing the previous reduction.
+    sycl::group_barrier(cta);
+    for (size_t m = 0; m < M; m++) sdata[m * lrange + tid] = vals[m];
+    sycl::group_barrier(cta);
+    for (size_t n = lrange; n > 1;)
+    {
+        size_t half = (n + 1) / 2;
+        if (tid < n / 2)
+            for (size_t m = 0; m < M; m++) sdata[m * lrange + tid] = Aop(sdata[m * lrange + tid], sdata[m * lrange + tid + half]);
+        sycl::group_barrier(cta);
+        n = half;
+    }
+    std::array<T, M> result;
+    for (size_t m = 0; m < M; m++) result[m] = sdata[m * lrange];
+    return result;
+}
+
+/**
+ * @brief Sums M values across the work-group in the same fixed order as tree_reduce, but every partial sum carries the rounding error of its additions (Knuth's TwoSum),
+ *        which is added back at the end. The result is as accurate as summing in twice the precision.
+ * @param cta The work-group.
+ * @param vals The values contributed by the calling work-item.
+ * @param sdata Local memory of 2 * M * group size elements.
+ * @return The M sums, available to every work-item.
+ */
+template <typename T, size_t M>
+std::array<T, M> compensated_sum(const sycl::group<1> &cta, const std::array<T, M> &vals, T *sdata)
+{
+    const size_t tid = cta.get_local_linear_id();
+    const size_t lrange = cta.get_local_linear_range();
+    T *errors = sdata + M * lrange;
+    sycl::group_barrier(cta);
+    for (size_t m = 0; m < M; m++)
+    {
+        sdata[m * lrange + tid] = vals[m];
+        errors[m * lrange + tid] = T(0);
+    }
+    sycl::group_barrier(cta);
+    for (size_t n = lrange; n > 1;)
+    {
+        size_t half = (n + 1) / 2;
+        if (tid < n / 2)
+            for (size_t m = 0; m < M; m++)
+            {
+                size_t i = m * lrange + tid;
+                T a = sdata[i], b = sdata[i + half];
+                T sum = a + b;
+                T b_virtual = sum - a;
+                errors[i] += errors[i + half] + ((a - (sum - b_virtual)) + (b - b_virtual));
+                sdata[i] = sum;
+            }
+        sycl::group_barrier(cta);
+        n = half;
+    }
+    std::array<T, M> result;
+    for (size_t m = 0; m < M; m++) result[m] = sdata[m * lrange] + errors[m * lrange];
+    return result;
+}
+
+//The deterministic reduction selected by DETERMINISTIC_REDUCTION, compensated_sum is only used for sums.
+template <typename T, size_t M, typename AssocOperator>
+std::array<T, M> deterministic_reduce(const sycl::group<1> &cta, const std::array<T, M> &vals, T *sdata, AssocOperator Aop)
+{
+    if constexpr (DETERMINISTIC_REDUCTION == 2 && std::is_same_v<AssocOperator, sycl::plus<T>>)
+        return compensated_sum(cta, vals, sdata);
+    else
+        return tree_reduce(cta, vals, sdata, Aop);
+}
+
+template <typename T, typename AssocOperator>
+T custom_reduce(const sycl::group<1>& cta, T val, T* sdata, AssocOperator Aop)
+{   
+    //sycl::reduce_over_group(cta, val, sdata, Aop);
+
+    /* sycl::sub_group sg{};
+    T w = detail::handler::cl::sycl::detail::(sg, val, Aop);
+    const int lid = cta.get_local_linear_id();
+    const int lrange = (cta.get_local_range().size() + 32 - 1) / 32;
+    if (sg.leader())
+    {
+        sdata[lid / sg.get_local_range()[0]] = w;
+    }
+    if (lrange == 1)
+    {
+        return sdata[0];
+    }
+    int outputs = lrange;
+    for (int i = (lrange + 1) / 2; i > 1; i = (i + 1) / 2) {
+      if (lid < i && lid + i < outputs)
+        sdata[lid] = Aop(sdata[lid], sdata[lid + i]);
+      outputs = outputs / 2 + outputs % 2;
+      sycl::group_barrier(cta);
+    }
+    sycl::group_barrier(cta);
+    return Aop(sdata[0], sdata[1]); */
+
+
+    //sycl::group_barrier(cta);
+    //sdata[cta.get_local_linear_id()] = val;
+    //sycl::group_barrier(cta);
+    //for (int i = cta.get_local_linear_range() / 2; i > 0; i >>= 1)
+    //{
+    //    if (cta.get_local_linear_id() < i && cta.get_local_linear_id() + i < cta.get_local_linear_range()){
+    //        sdata[cta.get_local_linear_id()] = Aop(sdata[cta.get_local_linear_id()],sdata[cta.get_local_linear_id() + i]);
+    //    }
+    //    sycl::group_barrier(cta);
+    //}    
+    //T result = sdata[0];
+    
+#if DETERMINISTIC_REDUCTION
+    return deterministic_reduce(cta, std::array<T, 1>{val}, sdata, Aop)[0];
+#else
+    return sycl::reduce_over_group(cta, val, Aop);
+#endif
+}
+
+/**
+ * @brief Reduces M values across the work-group in a single pass, instead of M separate group reductions.
+ *        Each sub-group reduces its values with shuffles, the sub-group leaders publish their partials in local memory, and every work-item combines the partials itself.
+ *        This costs two group barriers however many values are reduced. With DETERMINISTIC_REDUCTION set it is deterministic_reduce instead,
+ *        and without SUBGROUP_SHUFFLES it is tree_reduce.
+ * @param cta The work-group.
+ * @param sg The sub-group of the calling work-item.
+ * @param vals The values contributed by the calling work-item.
+ * @param sdata Local memory of reduction_scratch_size(group size, M) elements.
+ * @param Aop The associative operator.
+ * @return The M reductions, available to every work-item.
+ */
+template <typename T, size_t M, typename AssocOperator>
+std::array<T, M> custom_reduce(const sycl::group<1> &cta, const sycl::sub_group &sg, std::array<T, M> vals, T *sdata, AssocOperator Aop)
+{
+#if DETERMINISTIC_REDUCTION
+    return deterministic_reduce(cta, vals, sdata, Aop);
+#elif !SUBGROUP_SHUFFLES
+    return tree_reduce(cta, vals, sdata, Aop);
+#else
+    const size_t sg_id = sg.get_group_linear_id();
+    const size_t n_sg = sg.get_group_linear_range();
+    for (size_t m = 0; m < M; m++) vals[m] = sycl::reduce_over_group(sg, vals[m], Aop);
+    // sdata may still be read by work-items finishing the previous reduction.
+    sycl::group_barrier(cta);
+    if (sg.leader())
+        for (size_t m = 0; m < M; m++) sdata[sg_id * M + m] = vals[m];
+    sycl::group_barrier(cta);
+    std::array<T, M> result;
+    for (size_t m = 0; m < M; m++) result[m] = sdata[m];
+    for (size_t i = 1; i < n_sg; i++)
+        for (size_t m = 0; m < M; m++) result[m] = Aop(result[m], sdata[i * M + m]);
+    return result;
+#endif
+}
@@ -0,0 +1,378 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <stdexcept>
+#include <iostream>
+#include <atomic>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Binary container for optimised isomers.
+// Layout: ResultHeader | count fixed size records | index of count (ID, offset) pairs sorted by ID.
+// Record: ID (uint64) | iterations (uint64) | status (int32) | padding (4 bytes) | energy (T in an 8 byte slot) | X (N * 3 * T).
+// All integers are little endian as written by the host, the reader refuses files whose widths do not match its template arguments.
+
+constexpr char RESULT_MAGIC[8] = {'I', 'S', 'O', 'R', 'E', 'S', '0', '1'};
+
+struct ResultHeader
+{
+    char magic[8];
+    uint64_t N;              //Atoms per isomer
+    uint64_t count;          //Number of records
+    uint32_t real_width;     //sizeof(T)
+    uint32_t node_width;     //sizeof(K)
+    int32_t forcefield;      //ForcefieldType used for the optimisation
+    uint32_t record_bytes;
+    uint64_t iterations;     //CG iterations per launch
+    uint64_t max_iterations; //Iteration budget per isomer
+    uint64_t index_offset;   //Byte offset of the index
+};
+
+struct ResultIndexEntry
+{
+    uint64_t ID;
+    uint64_t offset; //Byte offset of the record
+};
+
+template <typename T>
+constexpr size_t result_record_bytes(const size_t N) { return 8 + 8 + 4 + 4 + 8 + N * 3 * sizeof(T); }
+
+/**
+ * @brief Streams optimised isomers to a result file. write() only enqueues the device to host copies into a pinned host block,
+ *        a dedicated writer thread waits for them and does the file I/O, so neither the copies nor the I/O hold up the next launches.
+ *        Blocks travel between the queue threads and the writer thread through lock-free BoundedQueues, the number of blocks bounds the batches in flight to the writer.
+ *        Every queue has blocks of its own, pinned host memory is only usable by queues of the context it was allocated in.
+ *        Only CONVERGED and FAILED isomers are written, EMPTY slots are skipped.
+ *        The index and final header are written by close(), or by the destructor.
+ *        A failed write, e.g. on a full disk, stops the writer thread from writing and is thrown by the next write() or by close().
+ */
+template <typename T, typename K>
+struct ResultWriter
+{
+    TEMPLATE_TYPEDEFS(T, K);
+
+    /**
+     * @param path The file to create, an existing file is overwritten.
+     * @param queues The queues write() is called with, each gets n_blocks pinned host blocks from its UsmPool.
+     * @param N Atoms per isomer.
+     * @param block_capacity Isomers per block, the capacity of the batches that are written.
+     * @param forcefield ForcefieldType stored in the header.
+     * @param iterations CG iterations per launch, stored in the header.
+     * @param max_iterations Iteration budget per isomer, stored in the header.
+     * @param n_blocks Number of pinned blocks per queue, write() blocks when all of the queue's blocks are waiting for the writer thread.
+     * @param resume Append to an existing file instead of overwriting it. Every whole record already in the file is kept, also when the writing process died before close().
+     * @throws std::runtime_error if the file cannot be opened or its header cannot be written, or if the file being resumed was written with different N, T or K.
+     */
+    ResultWriter(const std::string &path, const std::vector<sycl::queue> &queues, const size_t N, const size_t block_capacity, const int forcefield, const size_t iterations, const size_t max_iterations, const size_t n_blocks = 2, const bool resume = false)
+        : path(path), queues(queues), N(N), block_capacity(block_capacity), pending(n_blocks * queues.size())
+    {
+        std::memcpy(header.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC));
+        header.N = N;
+        header.count = 0;
+        header.real_width = sizeof(T);
+        header.node_width = sizeof(K);
+        header.forcefield = forcefield;
+        header.record_bytes = result_record_bytes<T>(N);
+        header.iterations = iterations;
+        header.max_iterations = max_iterations;
+        header.index_offset = 0;
+        if (resume && std::filesystem::exists(path)) reopen(path);
+        else file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("ResultWriter: cannot open " + path);
+        //The header on disk says "not closed" until close() patches it.
+        file.seekp(0);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.seekp(next_offset);
+        if (!file) throw std::runtime_error("ResultWriter: cannot write the header of " + path);
+
+        blocks.resize(n_blocks * queues.size());
+        for (size_t q = 0; q < queues.size(); q++)
+        {
+            sycl::queue Q = queues[q];
+            free_blocks.push_back(std::make_unique<BoundedQueue<Block *>>(n_blocks));
+            for (size_t b = q * n_blocks; b < (q + 1) * n_blocks; b++)
+            {
+                Block &block = blocks[b];
+                block.queue = q;
+                block.X = pool_malloc<coord3d>(block_capacity * N, Q, sycl::usm::alloc::host);
+                block.IDs = pool_malloc<size_t>(block_capacity, Q, sycl::usm::alloc::host);
+                block.iterations = pool_malloc<size_t>(block_capacity, Q, sycl::usm::alloc::host);
+                block.statuses = pool_malloc<IsomerStatus>(block_capacity, Q, sycl::usm::alloc::host);
+                block.energies = pool_malloc<T>(block_capacity, Q, sycl::usm::alloc::host);
+                free_blocks[q]->push(&block);
+            }
+        }
+        writer = std::thread([this]() { write_loop(); });
+    }
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter &operator=(const ResultWriter &) = delete;
+    //Destructors must not throw, a failure to finish the file is only reported.
+    ~ResultWriter()
+    {
+        try { close(); }
+        catch (const std::exception &e) { std::cerr << e.what() << std::endl; }
+    }
+
+    /**
+     * @brief Enqueues copies of the first n slots of the batch and their energies into a pinned block and hands it to the writer thread.
+     *        Returns without waiting for the copies, unless every block is still waiting for the writer thread.
+     * @param Q The queue to copy on, one of the queues the writer was created with. Buffer backed batches may be copied on a queue of their own, see DeviceScheduler::copy_queue,
+     *          for USM storage it must be the in-order queue the kernels on B run on.
+     * @param B The batch, typically the finished batch filled by refill().
+     * @param energies Energies of the slots of B, see forcefield_energies().
+     * @param n Number of leading slots to consider.
+     * @throws std::runtime_error if an earlier block could not be written to the file.
+     */
+    template <StoragePolicy S>
+    void write(sycl::queue &Q, IsomerBatch<T, K, S> &B, sycl::buffer<T, 1> &energies, const size_t n)
+    {
+        assert(B.N() == N && B.capacity() <= block_capacity);
+        if (failed) throw std::runtime_error("ResultWriter: writing " + path + " failed");
+        size_t q = std::find(queues.begin(), queues.end(), Q) - queues.begin();
+        assert(q < queues.size());
+        Block *block = *free_blocks[q]->pop();
+        block->n = std::min(n, B.capacity());
+        block->copies = {B.X.download(Q, block->X, block->n * N), B.IDs.download(Q, block->IDs, block->n), B.iterations.download(Q, block->iterations, block->n),
+                         B.statuses.download(Q, block->statuses, block->n)};
+        if (block->n > 0) block->copies.push_back(Q.submit([&](sycl::handler &h)
+                                                            {
+            sycl::accessor energies_acc(energies, h, sycl::range<1>(block->n), sycl::read_only);
+            h.copy(energies_acc, block->energies); }));
+        pending.push(block);
+    }
+
+    /**
+     * @brief Sorted IDs of the whole records stored in a result file, also if the writing process died before close(). Empty if the file does not exist.
+     * @throws std::runtime_error if the file was written with a different T or K.
+     */
+    static std::vector<uint64_t> ids_in(const std::string &path)
+    {
+        std::vector<uint64_t> IDs;
+        if (!std::filesystem::exists(path)) return IDs;
+        ResultHeader existing;
+        for (auto [ID, offset] : scan(path, existing)) IDs.push_back(ID);
+        std::sort(IDs.begin(), IDs.end());
+        return IDs;
+    }
+
+    /**
+     * @brief Waits for the writer thread, then writes the index and the final header.
+     * @throws std::runtime_error if any record, the index or the header could not be written. The file is then left as if the process had died, see resume.
+     */
+    void close()
+    {
+        if (!writer.joinable()) return;
+        pending.close();
+        writer.join();
+        for (auto &block : blocks)
+        {
+            sycl::queue &Q = queues[block.queue];
+            pool_free(block.X, Q);
+            pool_free(block.IDs, Q);
+            pool_free(block.iterations, Q);
+            pool_free(block.statuses, Q);
+            pool_free(block.energies, Q);
+        }
+        if (failed) throw std::runtime_error("ResultWriter: writing " + path + " failed");
+
+        //Sorted as pairs, the global swap() in sym_mat3.cpp makes std::sort ambiguous on our own structs.
+        std::sort(index.begin(), index.end());
+        std::vector<ResultIndexEntry> entries(index.size());
+        for (size_t i = 0; i < index.size(); i++) entries[i] = {index[i].first, index[i].second};
+        header.count = entries.size();
+        header.index_offset = next_offset;
+        file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(ResultIndexEntry));
+        file.seekp(0);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.close();
+        if (!file) throw std::runtime_error("ResultWriter: cannot write the index of " + path);
+    }
+
+  private:
+    struct Block
+    {
+        coord3d *X;
+        size_t *IDs;
+        size_t *iterations;
+        IsomerStatus *statuses;
+        T *energies;
+        size_t n = 0;
+        size_t queue = 0;                //Index of the queue whose context the block was allocated in
+        std::vector<sycl::event> copies; //Device to host copies filling the block
+    };
+
+    std::ofstream file;
+    std::string path;
+    std::vector<sycl::queue> queues;
+    size_t N, block_capacity;
+    ResultHeader header;
+    std::vector<std::pair<uint64_t, uint64_t>> index; //(ID, offset), only touched by the writer thread until it has been joined.
+    uint64_t next_offset = sizeof(ResultHeader);     //Likewise
+    std::vector<Block> blocks;
+    std::vector<std::unique_ptr<BoundedQueue<Block *>>> free_blocks; //One per queue
+    BoundedQueue<Block *> pending;
+    std::thread writer;
+    std::atomic<bool> failed = false; //Set by the writer thread once a write to the file has failed
+
+    //(ID, offset) of every whole record in an existing file, records after the index or a partially written record at the end are ignored.
+    static std::vector<std::pair<uint64_t, uint64_t>> scan(const std::string &path, ResultHeader &existing)
+    {
+        std::ifstream in(path, std::ios::binary);
+        in.read(reinterpret_cast<char *>(&existing), sizeof(existing));
+        if (!in || std::memcmp(existing.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC)) != 0 || existing.real_width != sizeof(T) || existing.node_width != sizeof(K) ||
+            existing.record_bytes != result_record_bytes<T>(existing.N))
+            throw std::runtime_error("ResultWriter: " + path + " is not a result file for this T and K");
+        uint64_t end = existing.index_offset ? existing.index_offset : std::filesystem::file_size(path);
+        uint64_t n_records = (end - sizeof(ResultHeader)) / existing.record_bytes;
+        std::vector<std::pair<uint64_t, uint64_t>> records(n_records);
+        for (uint64_t i = 0; i < n_records; i++)
+        {
+            records[i].second = sizeof(ResultHeader) + i * existing.record_bytes;
+            in.seekg(records[i].second);
+            in.read(reinterpret_cast<char *>(&records[i].first), sizeof(uint64_t));
+        }
+        return records;
+    }
+
+    //Keeps the whole records of an existing file and drops its index and any partially written record.
+    void reopen(const std::string &path)
+    {
+        ResultHeader existing;
+        index = scan(path, existing);
+        if (existing.N != N || existing.record_bytes != header.record_bytes)
+            throw std::runtime_error("ResultWriter: cannot resume " + path + ", it was written for N = " + std::to_string(existing.N));
+        next_offset = sizeof(ResultHeader) + index.size() * header.record_bytes;
+        std::filesystem::resize_file(path, next_offset);
+        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    }
+
+    void write_loop()
+    {
+        std::vector<char> record(header.record_bytes, 0);
+        while (auto next = pending.pop())
+        {
+            Block *block = *next;
+            for (auto &event : block->copies) event.wait();
+            for (size_t i = 0; i < (failed ? 0 : block->n); i++)
+            {
+                if (block->statuses[i] != IsomerStatus::CONVERGED && block->statuses[i] != IsomerStatus::FAILED) continue;
+                uint64_t ID = block->IDs[i], iterations = block->iterations[i];
+                int32_t status = (int32_t)block->statuses[i];
+                std::memcpy(record.data(), &ID, 8);
+                std::memcpy(record.data() + 8, &iterations, 8);
+                std::memcpy(record.data() + 16, &status, 4);
+                std::memcpy(record.data() + 24, &block->energies[i], sizeof(T));
+                std::memcpy(record.data() + 32, &block->X[i * N], N * sizeof(coord3d));
+                file.write(record.data(), record.size());
+                index.push_back({ID, next_offset});
+                next_offset += record.size();
+            }
+            //Flushed per block, so that a full disk is noticed while the run is still going. The blocks keep circulating after a failure, write() throws instead.
+            if (!failed && !file.flush()) failed = true;
+            free_blocks[block->queue]->push(block);
+        }
+    }
+};
+
+/**
+ * @brief Read-only, memory mapped view of a result file. Records are only paged in when they are accessed, so single isomers can be read out of very large runs.
+ *        T and K must be those of the ResultWriter that wrote the file.
+ */
+template <typename T, typename K>
+struct ResultReader
+{
+    explicit ResultReader(const std::string &path)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("ResultReader: cannot open " + path);
+        //The destructor does not run for a constructor that throws, so the file and mapping are released here.
+        try { map(path); }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+    ResultReader(const ResultReader &) = delete;
+    ResultReader &operator=(const ResultReader &) = delete;
+    ~ResultReader() { release(); }
+
+    const ResultHeader &get_header() const { return header; }
+    size_t size() const { return header.count; }
+    size_t N() const { return header.N; }
+
+    //Accessors for the i'th record in file order.
+    uint64_t ID(const size_t i) const { return field<uint64_t>(i, 0); }
+    uint64_t iterations(const size_t i) const { return field<uint64_t>(i, 8); }
+    IsomerStatus status(const size_t i) const { return (IsomerStatus)field<int32_t>(i, 16); }
+    T energy(const size_t i) const { return field<T>(i, 24); }
+    //Pointer to the N * 3 coordinates of record i, not necessarily aligned for T, copy them out with std::memcpy.
+    const char *X(const size_t i) const { return record(i) + 32; }
+
+    //Position of the record with the given ID, or size() if there is none. Binary search over the index.
+    size_t find(const uint64_t ID) const
+    {
+        size_t lo = 0, hi = header.count;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            ResultIndexEntry entry;
+            std::memcpy(&entry, data + header.index_offset + mid * sizeof(ResultIndexEntry), sizeof(entry));
+            if (entry.ID == ID) return (entry.offset - sizeof(ResultHeader)) / header.record_bytes;
+            if (entry.ID < ID) lo = mid + 1;
+            else hi = mid;
+        }
+        return header.count;
+    }
+
+  private:
+    int fd = -1;
+    size_t bytes = 0;
+    const char *data = nullptr;
+    ResultHeader header;
+
+    void map(const std::string &path)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw std::runtime_error("ResultReader: cannot stat " + path);
+        bytes = st.st_size;
+        if (bytes < sizeof(header)) throw std::runtime_error("ResultReader: " + path + " is not a result file");
+        void *mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) throw std::runtime_error("ResultReader: cannot map " + path);
+        data = static_cast<const char *>(mapping);
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC)) != 0) throw std::runtime_error("ResultReader: " + path + " is not a result file");
+        if (header.real_width != sizeof(T) || header.node_width != sizeof(K))
+            throw std::runtime_error("ResultReader: " + path + " stores " + std::to_string(header.real_width) + " byte reals and " + std::to_string(header.node_width) + " byte nodes");
+        if (header.record_bytes != result_record_bytes<T>(header.N)) throw std::runtime_error("ResultReader: " + path + " has " + std::to_string(header.record_bytes) + " byte records for N = " + std::to_string(header.N));
+        if (header.index_offset == 0 || header.index_offset + header.count * sizeof(ResultIndexEntry) > bytes) throw std::runtime_error("ResultReader: " + path + " is truncated or was not closed");
+        if (sizeof(ResultHeader) + header.count * header.record_bytes > header.index_offset) throw std::runtime_error("ResultReader: " + path + " has fewer records than its header says");
+    }
+
+    void release()
+    {
+        if (data) munmap(const_cast<char *>(data), bytes);
+        if (fd >= 0) ::close(fd);
+        data = nullptr;
+        fd = -1;
+    }
+
+    const char *record(const size_t i) const { return data + sizeof(ResultHeader) + i * header.record_bytes; }
+    template <typename U>
+    U field(const size_t i, const size_t offset) const
+    {
+        U value;
+        std::memcpy(&value, record(i) + offset, sizeof(U));
+        return value;
+    }
+};
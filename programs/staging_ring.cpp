@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+/**
+ * @brief Ring of pinned host slots through which new graphs are streamed into a batch.
+ *        A reader thread fills free slots ahead of the launches, and upload() drains them with asynchronous copies on the queue,
+ *        so the file reads and the host to device copies of the next graphs overlap with the kernels that are running.
+ *        A slot is handed back to the reader only once the copies reading from it have completed.
+ *        Slots are passed between the two threads through lock-free BoundedQueues.
+ */
+template <typename K>
+struct StagingRing
+{
+    /**
+     * Fills up to capacity graphs, N * 3 neighbours each, and their IDs. Returns how many it filled, 0 once there is nothing left to read.
+     * Called on the reader thread only.
+     */
+    using Reader = std::function<size_t(K *graphs, size_t *IDs, const size_t capacity)>;
+
+    /**
+     * @param Q Queue used to allocate the pinned slots, from its UsmPool.
+     * @param N Atoms per isomer.
+     * @param slot_capacity Graphs per slot, also the number the reader is asked for at a time.
+     * @param n_slots Number of slots, the reader stays at most n_slots * slot_capacity graphs ahead.
+     * @param read Fills a slot, see Reader.
+     */
+    StagingRing(sycl::queue &Q, const size_t N, const size_t slot_capacity, const size_t n_slots, Reader read)
+        : Q(Q), N(N), slot_capacity(slot_capacity), slots(n_slots), free_slots(n_slots), filled(n_slots)
+    {
+        for (auto &slot : slots)
+        {
+            slot.graphs = pool_malloc<K>(slot_capacity * N * 3, Q, sycl::usm::alloc::host);
+            slot.IDs = pool_malloc<size_t>(slot_capacity, Q, sycl::usm::alloc::host);
+            free_slots.push(&slot);
+        }
+        reader = std::thread([this, read]() { read_loop(read); });
+    }
+    StagingRing(const StagingRing &) = delete;
+    StagingRing &operator=(const StagingRing &) = delete;
+    ~StagingRing()
+    {
+        stopping = true;
+        free_slots.close();
+        reader.join();
+        for (auto &slot : slots)
+        {
+            for (auto &event : slot.uploads) event.wait();
+            pool_free(slot.graphs, Q);
+            pool_free(slot.IDs, Q);
+        }
+    }
+
+    /**
+     * @brief Enqueues copies of the next staged graphs and their IDs into the slots of B from first on, wrapping around the end. Waits for the reader if fewer than n graphs are staged.
+     * @param Q The queue to copy on, in the context of the queue the ring was created with. Buffer backed batches may be copied on a queue of their own, see DeviceScheduler::copy_queue,
+     *          for USM storage it must be the in-order queue the kernels on B run on.
+     * @param B Batch receiving the graphs, e.g. the incoming batch of refill().
+     * @param n Number of graphs wanted, at most the capacity of B.
+     * @param first Slot of B receiving the first graph.
+     * @return The number of graphs copied, less than n only once the reader has run out.
+     */
+    template <typename T, StoragePolicy S>
+    size_t upload(sycl::queue &Q, IsomerBatch<T, K, S> &B, size_t n, const size_t first = 0)
+    {
+        n = std::min(n, B.capacity());
+        size_t n_new = 0;
+        while (n_new < n)
+        {
+            if (!current)
+            {
+                auto next = filled.pop();
+                if (!next) break;
+                current = *next;
+            }
+            Slot *slot = current;
+            size_t dst = (first + n_new) % B.capacity();
+            size_t count = std::min({n - n_new, slot->count - slot->consumed, B.capacity() - dst});
+            slot->uploads.push_back(B.cubic_neighbours.upload(Q, slot->graphs + slot->consumed * N * 3, dst * N * 3, count * N * 3));
+            slot->uploads.push_back(B.IDs.upload(Q, slot->IDs + slot->consumed, dst, count));
+            slot->consumed += count;
+            n_new += count;
+            if (slot->consumed < slot->count) continue;
+            free_slots.push(slot);
+            current = nullptr;
+        }
+        return n_new;
+    }
+
+  private:
+    struct Slot
+    {
+        K *graphs;
+        size_t *IDs;
+        size_t count = 0, consumed = 0;
+        std::vector<sycl::event> uploads; //Copies reading from the slot since it was last filled
+    };
+
+    sycl::queue Q;
+    size_t N, slot_capacity;
+    std::vector<Slot> slots;
+    BoundedQueue<Slot *> free_slots, filled; //filled is closed by the reader once it has run out
+    Slot *current = nullptr;                  //Slot being drained by upload(), owned by the consumer
+    std::atomic<bool> stopping = false;
+    std::thread reader;
+
+    void read_loop(const Reader &read)
+    {
+        while (true)
+        {
+            auto next = free_slots.pop();
+            if (!next || stopping) return;
+            Slot *slot = *next;
+            for (auto &event : slot->uploads) event.wait();
+            slot->uploads.clear();
+            slot->count = read(slot->graphs, slot->IDs, slot_capacity);
+            slot->consumed = 0;
+            if (slot->count == 0)
+            {
+                filled.close();
+                return;
+            }
+            filled.push(slot);
+        }
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include <array>
+
+//          c   b              c   b
+//          |   |               \ /
+//        --v---u--     ->       v
+//          |   |                |
+//          d   a                u
+//                              / \   turned by 90 degrees
+//                             d   a
+// Stone-Wales (pyracylene) rotation of the arc u -> v.
+// Clockwise neighbour order before: u: [v, a, b], v: [u, c, d].
+// Clockwise neighbour order after:  u: [v, d, a], v: [u, b, c].
+
+/**
+ * @brief Checks whether the arc u -> v is the central bond of a pyracylene patch, i.e. the two faces sharing the bond are hexagons and the two faces at its ends are pentagons.
+ * @param FG The cubic graph of the isomer.
+ * @param u Source node of the arc.
+ * @param v Target node of the arc.
+ * @return True if a Stone-Wales rotation of the arc u -> v is possible.
+ */
+template <typename K, typename View>
+bool is_stone_wales_site(const DeviceCubicGraph<K, View> &FG, const K u, const K v)
+{
+    K b = FG.prev(u, v);
+    K d = FG.prev(v, u);
+    return FG.face_size(u, v) == 6 && FG.face_size(v, u) == 6 && FG.face_size(b, u) == 5 && FG.face_size(d, v) == 5;
+}
+
+/**
+ * @brief Applies one Stone-Wales rotation to every isomer in the parent batch and writes the resulting neighbouring isomers to the child batch.
+ *        The child inherits the optimised geometry of its parent, only the two atoms of the rotated bond are re-placed, by turning the bond 90 degrees about its midpoint in the tangent plane.
+ *        EMPTY parents and isomers without a pyracylene patch produce an EMPTY child.
+ * @param Q The queue to submit the kernel to.
+ * @param parents Batch of optimised isomers.
+ * @param children Batch to store the rotated isomers in, must have the same number of atoms and capacity as parents.
+ * @param site_offset Selects which of the eligible sites is rotated (modulo the number of sites), used to walk the different neighbours of an isomer.
+ */
+template <typename T, typename K, StoragePolicy S>
+void stone_wales_walk(sycl::queue &Q, IsomerBatch<T, K, S> &parents, IsomerBatch<T, K, S> &children, const size_t site_offset)
+{
+    TEMPLATE_TYPEDEFS(T, K);
+    assert(parents.N() == children.N() && parents.capacity() == children.capacity());
+    check_launch(Q.get_device(), parents.N(), parents.N() * (3 * sizeof(K) + sizeof(coord3d)) + scan_scratch_size(parents.N()) * sizeof(K), "stone_wales_walk");
+    Q.submit([&](sycl::handler &h)
+             {
+        auto N = parents.N();
+        sycl::local_accessor<K, 1> G(N * 3, h);
+        sycl::local_accessor<coord3d, 1> X(N, h);
+        sycl::local_accessor<K, 1> scan_scratch(scan_scratch_size(N), h);
+        auto parent_X_acc = parents.X.view(h, sycl::read_only);
+        auto parent_neighbours_acc = parents.cubic_neighbours.view(h, sycl::read_only);
+        auto parent_IDs_acc = parents.IDs.view(h, sycl::read_only);
+        auto parent_statuses_acc = parents.statuses.view(h, sycl::read_only);
+        auto X_acc = children.X.view(h, sycl::write_only, sycl::no_init);
+        auto neighbours_acc = children.cubic_neighbours.view(h, sycl::write_only, sycl::no_init);
+        auto IDs_acc = children.IDs.view(h, sycl::write_only, sycl::no_init);
+        auto iterations_acc = children.iterations.view(h, sycl::write_only, sycl::no_init);
+        auto statuses_acc = children.statuses.view(h, sycl::write_only, sycl::no_init);
+
+        h.parallel_for<class stone_wales>(sycl::nd_range(sycl::range{N * parents.capacity()}, sycl::range{N}), [=](sycl::nd_item<1> nditem) {
+            auto cta = nditem.get_group();
+            node_t u = nditem.get_local_linear_id();
+            auto bid = nditem.get_group_linear_id();
+            // EMPTY parents hold sentinel neighbours, their faces cannot be walked. The whole group leaves together, so no barrier is left waiting.
+            if (parent_statuses_acc[bid] == IsomerStatus::EMPTY)
+            {
+                for (int j = 0; j < 3; j++) neighbours_acc[bid * N * 3 + u * 3 + j] = std::numeric_limits<node_t>::max();
+                X_acc[bid * N + u] = coord3d{};
+                if (u == 0)
+                {
+                    IDs_acc[bid] = std::numeric_limits<size_t>::max();
+                    iterations_acc[bid] = 0;
+                    statuses_acc[bid] = IsomerStatus::EMPTY;
+                }
+                return;
+            }
+            const DeviceCubicGraph FG(parent_neighbours_acc, bid * N * 3);
+
+            for (int j = 0; j < 3; j++) G[u * 3 + j] = FG[u * 3 + j];
+            X[u] = parent_X_acc[bid * N + u];
+
+            // Each bond is considered once, from its smallest endpoint.
+            std::array<bool, 3> is_site = {false, false, false};
+            node_t site_count = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                node_t v = FG[u * 3 + j];
+                is_site[j] = u < v && is_stone_wales_site(FG, u, v);
+                if (is_site[j]) ++site_count;
+            }
+            node_t first_site = exclusive_scan<node_t>(cta, site_count, scan_scratch.get_pointer(), sycl::plus<node_t>{}, 0);
+            node_t n_sites = sycl::reduce_over_group(cta, site_count, sycl::plus<node_t>{});
+            coord3d centroid = {sycl::reduce_over_group(cta, X[u][0], sycl::plus<real_t>{}),
+                                sycl::reduce_over_group(cta, X[u][1], sycl::plus<real_t>{}),
+                                sycl::reduce_over_group(cta, X[u][2], sycl::plus<real_t>{})};
+            centroid /= (real_t)N;
+            sycl::group_barrier(cta);
+
+            node_t chosen = n_sites > 0 ? (node_t)(site_offset % n_sites) : std::numeric_limits<node_t>::max();
+            if (chosen >= first_site && chosen < first_site + site_count)
+            {
+                node_t k = first_site;
+                for (int j = 0; j < 3; j++)
+                {
+                    if (!is_site[j]) continue;
+                    if (k++ != chosen) continue;
+                    node_t v = G[u * 3 + j];
+                    int i = FG.dedge_ix(v, u);
+                    node_t a = G[u * 3 + (j + 1) % 3], b = G[u * 3 + (j + 2) % 3];
+                    node_t c = G[v * 3 + (i + 1) % 3], d = G[v * 3 + (i + 2) % 3];
+
+                    G[u * 3 + (j + 1) % 3] = d;
+                    G[u * 3 + (j + 2) % 3] = a;
+                    G[v * 3 + (i + 1) % 3] = b;
+                    G[v * 3 + (i + 2) % 3] = c;
+                    G[b * 3 + FG.dedge_ix(b, u)] = v;
+                    G[d * 3 + FG.dedge_ix(d, v)] = u;
+
+                    // Turn the bond 90 degrees about its midpoint in the plane tangent to the cage, u ends up between a and d.
+                    coord3d M = (X[u] + X[v]) / (real_t)2.;
+                    coord3d e = cross(unit_vector(M - centroid), X[v] - X[u]);
+                    if (dot(e, (X[a] + X[d]) / (real_t)2. - M) < (real_t)0.) e = -e;
+                    X[u] = M + e / (real_t)2.;
+                    X[v] = M - e / (real_t)2.;
+                }
+            }
+            sycl::group_barrier(cta);
+
+            for (int j = 0; j < 3; j++) neighbours_acc[bid * N * 3 + u * 3 + j] = G[u * 3 + j];
+            X_acc[bid * N + u] = X[u];
+            if (u == 0)
+            {
+                IDs_acc[bid] = parent_IDs_acc[bid];
+                iterations_acc[bid] = 0;
+                statuses_acc[bid] = n_sites > 0 ? IsomerStatus::NOT_CONVERGED : IsomerStatus::EMPTY;
+            }
+        }); });
+}
@@ -218,4 +218,22 @@ eigenvector3x3(real_t &lambda) const{
   
   std::array<coord3d,3> 
   mat() const { return {{{a,b,c},{b,d,e},{c,e,f}}}; }  
+
+  // Inverse of the matrix with every eigenvalue lambda replaced by max(|lambda|, relative_floor*max|lambda|).
+  // Positive definite also where the matrix is indefinite or near singular, as the diagonal hessian blocks of a distorted geometry are.
+  symMat3 positive_inverse(const real_t relative_floor) const {
+    auto [v, lambdas] = eigensystem();
+    real_t largest = 0;
+    for(int i=0;i<3;i++) largest = fabs(lambdas[i]) > largest? fabs(lambdas[i]) : largest;
+    if(largest == 0) return symMat3(1,0,0,1,0,1);
+
+    symMat3 P;
+    for(int i=0;i<3;i++){
+      real_t lambda = fabs(lambdas[i]) > relative_floor*largest? fabs(lambdas[i]) : relative_floor*largest;
+      real_t w = 1/lambda;
+      P.a += w*v[i][0]*v[i][0]; P.b += w*v[i][0]*v[i][1]; P.c += w*v[i][0]*v[i][2];
+      P.d += w*v[i][1]*v[i][1]; P.e += w*v[i][1]*v[i][2]; P.f += w*v[i][2]*v[i][2];
+    }
+    return P;
+  }
 };
@@ -0,0 +1,117 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <cmath>
+#include "telemetry.cpp"
+
+// Aggregates the telemetry files written by forcefield-opt --telemetry=<stride> into convergence histograms:
+// the iterations each isomer was sampled for, the fraction of isomers below the tolerance after a given number of iterations,
+// the gradient norm percentiles per iteration, and the step lengths chosen by the line search.
+
+//Prints one row of an ASCII histogram.
+void print_bar(const std::string &label, const size_t count, const size_t max_count)
+{
+    std::cout << std::setw(24) << label << " | " << std::setw(8) << count << " " << std::string(max_count ? 50 * count / max_count : 0, '#') << "\n";
+}
+
+template <typename T>
+T percentile(std::vector<T> values, const double p)
+{
+    if (values.empty()) return T(0);
+    size_t k = std::min(values.size() - 1, size_t(p * (values.size() - 1) + 0.5));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+template <typename T>
+void report(const std::vector<std::string> &paths, const double tolerance, const size_t n_bins)
+{
+    std::map<uint64_t, std::vector<TelemetrySample<T>>> isomers;
+    TelemetryHeader header;
+    for (auto &path : paths)
+        for (auto &sample : read_telemetry<T>(path, header)) isomers[sample.ID].push_back(sample);
+    if (isomers.empty())
+    {
+        std::cout << "No samples\n";
+        return;
+    }
+    const T N = header.N ? T(header.N) : T(1);
+    size_t n_samples = 0;
+    uint32_t max_iteration = 0;
+    for (auto &[ID, samples] : isomers)
+    {
+        std::sort(samples.begin(), samples.end(), [](auto &a, auto &b) { return a.iteration < b.iteration; });
+        max_iteration = std::max(max_iteration, samples.back().iteration);
+        n_samples += samples.size();
+    }
+    std::cout << isomers.size() << " isomers, " << n_samples << " samples, stride " << header.stride << ", N " << header.N << "\n\n";
+
+    //Last sampled iteration, within one stride of the iterations the isomer needed.
+    size_t bin_width = std::max<size_t>(1, (max_iteration + n_bins) / n_bins);
+    std::vector<size_t> bins(n_bins, 0);
+    for (auto &[ID, samples] : isomers) bins[std::min(n_bins - 1, samples.back().iteration / bin_width)]++;
+    std::cout << "Iterations sampled per isomer:\n";
+    for (size_t b = 0; b < n_bins; b++)
+        print_bar("[" + std::to_string(b * bin_width) + ", " + std::to_string((b + 1) * bin_width) + ")", bins[b], *std::max_element(bins.begin(), bins.end()));
+
+    //For every iteration bucket: the gradient norm / N distribution of the isomers still running, and how many of all isomers are below the tolerance.
+    std::cout << "\nGradient norm / N by iteration, percentiles over the isomers still running:\n";
+    std::cout << std::setw(24) << "iteration" << " | " << std::setw(12) << "median" << std::setw(12) << "p90" << std::setw(12) << "converged" << "\n";
+    for (size_t b = 0; b < n_bins; b++)
+    {
+        uint32_t iteration = b * bin_width;
+        std::vector<T> norms;
+        size_t converged = 0;
+        for (auto &[ID, samples] : isomers)
+        {
+            //Latest sample at or before this iteration.
+            auto it = std::upper_bound(samples.begin(), samples.end(), iteration, [](uint32_t i, auto &s) { return i < s.iteration; });
+            if (it == samples.begin()) continue;
+            T norm = std::prev(it)->gradient_norm / N;
+            converged += norm < tolerance;
+            if (it != samples.end()) norms.push_back(norm);
+        }
+        std::cout << std::setw(24) << iteration << " | " << std::setw(12) << percentile(norms, 0.5) << std::setw(12) << percentile(norms, 0.9) << std::setw(11) << std::fixed << std::setprecision(1) << 100.0 * converged / isomers.size() << "%" << std::defaultfloat << std::setprecision(6) << "\n";
+    }
+
+    //Step lengths, alpha lies in [0, 1] and 0 means the line search failed.
+    std::vector<size_t> alpha_bins(n_bins + 1, 0);
+    for (auto &[ID, samples] : isomers)
+        for (auto &sample : samples) alpha_bins[sample.alpha <= T(0) ? 0 : 1 + std::min(n_bins - 1, size_t(sample.alpha * n_bins))]++;
+    std::cout << "\nLine search step length:\n";
+    size_t max_count = *std::max_element(alpha_bins.begin(), alpha_bins.end());
+    print_bar("failed", alpha_bins[0], max_count);
+    for (size_t b = 0; b < n_bins; b++)
+    {
+        std::ostringstream label;
+        label << std::setprecision(3) << "(" << double(b) / n_bins << ", " << double(b + 1) / n_bins << "]";
+        print_bar(label.str(), alpha_bins[b + 1], max_count);
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    std::vector<std::string> paths;
+    double tolerance = 1e-3;
+    size_t n_bins = 20;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--tolerance=", 0) == 0) tolerance = std::stod(arg.substr(12));
+        else if (arg.rfind("--bins=", 0) == 0) n_bins = std::max(1, std::stoi(arg.substr(7)));
+        else paths.push_back(arg);
+    }
+    if (paths.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " <telemetry file>... [--tolerance=1e-3] [--bins=20]\n";
+        return 1;
+    }
+    TelemetryHeader header;
+    std::ifstream(paths[0], std::ios::binary).read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (header.real_width == sizeof(double)) report<double>(paths, tolerance, n_bins);
+    else report<float>(paths, tolerance, n_bins);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+// Per-iteration convergence telemetry of the CG optimiser.
+// Every isomer slot owns a ring of `depth` samples on the device, every stride'th iteration work-item 0 of the group writes one sample into it.
+// The host drains the rings between launches and appends the samples to a file, which telemetry-histogram.cpp turns into histograms.
+// File layout: TelemetryHeader | samples.
+
+constexpr char TELEMETRY_MAGIC[8] = {'I', 'S', 'O', 'T', 'E', 'L', '0', '1'};
+
+struct TelemetryHeader
+{
+    char magic[8];
+    uint32_t real_width; //sizeof(T)
+    uint32_t stride;     //Iterations between samples
+    uint32_t depth;      //Samples per ring, a slot that takes more than stride * depth iterations in one launch loses its oldest samples
+    uint32_t N;          //Atoms per isomer
+};
+
+template <typename T>
+struct TelemetrySample
+{
+    uint64_t ID;
+    uint32_t iteration; //Total CG iterations of the isomer when the sample was taken
+    T energy;           //Energy at the start of the iteration
+    T gradient_norm;    //Gradient norm at the start of the iteration
+    T alpha;            //Step length found by the line search, 0 if it failed
+};
+
+//Device side handle to the ring of one isomer. A default constructed view records nothing.
+template <typename T>
+struct TelemetryView
+{
+    TelemetrySample<T> *samples = nullptr; //The ring of this isomer
+    uint32_t *count = nullptr;             //Samples written to the ring since the last drain
+    uint64_t ID = 0;
+    uint32_t iteration_offset = 0;         //Iterations done in earlier launches
+    uint32_t stride = 0, depth = 0;
+
+    //Called by a single work-item per isomer.
+    void record(const size_t iteration, const T energy, const T gradient_norm, const T alpha) const
+    {
+        if (stride == 0 || iteration % stride != 0) return;
+        samples[*count % depth] = TelemetrySample<T>{ID, uint32_t(iteration_offset + iteration), energy, gradient_norm, alpha};
+        ++*count;
+    }
+};
+
+/**
+ * @brief Device side rings of telemetry samples for every slot of a batch, and the file they are drained to.
+ *        Constructed with stride 0 the telemetry is disabled: the kernels skip it and drain() does nothing.
+ */
+template <typename T>
+struct Telemetry
+{
+    /**
+     * @param capacity Slots in the batch being optimised.
+     * @param stride Iterations between samples, 0 disables the telemetry.
+     * @param depth Samples kept per slot between two drains.
+     * @param N Atoms per isomer, stored in the file so that gradient norms can be normalised.
+     * @param path File the samples are appended to, ignored when disabled.
+     */
+    Telemetry(const size_t capacity, const uint32_t stride, const uint32_t depth, const uint32_t N = 0, const std::string &path = "")
+        : stride(stride), depth(stride ? depth : 0),
+          samples(sycl::range<1>(std::max<size_t>(1, stride ? capacity * depth : 0))),
+          counts(sycl::range<1>(std::max<size_t>(1, stride ? capacity : 0)))
+    {
+        if (stride == 0) return;
+        sycl::host_accessor counts_acc(counts, sycl::write_only, sycl::no_init);
+        for (size_t i = 0; i < counts.size(); i++) counts_acc[i] = 0;
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Telemetry: cannot open " + path);
+        TelemetryHeader header;
+        std::memcpy(header.magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+        header.real_width = sizeof(T);
+        header.stride = stride;
+        header.depth = depth;
+        header.N = N;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+
+    bool enabled() const { return stride > 0; }
+
+    //Appends the samples in every ring to the file, oldest first, and empties the rings. Must be called before a slot is handed to a new isomer.
+    void drain()
+    {
+        if (!enabled()) return;
+        sycl::host_accessor samples_acc(samples, sycl::read_only);
+        sycl::host_accessor counts_acc(counts);
+        for (size_t slot = 0; slot < counts.size(); slot++)
+        {
+            uint32_t count = counts_acc[slot], n = std::min(count, depth);
+            for (uint32_t i = count - n; i < count; i++)
+                file.write(reinterpret_cast<const char *>(&samples_acc[slot * depth + i % depth]), sizeof(TelemetrySample<T>));
+            counts_acc[slot] = 0;
+        }
+        file.flush();
+    }
+
+    const uint32_t stride, depth;
+    sycl::buffer<TelemetrySample<T>, 1> samples;
+    sycl::buffer<uint32_t, 1> counts;
+
+  private:
+    std::ofstream file;
+};
+
+//Reads a telemetry file written by Telemetry<T>.
+template <typename T>
+std::vector<TelemetrySample<T>> read_telemetry(const std::string &path, TelemetryHeader &header)
+{
+    std::ifstream file(path, std::ios::binary);
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC)) != 0) throw std::runtime_error("read_telemetry: " + path + " is not a telemetry file");
+    if (header.real_width != sizeof(T)) throw std::runtime_error("read_telemetry: " + path + " stores " + std::to_string(header.real_width) + " byte reals");
+    std::vector<TelemetrySample<T>> samples;
+    TelemetrySample<T> sample;
+    while (file.read(reinterpret_cast<char *>(&sample), sizeof(sample))) samples.push_back(sample);
+    return samples;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <CL/sycl.hpp>
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+// Caching allocator for USM. Freed blocks are kept on a free list per size class and handed out again, so that batches and kernel scratch
+// which are created and destroyed over and over (one batch per N in a sweep, scratch per launch) stop paying for malloc_device / malloc_host.
+// Size classes are powers of two split into four steps, so a block is at most 25% larger than requested.
+// Like sycl::free, deallocate() does not wait: the caller must make sure no kernel still uses the block.
+
+struct UsmPoolStats
+{
+    size_t current_bytes = 0; //Bytes handed out and not yet returned, counted by size class
+    size_t peak_bytes = 0;    //Highest current_bytes so far
+    size_t cached_bytes = 0;  //Bytes held on the free lists
+    size_t allocations = 0;   //Calls to allocate()
+    size_t reuses = 0;        //Allocations served from a free list
+};
+
+struct UsmPool
+{
+    UsmPool(const sycl::device &device, const sycl::context &context) : device(device), context(context) {}
+    UsmPool(const UsmPool &) = delete;
+    UsmPool &operator=(const UsmPool &) = delete;
+    ~UsmPool() { release(); }
+
+    //The pool shared by every queue on the device and context of Q.
+    //Pools are never destroyed: their blocks would otherwise be freed during static destruction, after the runtime may have shut down.
+    static UsmPool &get(const sycl::queue &Q)
+    {
+        static std::mutex registry_mutex;
+        static auto *registry = new std::vector<std::unique_ptr<UsmPool>>();
+        std::lock_guard lock(registry_mutex);
+        auto device = Q.get_device();
+        auto context = Q.get_context();
+        for (auto &pool : *registry)
+            if (pool->device == device && pool->context == context) return *pool;
+        registry->push_back(std::make_unique<UsmPool>(device, context));
+        return *registry->back();
+    }
+
+    //Allocates room for n elements of U of the given kind.
+    template <typename U>
+    U *allocate(const size_t n, const sycl::usm::alloc kind) { return static_cast<U *>(allocate_bytes(n * sizeof(U), kind)); }
+
+    void *allocate_bytes(const size_t bytes, const sycl::usm::alloc kind)
+    {
+        size_t size = size_class(bytes);
+        std::lock_guard lock(mutex);
+        stats.allocations++;
+        void *ptr = nullptr;
+        auto &list = free_lists[{kind, size}];
+        if (!list.empty())
+        {
+            ptr = list.back();
+            list.pop_back();
+            stats.cached_bytes -= size;
+            stats.reuses++;
+        }
+        else
+        {
+            ptr = sycl::malloc(size, device, context, kind);
+            // Out of memory with blocks cached: give them back to the runtime and try once more.
+            if (!ptr && stats.cached_bytes > 0)
+            {
+                release_locked();
+                ptr = sycl::malloc(size, device, context, kind);
+            }
+            if (!ptr) throw sycl::exception(sycl::make_error_code(sycl::errc::memory_allocation), "UsmPool: cannot allocate " + std::to_string(size) + " bytes");
+        }
+        live[ptr] = {kind, size};
+        stats.current_bytes += size;
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.current_bytes);
+        return ptr;
+    }
+
+    //Returns a block to its free list. Null pointers are ignored.
+    void deallocate(void *ptr)
+    {
+        if (!ptr) return;
+        std::lock_guard lock(mutex);
+        auto it = live.find(ptr);
+        assert(it != live.end() && "UsmPool: pointer was not allocated by this pool");
+        free_lists[it->second].push_back(ptr);
+        stats.current_bytes -= it->second.second;
+        stats.cached_bytes += it->second.second;
+        live.erase(it);
+    }
+
+    //Frees every cached block, blocks that are handed out are not affected.
+    void release()
+    {
+        std::lock_guard lock(mutex);
+        release_locked();
+    }
+
+    UsmPoolStats statistics()
+    {
+        std::lock_guard lock(mutex);
+        return stats;
+    }
+
+    //Smallest size class holding bytes: 256 bytes at least, then 4 steps per power of two.
+    static size_t size_class(const size_t bytes)
+    {
+        size_t size = 256;
+        while (size < bytes) size <<= 1;
+        if (size <= 256) return size;
+        size_t step = size / 8; // size / 2 .. size in four steps of size / 8
+        return size / 2 + (bytes - size / 2 + step - 1) / step * step;
+    }
+
+  private:
+    using Key = std::pair<sycl::usm::alloc, size_t>;
+    sycl::device device;
+    sycl::context context;
+    std::mutex mutex;
+    std::map<Key, std::vector<void *>> free_lists;
+    std::unordered_map<void *, Key> live;
+    UsmPoolStats stats;
+
+    void release_locked()
+    {
+        for (auto &[key, list] : free_lists)
+            for (void *ptr : list) sycl::free(ptr, context);
+        free_lists.clear();
+        stats.cached_bytes = 0;
+    }
+};
+
+//Allocates n elements of U from the pool of Q.
+template <typename U>
+U *pool_malloc(const size_t n, const sycl::queue &Q, const sycl::usm::alloc kind = sycl::usm::alloc::device)
+{
+    return UsmPool::get(Q).allocate<U>(n, kind);
+}
+
+//Returns memory from pool_malloc to the pool of Q.
+inline void pool_free(void *ptr, const sycl::queue &Q) { UsmPool::get(Q).deallocate(ptr); }
+
+//Hands ownership of pooled memory to a shared_ptr which, when released, waits for *done before returning the memory to the pool of Q.
+//Set *done to the event of the command using the memory once it is submitted. A default constructed event completes immediately.
+inline std::shared_ptr<void> pool_hold(void *ptr, const sycl::queue &Q, std::shared_ptr<sycl::event> done)
+{
+    return std::shared_ptr<void>(ptr, [Q, done](void *p)
+                                 {
+        done->wait();
+        pool_free(p, Q); });
+}
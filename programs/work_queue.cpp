@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue, the hand-off between the reader, queue and writer threads.
+ *        Every cell carries a sequence number that tells producers and consumers whose turn it is (D. Vyukov's bounded MPMC queue),
+ *        so neither side ever takes a lock and a stalled thread cannot block the others.
+ *        The capacity is the back-pressure: with one element per batch in flight, a producer that runs ahead of the device blocks in push().
+ *        Blocking calls spin briefly and then back off to short sleeps, the waits they cover (a launch, a file read) are far longer than the hand-off itself.
+ */
+template <typename T>
+struct BoundedQueue
+{
+    //capacity is rounded up to a power of two.
+    explicit BoundedQueue(const size_t capacity) : cells(round_up(capacity)), mask(cells.size() - 1)
+    {
+        for (size_t i = 0; i < cells.size(); i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    //Returns false if the queue is full.
+    bool try_push(const T &value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position)
+            {
+                if (!tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) continue;
+                cell.value = value;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+            if (sequence < position) return false;
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    //Returns false if the queue is empty.
+    bool try_pop(T &value)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position + 1)
+            {
+                if (!head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) continue;
+                value = cell.value;
+                cell.sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+            }
+            if (sequence < position + 1) return false;
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    //Blocks while the queue is full.
+    void push(const T &value)
+    {
+        for (Backoff backoff; !try_push(value); backoff.wait()) {}
+    }
+
+    //Blocks while the queue is empty. Returns nothing once the queue is closed and drained.
+    std::optional<T> pop()
+    {
+        T value;
+        for (Backoff backoff;; backoff.wait())
+        {
+            if (try_pop(value)) return value;
+            //Elements pushed before close() are still handed out.
+            if (closed.load(std::memory_order_acquire)) return try_pop(value) ? std::optional<T>(value) : std::nullopt;
+        }
+    }
+
+    //Wakes the consumers blocked in pop() for good once the queue is empty. Pushing after close() is not allowed.
+    void close() { closed.store(true, std::memory_order_release); }
+
+    size_t capacity() const { return cells.size(); }
+
+  private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    //Head and tail on their own cache lines, producers and consumers would otherwise invalidate each other's.
+    std::vector<Cell> cells;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+
+    static size_t round_up(const size_t n)
+    {
+        size_t p = 1;
+        while (p < std::max<size_t>(n, 1)) p <<= 1;
+        return p;
+    }
+
+    struct Backoff
+    {
+        int round = 0;
+        void wait()
+        {
+            if (round < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(std::min(1 << std::min(round - 64, 8), 200)));
+            round++;
+        }
+    };
+};
@@ -0,0 +1,44 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+
+#include "../programs/forcefield.cpp"
+#include "test_fullerenes.cpp"
+
+// CG iterations to convergence for C20, C60 and C180 (the leapfrogs of C20) from their Tutte starting geometries.
+// The CG variant is a compile-time mode, so this benchmark is built twice, see CMakeLists.txt:
+// cg-iterations-benchmark runs the plain CG, cg-iterations-benchmark-block-jacobi the block-Jacobi preconditioned CG.
+// Both start from the same geometries, comparing their output shows what the preconditioner saves.
+// Usage: cg-iterations-benchmark [tolerance]
+
+int main(int argc, char const *argv[])
+{
+    TEMPLATE_TYPEDEFS(float, uint16_t);
+    real_t tolerance = argc > 1 ? std::stof(argv[1]) : 1e-3f;
+    sycl::queue Q(sycl::gpu_selector_v, sycl::property::queue::in_order());
+    std::cout << "BLOCK_JACOBI_INTERVAL " << BLOCK_JACOBI_INTERVAL << ", LINE_SEARCH_POINTS " << LINE_SEARCH_POINTS << ", tolerance " << tolerance << "\n";
+    std::cout << std::setw(8) << "N" << std::setw(12) << "status" << std::setw(12) << "iterations" << std::setw(16) << "energy" << "\n";
+
+    std::vector<node_t> graph = C20_graph<node_t>();
+    int failures = 0;
+    for (int k = 0; k < 3; k++, graph = leapfrog(graph))
+    {
+        int N = graph.size() / 3;
+        if (!fits_launch(Q.get_device(), N, forcefield_local_bytes<real_t>(N))) break;
+        IsomerBatch<real_t, node_t> B(N, 1, Q);
+        load_isomers(Q, B, graph);
+        forcefield_optimise<PEDERSEN>(Q, B, 20 * N, 20 * N, tolerance);
+        sycl::buffer<real_t, 1> energies{sycl::range<1>(1)};
+        forcefield_energies<PEDERSEN>(Q, B, energies);
+        size_t iterations;
+        IsomerStatus status;
+        copy(&iterations, B.iterations);
+        copy(&status, B.statuses);
+        sycl::host_accessor energy(energies, sycl::read_only);
+        std::cout << std::setw(8) << N << std::setw(12) << (status == IsomerStatus::CONVERGED ? "CONVERGED" : "FAILED") << std::setw(12) << iterations << std::setw(16) << energy[0] << "\n";
+        failures += status != IsomerStatus::CONVERGED;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -10,125 +10,65 @@
 
 using namespace cl::sycl;
 
-enum class IsomerStatus {EMPTY, CONVERGED, PLZ_CHECK, FAILED, NOT_CONVERGED};
-enum BatchMember {COORDS3D, COORDS2D, CUBIC_NEIGHBOURS, DUAL_NEIGHBOURS, FACE_DEGREES, IDS, ITERATIONS, STATUSES};
-enum SortOrder {ASCENDING, DESCENDING};
-enum class LaunchPolicy {SYNC, ASYNC};
-enum Device   {CPU, GPU};
-
-template<typename T, typename K>
-struct IsomerBatch
-{ 
-    //template typename T::LaunchCtx LaunchCtx;
-    int isomer_capacity = 0;
-    bool allocated = false;
-    size_t n_atoms = 0;
-    size_t n_faces = 0;
-    size_t n_isomers = 0;
-    T* X;
-    T* xys;
-
-    K* cubic_neighbours;
-    K* dual_neighbours;
-    K* face_degrees;
-
-    size_t* IDs;
-    size_t* iterations;
-    IsomerStatus* statuses;
-    std::vector<std::tuple<std::string,void**,size_t,bool>> pointers;
-
-    IsomerBatch(){
-      pointers =   {{"cubic_neighbours",(void**)&cubic_neighbours, sizeof(K)*3, true}, {"dual_neighbours", (void**)&dual_neighbours, sizeof(K)*4, true}, {"face_degrees", (void**)&face_degrees, sizeof(K)*1, true}, {"X", (void**)&X, sizeof(T)*3, true}, {"xys", (void**)&xys, sizeof(T)*2, true}, {"statuses", (void**)&statuses, sizeof(IsomerStatus), false}, {"IDs", (void**)&IDs, sizeof(size_t), false}, {"iterations", (void**)&iterations, sizeof(size_t), false}};
-    }
-
-    void operator=(const IsomerBatch &);
-
-    ~IsomerBatch();
-    IsomerBatch(size_t n_atoms, size_t n_isomers, cl::sycl::queue& Q);
-    //void set_print_simple() {verbose = false;} 
-    //void set_print_verbose() {verbose = true;} 
-    //bool get_print_mode() const {return verbose;}
-    ////Prints a specific parameter from the batch
-    //void print(const BatchMember param, const std::pair<int,int>& range = {-1,-1}); 
-    //int size() const {return m_size;}
-    //int capacity() const {return isomer_capacity;}
-//
-    //std::vector<size_t> find_ids(const IsomerStatus status); //Returns a vector of IDs with a given status
-    //void shrink_to_fit();        
-//
-    //void clear(sycl::queue& Q, const LaunchPolicy = LaunchPolicy::SYNC);                 //Clears the batch and resets the size to 0
-    //bool operator==(const IsomerBatch& b); //Returns true if the two batches are equal
-    //bool operator!=(const IsomerBatch& b) {return !(*this == b);}
-    ////friend std::ostream& operator<<(std::ostream& os, const IsomerBatch& a); //Prints the batch to the given stream
-
-  private:
-    int m_size = 0;
-    cl::sycl::context ctx;
-    bool verbose = false;
-
-};
-
-using std::get;
-
-template<typename T, typename K>
-IsomerBatch<T,K>::IsomerBatch(size_t n_atoms, size_t n_isomers, cl::sycl::queue& Q){
-    TEMPLATE_TYPEDEFS(T,K);
-    this->n_atoms          = n_atoms;
-    this->isomer_capacity  = n_isomers;
-    this->n_faces          = n_atoms/2 + 2;
-    this->ctx            =  Q.get_context();
-    pointers =   {{"cubic_neighbours",(void**)&cubic_neighbours, sizeof(node_t)*n_atoms*3, true}, {"dual_neighbours", (void**)&dual_neighbours, sizeof(node_t) * (n_atoms/2 +2) * 6, true}, {"face_degrees", (void**)&face_degrees, sizeof(node_t)*(n_atoms/2 +2), true},{"X", (void**)&X, sizeof(real_t)*n_atoms*3, true}, {"xys", (void**)&xys, sizeof(real_t)*n_atoms*2, true}, {"statuses", (void**)&statuses, sizeof(IsomerStatus), false}, {"IDs", (void**)&IDs, sizeof(size_t), false}, {"iterations", (void**)&iterations, sizeof(size_t), false}};
-    if (!Q.is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            std::cout << "Allocating " << isomer_capacity * get<2>(pointers[i]) << " bytes of device memory for " << get<0>(pointers[i]) << std::endl;
-            *get<1>(pointers[i]) = cl::sycl::malloc_device(n_isomers * get<2>(pointers[i]), Q); 
-            Q.memset(*get<1>(pointers[i]),0,n_isomers*get<2>(pointers[i]));
-            auto device = get_pointer_device(*get<1>(pointers[i]), Q.get_context());
-            std::cout << "Allocated on device: " << device.get_info<info::device::name>() << std::endl;
-        }
-    } else if(Q.is_host()){
-        for (size_t i = 0; i < pointers.size(); i++) {
-            //For asynchronous memory transfers host memory must be pinned.
-            *get<1>(pointers[i]) = cl::sycl::malloc_host(n_isomers * get<2>(pointers[i]), Q); 
-            Q.memset(*get<1>(pointers[i]),0, n_isomers*get<2>(pointers[i]));
-        }
-    }
-    Q.wait_and_throw();
-    allocated = true;
-}
-
-template<typename T, typename K>
-IsomerBatch<T,K>::~IsomerBatch(){
-    if (allocated == true);
-    {
-        for (size_t i = 0; i < pointers.size(); i++) {
-            auto device = get_pointer_device(*get<1>(pointers[i]), ctx);
-            std::cout << "Attempting to free ptr: "<< i << ": "<< get<0>(pointers[i]) << " " << device.get_info<info::device::name>() << std::endl;
-            //cl::sycl::free(*get<1>(pointers[i]), ctx);
-
-        }
-    }
-    allocated = false;
-}
-
+#include "../programs/isomer_batch.cpp"
+#include "test_fullerenes.cpp"
 
 int main(int argc, char const *argv[])
 {
 
     queue Q(gpu_selector{}, property::queue::in_order());
-    IsomerBatch<float, int> batch(20, 1, Q);
+    IsomerBatch<float, int, StoragePolicy::USM_DEVICE> batch(20, 1, Q);
     /* code */
     //Q.wait_and_throw();
 //
     Q.submit([&](handler &h) {
         // Create a command group to issue GPU work.
+        auto X = batch.X.view(h, read_only);
         h.parallel_for<class hello_world>(nd_range(range{1}, range{1}), [=](nd_item<1> idx) {
-            printf("Hello World from GPU thread %e!\n", batch.X[0]);
+            printf("Hello World from GPU thread %e!\n", X[0][0]);
 
         });
     });
 //
     Q.wait_and_throw();
 
-    return 0;
+    //Lifecycle: growing, shrinking and clearing only reallocate when the capacity changes.
+    TestChecks check;
+    batch.resize(Q, 1);
+    batch.resize(Q, 100);
+    check(batch.size() == 100 && batch.capacity() == 100, "resize(100) gives size 100, capacity 100");
+    batch.resize(Q, 10);
+    check(batch.size() == 10 && batch.capacity() == 100, "resize(10) keeps capacity 100");
+    batch.shrink_to_fit(Q);
+    check(batch.size() == 10 && batch.capacity() == 10, "shrink_to_fit gives size 10, capacity 10");
+
+    IsomerBatch<float, int, StoragePolicy::USM_DEVICE> copied(20, 1, Q);
+    copy(Q, copied, batch);
+    check(copied.size() == 10 && copied.capacity() == 10, "copy reserves the capacity of the original");
+    check(copied == batch, "copy equal to original");
+    check(batch.find_ids(IsomerStatus::EMPTY).size() == 10, "all 10 isomers EMPTY");
+
+    IsomerBatch<float, int, StoragePolicy::USM_DEVICE> moved(std::move(copied));
+    check(!copied.allocated && copied.capacity() == 0, "moved-from batch released");
+    check(moved == batch, "moved-to batch equal to original");
+    moved.clear(Q);
+    check(moved.size() == 0 && moved.capacity() == 10, "clear gives size 0, capacity 10");
+
+    //Repeated construction must not grow the memory footprint: every batch returns its blocks to the pool, and the next one reuses them.
+    auto &pool = UsmPool::get(Q);
+    size_t start_bytes = pool.statistics().current_bytes, footprint;
+    {
+        IsomerBatch<float, int, StoragePolicy::USM_DEVICE> temporary(200, 100, Q);
+        footprint = pool.statistics().current_bytes - start_bytes;
+    }
+    auto before = pool.statistics();
+    for (int i = 0; i < 1000; i++) {
+        IsomerBatch<float, int, StoragePolicy::USM_DEVICE> temporary(200, 100, Q);
+    }
+    auto after = pool.statistics();
+    check(footprint > 0, "a batch allocates from the pool");
+    check(after.current_bytes == start_bytes, "1000 batches return every byte to the pool");
+    check(after.peak_bytes <= std::max(before.peak_bytes, start_bytes + footprint), "1000 batches peak within one batch's footprint");
+
+    return check.result();
 }
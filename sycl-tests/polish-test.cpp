@@ -0,0 +1,53 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include "../programs/forcefield.cpp"
+#include "test_fullerenes.cpp"
+
+// Optimises C60 in float and polishes it with the double precision Newton stage of polish. Every isomer must reach the double
+// tolerance within the few Newton steps it is given, which it only does if the forcefield hessian is right, and must not gain energy.
+// Usage: polish-test [capacity]
+
+int main(int argc, char const *argv[])
+{
+    TEMPLATE_TYPEDEFS(float, uint16_t);
+    size_t capacity = argc > 1 ? std::stoi(argv[1]) : 4;
+    sycl::queue Q(sycl::gpu_selector_v, sycl::property::queue::in_order());
+    std::vector<node_t> graph = leapfrog(C20_graph<node_t>());
+    int N = graph.size() / 3;
+    const size_t newton_steps = 20;
+
+    IsomerBatch<real_t, node_t> B(N, capacity, Q);
+    IsomerBatch<double, node_t> P(N, capacity, Q);
+    load_isomers(Q, B, graph);
+    forcefield_optimise<PEDERSEN>(Q, B, 10 * N, 10 * N);
+    polish<PEDERSEN>(Q, B, P, newton_steps, 1e-6).wait();
+
+    sycl::buffer<real_t, 1> float_energies{sycl::range<1>(capacity)};
+    sycl::buffer<double, 1> double_energies{sycl::range<1>(capacity)};
+    forcefield_energies<PEDERSEN>(Q, B, float_energies);
+    forcefield_energies<PEDERSEN>(Q, P, double_energies);
+    std::vector<size_t> float_iterations(capacity), iterations(capacity);
+    std::vector<IsomerStatus> float_statuses(capacity), statuses(capacity);
+    copy(float_iterations.data(), B.iterations);
+    copy(iterations.data(), P.iterations);
+    copy(float_statuses.data(), B.statuses);
+    copy(statuses.data(), P.statuses);
+    sycl::host_accessor E_float(float_energies, sycl::read_only);
+    sycl::host_accessor E_double(double_energies, sycl::read_only);
+
+    TestChecks check;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        std::string isomer = "isomer " + std::to_string(i) + ": ";
+        size_t steps = iterations[i] - float_iterations[i];
+        std::cout << isomer << "float energy " << E_float[i] << " after " << float_iterations[i] << " iterations, double energy " << E_double[i] << " after " << steps << " Newton steps\n";
+        check(float_statuses[i] == IsomerStatus::CONVERGED, isomer + "converged in float");
+        check(statuses[i] == IsomerStatus::CONVERGED && steps < newton_steps, isomer + "polished to 1e-6 within " + std::to_string(newton_steps) + " Newton steps");
+        check(E_double[i] <= E_float[i] + 1e-4 * std::abs(E_float[i]), isomer + "polishing does not raise the energy");
+    }
+    return check.result();
+}
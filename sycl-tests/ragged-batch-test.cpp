@@ -0,0 +1,89 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <tuple>
+#include <cmath>
+
+#include "../programs/forcefield.cpp"
+#include "test_fullerenes.cpp"
+
+// Packs C20 and C60 into one ragged batch, optimises it in a single launch per batch with forcefield_optimise_ragged, unpacks it
+// and compares every isomer with the same starting geometry optimised per size by forcefield_optimise.
+// Also checks that bucket_by_size separates the two sizes by default and merges them when any fraction of idle work-items is allowed.
+// Usage: ragged-batch-test
+
+//Energies, iterations, statuses and IDs of the slots of a batch.
+template <typename T, typename K>
+struct Outcome
+{
+    std::vector<T> energies;
+    std::vector<size_t> iterations, IDs;
+    std::vector<IsomerStatus> statuses;
+
+    Outcome(sycl::queue &Q, IsomerBatch<T, K> &B) : energies(B.capacity()), iterations(B.capacity()), IDs(B.capacity()), statuses(B.capacity())
+    {
+        sycl::buffer<T, 1> E{sycl::range<1>(B.capacity())};
+        forcefield_energies<PEDERSEN>(Q, B, E);
+        sycl::host_accessor E_acc(E, sycl::read_only);
+        for (size_t i = 0; i < B.capacity(); i++) energies[i] = E_acc[i];
+        copy(iterations.data(), B.iterations);
+        copy(IDs.data(), B.IDs);
+        copy(statuses.data(), B.statuses);
+    }
+};
+
+int main()
+{
+    TEMPLATE_TYPEDEFS(float, uint16_t);
+    DeviceScheduler scheduler;
+    sycl::queue &Q = scheduler.queue(0);
+    TestChecks check;
+
+    std::vector<size_t> mixed = {20, 60, 20, 60, 20};
+    auto buckets = bucket_by_size(mixed);
+    check(buckets == std::vector<std::vector<size_t>>{{0, 2, 4}, {1, 3}}, "bucket_by_size separates C20 and C60");
+    buckets = bucket_by_size(mixed, 1.0);
+    check(buckets == std::vector<std::vector<size_t>>{{0, 2, 4, 1, 3}}, "bucket_by_size with max_idle 1 keeps one bucket");
+
+    std::vector<node_t> small_graph = C20_graph<node_t>(), large_graph = leapfrog(small_graph);
+    IsomerBatch<real_t, node_t> small(20, 3, Q), large(60, 2, Q), small_reference(20, 3, Q), large_reference(60, 2, Q);
+    load_isomers(Q, small, small_graph);
+    load_isomers(Q, large, large_graph);
+    copy(Q, small_reference, small);
+    copy(Q, large_reference, large);
+
+    // Slots in the order of the bucket: three C20 followed by two C60.
+    std::vector<size_t> sizes;
+    for (auto i : buckets[0]) sizes.push_back(mixed[i]);
+    std::vector<RaggedBatch<real_t, node_t>> ragged;
+    ragged.emplace_back(sizes);
+    check(ragged[0].capacity() == 5 && ragged[0].total_atoms() == 180 && ragged[0].max_N() == 60 && ragged[0].offset(3) == 60, "ragged layout");
+    pack(Q, ragged[0], 0, small, 3);
+    pack(Q, ragged[0], 3, large, 2);
+    Q.wait_and_throw();
+
+    forcefield_optimise_ragged<PEDERSEN>(scheduler, ragged, 10 * 60);
+    forcefield_optimise<PEDERSEN>(Q, small_reference, 10 * 60, 10 * 60);
+    forcefield_optimise<PEDERSEN>(Q, large_reference, 10 * 60, 10 * 60);
+
+    unpack(Q, small, ragged[0], 0, 3);
+    unpack(Q, large, ragged[0], 3, 2);
+    Q.wait_and_throw();
+
+    for (auto [B, reference, name] : {std::make_tuple(&small, &small_reference, std::string("C20")), std::make_tuple(&large, &large_reference, std::string("C60"))})
+    {
+        Outcome<real_t, node_t> got(Q, *B), want(Q, *reference);
+        for (size_t i = 0; i < B->capacity(); i++)
+        {
+            std::string isomer = name + " isomer " + std::to_string(i) + ": ";
+            std::cout << isomer << "ragged " << got.energies[i] << " after " << got.iterations[i] << " iterations, per size " << want.energies[i] << " after " << want.iterations[i] << " iterations\n";
+            check(got.IDs[i] == i, isomer + "ID survives pack and unpack");
+            check(got.statuses[i] == IsomerStatus::CONVERGED && want.statuses[i] == IsomerStatus::CONVERGED, isomer + "both converged");
+            check(std::abs(got.energies[i] - want.energies[i]) <= 1e-3 * std::abs(want.energies[i]), isomer + "energies agree to 1e-3");
+            double iteration_ratio = double(got.iterations[i]) / double(std::max<size_t>(1, want.iterations[i]));
+            check(iteration_ratio > 0.8 && iteration_ratio < 1.25, isomer + "iteration counts agree to 25%");
+        }
+    }
+    return check.result();
+}
@@ -0,0 +1,103 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cmath>
+
+using namespace cl::sycl;
+
+#include "../programs/reductions.cpp"
+#include "../programs/util.cpp"
+
+// Cost and accuracy of the work-group reductions behind custom_reduce, for each DETERMINISTIC_REDUCTION mode:
+// 0 = sub-group shuffles (custom_reduce as compiled by default, tree_reduce under nvc++, see SUBGROUP_SHUFFLES), 1 = tree_reduce, 2 = compensated_sum.
+// Every work-group reduces three values per round, like the fused reductions in the CG loop, for a number of rounds per launch.
+// The error is measured against a double precision host sum of the same values.
+// Usage: reduction-benchmark [N] [groups] [rounds] [repetitions]
+
+template <int Mode> class reduce_kernel;
+
+using clock_type = std::chrono::steady_clock;
+inline double elapsed_us(clock_type::time_point start) { return std::chrono::duration<double, std::micro>(clock_type::now() - start).count(); }
+
+//Value of work-item i in group g in the given round, spread over several orders of magnitude so that rounding matters.
+//Built from integer hashing only, so host and device produce the same bits.
+inline float value(const size_t g, const size_t i, const size_t round)
+{
+    uint32_t h = uint32_t(g * 7919 + i * 104729 + round * 31337);
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return float(int(h % 2001) - 1000) * float(1u << ((h >> 27) % 24)) / 4096.f;
+}
+
+template <int Mode>
+void benchmark(queue &Q, const std::string &name, const size_t N, const size_t groups, const size_t rounds, const size_t repetitions)
+{
+    buffer<float, 1> results{range<1>(groups * 3)};
+    std::vector<double> times;
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        auto start = clock_type::now();
+        Q.submit([&](handler &h)
+                 {
+            local_accessor<float, 1> sdata(2 * 3 * N, h);
+            accessor results_acc(results, h, write_only, no_init);
+            h.parallel_for<reduce_kernel<Mode>>(nd_range(range{N * groups}, range{N}), [=](nd_item<1> nditem) {
+                auto cta = nditem.get_group();
+                auto tid = nditem.get_local_linear_id();
+                auto bid = nditem.get_group_linear_id();
+                std::array<float, 3> acc = {0.f, 0.f, 0.f};
+                for (size_t round = 0; round < rounds; round++)
+                {
+                    std::array<float, 3> vals = {value(bid, tid, round), value(bid, tid, round + 1), value(bid, tid, round + 2)};
+                    std::array<float, 3> sums;
+                    if constexpr (Mode == 0) sums = custom_reduce(cta, nditem.get_sub_group(), vals, sdata.get_pointer().get(), plus<float>{});
+                    if constexpr (Mode == 1) sums = tree_reduce(cta, vals, sdata.get_pointer().get(), plus<float>{});
+                    if constexpr (Mode == 2) sums = compensated_sum(cta, vals, sdata.get_pointer().get());
+                    for (size_t m = 0; m < 3; m++) acc[m] += sums[m];
+                }
+                if (tid == 0)
+                    for (size_t m = 0; m < 3; m++) results_acc[bid * 3 + m] = acc[m];
+            }); });
+        Q.wait_and_throw();
+        times.push_back(elapsed_us(start));
+    }
+
+    //Reference: the per-round sums in double, accumulated in float like the kernel does, so only the reduction error remains.
+    host_accessor results_acc(results, read_only);
+    double max_error = 0;
+    for (size_t g = 0; g < std::min<size_t>(groups, 64); g++)
+        for (size_t m = 0; m < 3; m++)
+        {
+            float acc = 0.f;
+            for (size_t round = 0; round < rounds; round++)
+            {
+                double sum = 0;
+                for (size_t i = 0; i < N; i++) sum += value(g, i, round + m);
+                acc += (float)sum;
+            }
+            max_error = std::max(max_error, std::abs(double(results_acc[g * 3 + m]) - acc) / std::max(1e-30, std::abs(double(acc))));
+        }
+    remove_outliers(times, 3);
+    std::cout << std::setw(16) << name << std::setw(14) << std::fixed << std::setprecision(2) << mean(times) / rounds << " +- " << stddev(times) / rounds << " us/round"
+              << std::setw(16) << std::scientific << std::setprecision(2) << max_error << " max rel. error\n" << std::defaultfloat;
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t N = argc > 1 ? std::stoi(argv[1]) : 200;
+    size_t groups = argc > 2 ? std::stoi(argv[2]) : 10000;
+    size_t rounds = argc > 3 ? std::stoi(argv[3]) : 100;
+    size_t repetitions = argc > 4 ? std::stoi(argv[4]) : 20;
+
+    queue Q(default_selector_v, property::queue::in_order());
+    std::cout << "Device: " << Q.get_device().get_info<info::device::name>() << ", N = " << N << ", groups = " << groups << ", rounds = " << rounds << "\n";
+
+    benchmark<0>(Q, "sub-group", N, groups, rounds, repetitions);
+    benchmark<1>(Q, "tree", N, groups, rounds, repetitions);
+    benchmark<2>(Q, "compensated", N, groups, rounds, repetitions);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cmath>
+#define FLOAT_TYPEDEFS(T) static_assert(std::is_floating_point<T>::value, "T must be float"); typedef std::array<T,3> coord3d; typedef std::array<T,2> coord2d; typedef T real_t;
+#define INT_TYPEDEFS(K) static_assert(std::is_integral<K>::value, "K must be integral type"); typedef std::array<K,3> node3; typedef std::array<K,2> node2; typedef K node_t; typedef std::array<K,6> node6;
+#define TEMPLATE_TYPEDEFS(T,K) FLOAT_TYPEDEFS(T) INT_TYPEDEFS(K)
+
+using namespace cl::sycl;
+
+#include "../programs/isomer_batch.cpp"
+#include "../programs/util.cpp"
+
+// Compares the IsomerBatch storage policies on the three costs that differ between them:
+// host -> device transfer, per launch overhead of a kernel touching the batch (dependency tracking for buffers), and device -> host transfer.
+// Usage: storage-policy-benchmark [N] [capacity] [launches] [repetitions]
+
+template <StoragePolicy S> class touch_batch;
+
+using clock_type = std::chrono::steady_clock;
+inline double elapsed_us(clock_type::time_point start) { return std::chrono::duration<double, std::micro>(clock_type::now() - start).count(); }
+
+void report(const std::string &policy, const std::string &what, std::vector<double> times)
+{
+    remove_outliers(times, 3);
+    std::cout << std::setw(12) << policy << std::setw(12) << what << std::setw(14) << std::fixed << std::setprecision(2) << mean(times) << " +- " << stddev(times) << " us\n";
+}
+
+template <StoragePolicy S>
+void benchmark(queue &Q, const std::string &name, const size_t N, const size_t capacity, const size_t launches, const size_t repetitions)
+{
+    TEMPLATE_TYPEDEFS(float, uint16_t);
+    IsomerBatch<float, uint16_t, S> B(N, capacity, Q);
+    std::vector<node_t> graph(N * capacity * 3, 1);
+    std::vector<coord3d> h_X(N * capacity);
+    std::vector<double> upload, launch, download;
+
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        auto start = clock_type::now();
+        copy(B.cubic_neighbours, graph.data());
+        upload.push_back(elapsed_us(start));
+
+        start = clock_type::now();
+        for (size_t l = 0; l < launches; l++)
+        {
+            Q.submit([&](handler &h)
+                     {
+                auto X_acc = B.X.view(h);
+                auto neighbours_acc = B.cubic_neighbours.view(h, read_only);
+                auto statuses_acc = B.statuses.view(h);
+                h.parallel_for<touch_batch<S>>(nd_range(range{N * capacity}, range{N}), [=](nd_item<1> nditem) {
+                    auto tid = nditem.get_local_linear_id();
+                    auto bid = nditem.get_group_linear_id();
+                    X_acc[bid * N + tid][0] += (real_t)neighbours_acc[(bid * N + tid) * 3];
+                    if (tid == 0) statuses_acc[bid] = IsomerStatus::NOT_CONVERGED;
+                }); });
+        }
+        Q.wait_and_throw();
+        launch.push_back(elapsed_us(start) / launches);
+
+        start = clock_type::now();
+        copy(h_X.data(), B.X);
+        download.push_back(elapsed_us(start));
+    }
+    report(name, "upload", upload);
+    report(name, "launch", launch);
+    report(name, "download", download);
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t N = argc > 1 ? std::stoi(argv[1]) : 200;
+    size_t capacity = argc > 2 ? std::stoi(argv[2]) : 1000;
+    size_t launches = argc > 3 ? std::stoi(argv[3]) : 100;
+    size_t repetitions = argc > 4 ? std::stoi(argv[4]) : 20;
+
+    // USM batches are only ordered by an in-order queue, use the same queue for all policies to keep the comparison fair.
+    queue Q(default_selector_v, property::queue::in_order());
+    std::cout << "Device: " << Q.get_device().get_info<info::device::name>() << ", N = " << N << ", capacity = " << capacity << "\n";
+
+    benchmark<StoragePolicy::BUFFER>(Q, "BUFFER", N, capacity, launches, repetitions);
+    benchmark<StoragePolicy::USM_DEVICE>(Q, "USM_DEVICE", N, capacity, launches, repetitions);
+    benchmark<StoragePolicy::USM_SHARED>(Q, "USM_SHARED", N, capacity, launches, repetitions);
+    benchmark<StoragePolicy::USM_HOST>(Q, "USM_HOST", N, capacity, launches, repetitions);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <CL/sycl.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include "../programs/forcefield.cpp"
+#include "test_fullerenes.cpp"
+
+// Forces the strided forcefield, which forcefield_optimise_async only picks for isomers too large for a work-group, onto C60
+// and compares it with the work-group forcefield on the same starting geometries, a different one in every slot. Both must converge every isomer,
+// to the same energy and in about the same number of iterations, the two only differ in the order of their float sums.
+// Usage: strided-forcefield-test [capacity]
+
+int main(int argc, char const *argv[])
+{
+    TEMPLATE_TYPEDEFS(float, uint16_t);
+    size_t capacity = argc > 1 ? std::stoi(argv[1]) : 4;
+    sycl::queue Q(sycl::gpu_selector_v, sycl::property::queue::in_order());
+    std::vector<node_t> graph = leapfrog(C20_graph<node_t>());
+    int N = graph.size() / 3;
+
+    IsomerBatch<real_t, node_t> work_group(N, capacity, Q), strided(N, capacity, Q);
+    load_isomers(Q, work_group, graph);
+    perturb_isomers(work_group, real_t(0.1));
+    copy(Q, strided, work_group);
+
+    Telemetry<real_t> disabled(capacity, 0, 0);
+    forcefield_optimise<PEDERSEN>(Q, work_group, 10 * N, 10 * N);
+    forcefield_optimise_strided<PEDERSEN>(Q, strided, 10 * N, 10 * N, disabled).wait();
+
+    sycl::buffer<real_t, 1> work_group_energies{sycl::range<1>(capacity)}, strided_energies{sycl::range<1>(capacity)};
+    forcefield_energies<PEDERSEN>(Q, work_group, work_group_energies);
+    forcefield_energies<PEDERSEN>(Q, strided, strided_energies);
+    std::vector<real_t> E_work_group(capacity), E_strided(capacity);
+    std::vector<size_t> work_group_iterations(capacity), strided_iterations(capacity);
+    std::vector<IsomerStatus> work_group_statuses(capacity), strided_statuses(capacity);
+    {
+        sycl::host_accessor work_group_acc(work_group_energies, sycl::read_only), strided_acc(strided_energies, sycl::read_only);
+        for (size_t i = 0; i < capacity; i++)
+        {
+            E_work_group[i] = work_group_acc[i];
+            E_strided[i] = strided_acc[i];
+        }
+    }
+    copy(work_group_iterations.data(), work_group.iterations);
+    copy(strided_iterations.data(), strided.iterations);
+    copy(work_group_statuses.data(), work_group.statuses);
+    copy(strided_statuses.data(), strided.statuses);
+
+    TestChecks check;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        std::string isomer = "isomer " + std::to_string(i) + ": ";
+        std::cout << isomer << "work-group " << E_work_group[i] << " after " << work_group_iterations[i] << " iterations, strided " << E_strided[i] << " after " << strided_iterations[i] << " iterations\n";
+        check(work_group_statuses[i] == IsomerStatus::CONVERGED && strided_statuses[i] == IsomerStatus::CONVERGED, isomer + "both converged");
+        check(std::abs(E_work_group[i] - E_strided[i]) <= 1e-3 * std::abs(E_work_group[i]), isomer + "energies agree to 1e-3");
+        double iteration_ratio = double(strided_iterations[i]) / double(std::max<size_t>(1, work_group_iterations[i]));
+        check(iteration_ratio > 0.8 && iteration_ratio < 1.25, isomer + "iteration counts agree to 25%");
+    }
+    return check.result();
+}
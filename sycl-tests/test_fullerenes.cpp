@@ -0,0 +1,105 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <random>
+
+// Small fullerenes for the tests that run the forcefield, with their graphs built in so that the tests need no input files.
+// Graphs are cubic neighbour lists in clockwise order, the layout of IsomerBatch::cubic_neighbours.
+
+//C20, the dodecahedron.
+template <typename K>
+std::vector<K> C20_graph()
+{
+    return {4, 7, 1, 0, 9, 2, 1, 11, 3, 2, 13, 4, 3, 5, 0, 4, 14, 6, 5, 16, 7, 6, 8, 0, 7, 17, 9, 8, 10, 1, 9, 18, 11, 10, 12, 2, 11, 19, 13, 12, 14, 3, 13, 15, 5, 14, 19, 16, 15, 17, 6, 16, 18, 8, 17, 19, 10, 18, 15, 12};
+}
+
+/**
+ * @brief Leapfrog transform of a fullerene graph. Every arc u -> v becomes a node of the new graph, so it has three times as many nodes.
+ *        The faces of G are kept and every node of G becomes a hexagon, the leapfrog of C20 is the icosahedral C60.
+ * @param G Cubic neighbour lists in clockwise order.
+ * @return The leapfrog graph, the node of arc u -> G[u * 3 + j] is u * 3 + j.
+ */
+template <typename K>
+std::vector<K> leapfrog(const std::vector<K> &G)
+{
+    auto arc = [&](const K u, const K v) {
+        for (int j = 0; j < 3; j++)
+            if (G[u * 3 + j] == v) return K(u * 3 + j);
+        return K(0);
+    };
+    std::vector<K> L(G.size() * 3);
+    for (size_t u = 0; u < G.size() / 3; u++)
+        for (int j = 0; j < 3; j++)
+        {
+            K v = G[u * 3 + j];
+            K next_on_face = G[v * 3 + (arc(v, (K)u) - v * 3 + 2) % 3]; //prev(v, u)
+            K prev_on_face = G[u * 3 + (j + 1) % 3];                    //next(u, v)
+            //The node of u -> v lies in the face to the left of u -> v: across the bond, then along that face in both directions.
+            L[(u * 3 + j) * 3 + 0] = arc(v, (K)u);
+            L[(u * 3 + j) * 3 + 1] = arc(v, next_on_face);
+            L[(u * 3 + j) * 3 + 2] = arc(prev_on_face, (K)u);
+        }
+    return L;
+}
+
+/**
+ * @brief Fills every slot of B with the graph, IDs 0 .. capacity - 1, and a starting geometry from tutte_layout and spherical_projection, ready to optimise.
+ */
+template <typename T, typename K, StoragePolicy S>
+void load_isomers(sycl::queue &Q, IsomerBatch<T, K, S> &B, const std::vector<K> &graph)
+{
+    size_t N = graph.size() / 3, capacity = B.capacity();
+    std::vector<K> graphs(capacity * N * 3);
+    std::vector<size_t> IDs(capacity), iterations(capacity, 0);
+    std::vector<IsomerStatus> statuses(capacity, IsomerStatus::NOT_CONVERGED);
+    for (size_t i = 0; i < capacity; i++)
+    {
+        std::copy(graph.begin(), graph.end(), graphs.begin() + i * N * 3);
+        IDs[i] = i;
+    }
+    copy(B.cubic_neighbours, graphs.data());
+    copy(B.IDs, IDs.data());
+    copy(B.iterations, iterations.data());
+    copy(B.statuses, statuses.data());
+    tutte_layout(Q, B);
+    spherical_projection(Q, B);
+    Q.wait_and_throw();
+}
+
+/**
+ * @brief Moves every node of slot i by a deterministic pseudo-random offset of at most amplitude per coordinate, seeded with i,
+ *        so that the slots of a batch filled by load_isomers start from different geometries. Slot 0 is left unperturbed.
+ */
+template <typename T, typename K, StoragePolicy S>
+void perturb_isomers(IsomerBatch<T, K, S> &B, const T amplitude)
+{
+    size_t N = B.N(), capacity = B.capacity();
+    std::vector<typename IsomerBatch<T, K, S>::coord3d> X(capacity * N);
+    copy(X.data(), B.X);
+    for (size_t i = 1; i < capacity; i++)
+    {
+        std::mt19937 generator(i);
+        std::uniform_real_distribution<T> offset(-amplitude, amplitude);
+        for (size_t j = 0; j < N; j++)
+            for (int k = 0; k < 3; k++) X[i * N + j][k] += offset(generator);
+    }
+    copy(B.X, X.data());
+}
+
+//Prints the outcome of a check and counts the failures.
+struct TestChecks
+{
+    int failures = 0;
+    void operator()(const bool ok, const std::string &what)
+    {
+        std::cout << (ok ? "PASS: " : "FAIL: ") << what << std::endl;
+        failures += !ok;
+    }
+    //Exit code of the test.
+    int result() const
+    {
+        std::cout << failures << " checks failed" << std::endl;
+        return failures == 0 ? 0 : 1;
+    }
+};